@@ -0,0 +1,151 @@
+#
+#  BSD LICENSE
+#
+#  Copyright (c) Crane Che <cranechu@gmail.com>
+#  All rights reserved.
+#
+#  Redistribution and use in source and binary forms, with or without
+#  modification, are permitted provided that the following conditions
+#  are met:
+#
+#    * Redistributions of source code must retain the above copyright
+#      notice, this list of conditions and the following disclaimer.
+#    * Redistributions in binary form must reproduce the above copyright
+#      notice, this list of conditions and the following disclaimer in
+#      the documentation and/or other materials provided with the
+#      distribution.
+#    * Neither the name of Intel Corporation nor the names of its
+#      contributors may be used to endorse or promote products derived
+#      from this software without specific prior written permission.
+#
+#  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+#  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+#  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+#  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+#  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+#  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+#  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+#  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+#  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+#  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+#  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#
+
+# -*- coding: utf-8 -*-
+
+
+# Performance benchmark suite: canonical profiles are measured with
+# ioworkers, results are saved in JSON, and compared with a baseline JSON
+# of the same format. A profile fails when its IOPS is lower, or its
+# average latency is higher, than the baseline beyond the tolerance. Run
+# by "make benchmark", or "make benchmark_tcp" on the local NVMe/TCP
+# target.
+
+
+import json
+import time
+import pytest
+import logging
+
+import nvme as d
+
+
+class Benchmark(object):
+    """collect results of profiles, and check them with the baseline"""
+
+    def __init__(self, baseline, tolerance, seconds):
+        self.tolerance = tolerance
+        self.seconds = seconds
+        self.results = {}
+        self.baseline = {}
+        if baseline:
+            with open(baseline) as f:
+                self.baseline = json.load(f).get("results", {})
+            logging.info("baseline %s: %d profiles" % (baseline, len(self.baseline)))
+
+    def record(self, name, rets, io_size, qdepth):
+        ios = sum(r.io_count_read+r.io_count_write for r in rets)
+        mseconds = max(r.mseconds for r in rets)
+        iops = ios*1000/mseconds
+        result = dict(iops=int(iops),
+                      mbps=round(iops*io_size*512/1000_000, 1),
+                      latency_avg_us=int(qdepth*1000_000/iops),
+                      latency_max_us=max(r.latency_max_us for r in rets),
+                      errors=sum(1 for r in rets if r.error))
+        self.results[name] = result
+        logging.info("%s: %s" % (name, result))
+        assert result["errors"] == 0, "ioworker error in %s" % name
+
+        base = self.baseline.get(name)
+        if base:
+            tolerance = base.get("tolerance", self.tolerance)
+            assert iops >= base["iops"]*(1-tolerance), \
+                "%s regression: %d IOPS, baseline %d IOPS, tolerance %d%%" % \
+                (name, iops, base["iops"], tolerance*100)
+            if "latency_avg_us" in base:
+                latency = result["latency_avg_us"]
+                assert latency <= base["latency_avg_us"]*(1+tolerance), \
+                    "%s regression: %d us latency, baseline %d us, tolerance %d%%" % \
+                    (name, latency, base["latency_avg_us"], tolerance*100)
+
+    def save(self, filename, nvme0):
+        with open(filename, "w") as f:
+            json.dump(dict(time=time.strftime("%Y-%m-%d %H:%M:%S"),
+                           model=nvme0.id_data(63, 24, str),
+                           firmware=nvme0.id_data(71, 64, str),
+                           seconds=self.seconds,
+                           results=self.results),
+                      f, indent=2, sort_keys=True)
+        logging.info("benchmark results are saved in %s" % filename)
+
+
+@pytest.fixture(scope="module")
+def benchmark(request, nvme0):
+    ret = Benchmark(request.config.getoption("--baseline"),
+                    request.config.getoption("--tolerance"),
+                    request.config.getoption("--seconds"))
+    yield ret
+    ret.save(request.config.getoption("--results"), nvme0)
+
+
+def run_profile(nvme0, nvme0n1, benchmark, name,
+                io_size, lba_random, read_percentage, qdepth, workers=1):
+    if qdepth > (nvme0.cap&0xffff)+1:
+        pytest.skip("qdepth %d is not supported by the device" % qdepth)
+
+    l = []
+    for i in range(workers):
+        l.append(nvme0n1.ioworker(io_size=io_size, lba_align=io_size,
+                                  lba_random=lba_random, qdepth=qdepth,
+                                  read_percentage=read_percentage,
+                                  time=benchmark.seconds).start())
+    rets = [w.close() for w in l]
+    benchmark.record(name, rets, io_size, qdepth*workers)
+
+
+@pytest.mark.parametrize("qdepth", [1, 2, 4, 8, 16, 32, 64, 128, 256])
+@pytest.mark.parametrize("read_percentage", [100, 0])
+def test_random_4k_qd_curve(nvme0, nvme0n1, benchmark, read_percentage, qdepth):
+    name = "random_4k_%s_qd%d" % ("read" if read_percentage else "write", qdepth)
+    run_profile(nvme0, nvme0n1, benchmark, name, 8, True, read_percentage, qdepth)
+
+
+@pytest.mark.parametrize("read_percentage", [100, 0])
+def test_sequential_128k(nvme0, nvme0n1, benchmark, read_percentage):
+    name = "sequential_128k_%s_qd32" % ("read" if read_percentage else "write")
+    run_profile(nvme0, nvme0n1, benchmark, name, 256, False, read_percentage, 32)
+
+
+def test_random_4k_mixed_70_30(nvme0, nvme0n1, benchmark):
+    run_profile(nvme0, nvme0n1, benchmark, "random_4k_mixed_70_30_qd64",
+                8, True, 70, 64)
+
+
+@pytest.mark.parametrize("workers", [1, 2, 4, 8])
+def test_random_4k_read_queue_scaling(nvme0, nvme0n1, benchmark, workers):
+    # each ioworker runs on its exclusive core
+    if d.cores_free() < workers:
+        pytest.skip("%d ioworkers need more free cores" % workers)
+
+    run_profile(nvme0, nvme0n1, benchmark, "random_4k_read_qd32_x%d" % workers,
+                8, True, 100, 32, workers)
@@ -32,6 +32,9 @@
 #
 
 
+from posix.uio cimport iovec
+
+
 cdef extern from "driver.h":
     ctypedef struct qpair:
         pass
@@ -43,6 +46,15 @@ cdef extern from "driver.h":
         pass
     ctypedef struct cpl:
         pass
+    ctypedef struct ioworker_mismatch:
+        unsigned long lba
+        unsigned int lba_count
+        unsigned short status
+        unsigned int expected_crc
+        unsigned int actual_crc
+        unsigned long actual_lba
+        unsigned long actual_token
+    enum: IOWORKER_SS_WINDOW_MAX
     ctypedef struct ioworker_args:
         unsigned long lba_start
         unsigned short lba_size
@@ -55,6 +67,17 @@ cdef extern from "driver.h":
         unsigned long io_count
         unsigned int seconds
         unsigned int qdepth
+        unsigned int stripe_chunk
+        unsigned int poll_idle_us
+        bint cmb_data
+        unsigned int slo_latency_us
+        unsigned int slo_percentile
+        unsigned int ss_round_seconds
+        unsigned int ss_window
+        bint known_pattern
+        bint verify_scan
+        unsigned int mismatch_max
+        ioworker_mismatch* mismatch
         unsigned int* io_counter_per_second
         unsigned int* io_counter_per_latency
     ctypedef struct ioworker_rets:
@@ -63,8 +86,52 @@ cdef extern from "driver.h":
         unsigned int mseconds
         unsigned int latency_max_us
         unsigned short error
+        int cpu_core
+        unsigned long poll_sleep_us
+        unsigned long poll_delay_us
+        unsigned int slo_qdepth
+        unsigned int slo_qdepth_min
+        unsigned int slo_qdepth_max
+        unsigned int slo_latency_us
+        unsigned long slo_iops
+        unsigned long slo_iops_min
+        unsigned long slo_iops_max
+        unsigned int ss_seconds
+        unsigned long mismatch_lba_count
+        unsigned int mismatch_count
+        unsigned long cycles_total
+        unsigned long cycles_submit
+        unsigned long cycles_fill
+        unsigned long cycles_cmdlog
+        unsigned long cycles_completion
+        unsigned long cycles_verify
+        unsigned long cycles_poll_empty
+        unsigned long cycles_idle
+        unsigned long cycles_other
+        unsigned long poll_count
+        unsigned long poll_empty_count
+
+    ctypedef struct buffer_pool:
+        unsigned long max_cached_bytes
+        unsigned long cached_bytes
+        unsigned long count_alloc
+        unsigned long count_reuse
+        int socket_id
 
+    ctypedef struct cpl_batch_entry:
+        void * cb_arg
+        unsigned int cdw0
+        unsigned int latency_us
+        unsigned short cid
+        unsigned short status
     ctypedef void(*cmd_cb_func)(void * cmd_cb_arg, const cpl * cpl)
+    ctypedef struct cpl_batch:
+        unsigned int count
+        unsigned int max
+        cmd_cb_func cb_fn
+        unsigned int completed
+        cpl_batch_entry * entries
+
     ctypedef void(*aer_cb_func)(void * are_cb_arg, const cpl * cpl)
     ctypedef void(*timeout_cb_func)(void * cb_arg, ctrlr * ctrlr,
                                     qpair * qpair, unsigned short cid)
@@ -72,8 +139,18 @@ cdef extern from "driver.h":
     int driver_init()
     int driver_fini()
     void driver_config(unsigned long cfg_word)
+    unsigned long driver_config_read()
+    int driver_numa_socket_get()
+    void driver_numa_socket_set(int socket_id)
+    int driver_core_get()
+    int driver_core_free()
+    unsigned long driver_get_ticks()
+    unsigned long driver_get_ticks_hz()
+    size_t driver_metrics(char* buf, size_t size)
+    unsigned long driver_ioworker_bytes(int pid)
 
     pcie * pcie_init(ctrlr * c)
+    int pcie_get_numa_node(pcie * pci)
     int pcie_cfg_read8(pcie * pci,
                        unsigned char * value,
                        unsigned int offset)
@@ -81,9 +158,44 @@ cdef extern from "driver.h":
                         unsigned char value,
                         unsigned int offset)
 
-    ctrlr * nvme_init(char * traddr)
-    ctrlr * nvme_probe(char * traddr)
+    ctypedef struct ctrlr_options:
+        bint use_cmb_sqs
+        char trsvcid[33]
+        char subnqn[224]
+        bint header_digest
+        bint data_digest
+        unsigned int num_io_queues
+        unsigned int io_queue_size
+
+    ctrlr * nvme_init(char * traddr, const ctrlr_options * options)
+    ctrlr * nvme_probe(char * traddr, const ctrlr_options * options)
+    int nvme_probe_multi(char ** traddrs,
+                         unsigned int count,
+                         const ctrlr_options * options,
+                         ctrlr ** ctrlrs,
+                         unsigned long * attach_us,
+                         int * errors)
     int nvme_fini(ctrlr * c)
+    unsigned long nvme_admin_change_count()
+
+    ctypedef struct nvme_reset_stat:
+        unsigned long reset_us
+        unsigned long first_io_us
+
+    int nvme_reset(ctrlr * c)
+    nvme_reset_stat * nvme_get_reset_stat()
+
+    ctypedef struct nvme_recovery_ticks:
+        unsigned long start
+        unsigned long cc_en_clear
+        unsigned long csts_rdy_clear
+        unsigned long cc_en_set
+        unsigned long csts_rdy_set
+        unsigned long shst_complete
+
+    int nvme_recovery_monitor_start(ctrlr * c)
+    nvme_recovery_ticks * nvme_recovery_monitor_stop()
+
     int nvme_set_reg32(ctrlr * c,
                        unsigned int offset,
                        unsigned int value)
@@ -116,10 +228,31 @@ cdef extern from "driver.h":
 
     void * buffer_init(size_t bytes, unsigned long* phys_addr)
     void buffer_fini(void * buf)
+    void buffer_fill_pattern(void * buf, size_t len,
+                             const void * pattern, size_t pattern_len)
+    long buffer_mismatch(const void * buf1, const void * buf2, size_t len)
+    unsigned int buffer_crc32c(const void * buf, size_t len)
+    buffer_pool * buffer_pool_create(unsigned long max_cached_bytes, int socket_id)
+    void * buffer_pool_alloc(buffer_pool * pool, size_t bytes,
+                             unsigned long * phys_addr, bint zero)
+    void buffer_pool_free(buffer_pool * pool, void * buf, size_t bytes)
+    void buffer_pool_clear(buffer_pool * pool)
+    void buffer_pool_destroy(buffer_pool * pool)
+    void * buffer_cmb_alloc(ctrlr * c, size_t bytes, bint zero)
+    void buffer_cmb_free(ctrlr * c, void * buf, size_t bytes)
+
+    enum: DOORBELL_BATCH_HIST_NUM
+    ctypedef struct qpair_doorbell_stat:
+        unsigned long batch_hist[DOORBELL_BATCH_HIST_NUM]
+        unsigned long rings
+        unsigned long cmds
 
-    qpair * qpair_create(ctrlr * c, int prio, int depth)
+    qpair * qpair_create(ctrlr * c, int prio, int depth,
+                         bint delay_doorbell, int cmb_sq)
     int qpair_wait_completion(qpair * q, unsigned int max_completions)
+    int qpair_wait_completion_batch(qpair * q, cpl_batch * batch)
     int qpair_get_id(qpair * q)
+    qpair_doorbell_stat * qpair_get_doorbell_stat(qpair * q)
     int qpair_free(qpair * q)
 
     namespace * ns_init(ctrlr * c, unsigned int nsid)
@@ -133,6 +266,16 @@ cdef extern from "driver.h":
                           unsigned int io_flags,
                           cmd_cb_func cb_fn,
                           void * cb_arg)
+    int ns_cmd_read_write_vec(bint is_read,
+                              namespace * ns,
+                              qpair * qpair,
+                              const iovec * iov,
+                              int iovcnt,
+                              unsigned long lba,
+                              unsigned int lba_count,
+                              unsigned int io_flags,
+                              cmd_cb_func cb_fn,
+                              void * cb_arg)
     unsigned int ns_get_sector_size(namespace * ns)
     unsigned long ns_get_num_sectors(namespace * ns)
     int ns_fini(namespace * ns)
@@ -142,9 +285,30 @@ cdef extern from "driver.h":
                        qpair* qpair,
                        ioworker_args* args,
                        ioworker_rets* rets)
+    int ioworker_entry_striped(namespace** ns,
+                               qpair** qpair,
+                               unsigned int count,
+                               ioworker_args* args,
+                               ioworker_rets* rets,
+                               ioworker_rets* target_rets)
 
     void log_buf_dump(const char * header, const void * buf, size_t len)
     void log_cmd_dump(qpair * qpair, size_t count)
     void log_cmd_dump_admin(ctrlr * ctrlr, size_t count)
 
+    ctypedef struct slow_io_cmd:
+        unsigned long time_cmd_us
+        unsigned long time_cpl_us
+        unsigned int cmd[16]
+        unsigned int cpl[4]
+    ctypedef struct slow_io_record:
+        unsigned short qid
+        unsigned short neighbour_count
+        unsigned int latency_us
+        unsigned int inflight
+        slow_io_cmd io
+        slow_io_cmd neighbour[8]
+    int log_slow_io_trace(unsigned int threshold_us, unsigned int max)
+    slow_io_record* log_slow_io_get(unsigned int* count, unsigned long* dropped)
+
     const char* cmd_name(unsigned char opc, int set)
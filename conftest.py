@@ -11,6 +11,21 @@ def pytest_addoption(parser):
     parser.addoption(
         "--pciaddr", action="store", default="", help="pci (BDF) address of the device under test, e.g.: 02:00.0"
     )
+    parser.addoption(
+        "--pciaddr2", action="store", default="", help="pci (BDF) address of the second device, for tests across controllers"
+    )
+    parser.addoption(
+        "--baseline", action="store", default="", help="baseline JSON file of benchmark results to compare with"
+    )
+    parser.addoption(
+        "--results", action="store", default="benchmark.json", help="JSON file to save benchmark results"
+    )
+    parser.addoption(
+        "--tolerance", action="store", type=float, default=0.1, help="allowed performance drop from the baseline, e.g.: 0.1 for 10%%"
+    )
+    parser.addoption(
+        "--seconds", action="store", type=int, default=10, help="seconds of each benchmark profile"
+    )
 
 
 @pytest.fixture(scope="session")
@@ -33,6 +48,15 @@ def script(request):
     logging.info("test duration: %.3f sec" % (time.time()-start_time))
 
 
+@pytest.fixture(scope="session")
+def pciaddr2(request):
+    ret = request.config.getoption("--pciaddr2")
+    if not ret:
+        pytest.skip("no second device")
+    logging.info("second DUT %s" % ret)
+    return ret
+
+
 @pytest.fixture(scope="session")
 def nvme0(pciaddr):
     ret = d.Controller(pciaddr.encode('utf-8'))
@@ -62,6 +86,16 @@ def nvme0n1(nvme0):
     del ret
 
     
+@pytest.fixture(scope="session")
+def nvme1n1(pciaddr2):
+    nvme1 = d.Controller(pciaddr2.encode('utf-8'))
+    ret = d.Namespace(nvme1, 1)
+    yield ret
+    ret.close()
+    del ret
+    del nvme1
+
+    
 @pytest.fixture(scope="function")
 def aer(nvme0):
     def register_cb(func):
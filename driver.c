@@ -35,9 +35,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <string.h>
+#include <sched.h>
+#include <signal.h>
 #include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <sys/time.h>
 #include <sys/sysinfo.h>
 
@@ -51,8 +57,17 @@
 #include "driver.h"
 
 
+// crc32c of NVMe/TCP digests and data verification is accelerated by
+// SSE4.2 instructions, spdk is built in the same flags (CONFIG_ARCH)
+#if defined(__x86_64__) && !defined(__SSE4_2__)
+#define DRIVER_CRC32C_SLOW        (true)
+#else
+#define DRIVER_CRC32C_SLOW        (false)
+#endif
+
 #define US_PER_S              (1000ULL*1000ULL)
 #define MIN(X,Y)              ((X) < (Y) ? (X) : (Y))
+#define MAX(X,Y)              ((X) > (Y) ? (X) : (Y))
 
 #ifndef BIT
 #define BIT(a)                (1UL << (a))
@@ -68,12 +83,56 @@
 #define DRIVER_IO_TOKEN_NAME      "driver_io_token"
 #define DRIVER_CRC32_TABLE_NAME   "driver_crc32_table"
 #define DRIVER_GLOBAL_CONFIG_NAME "driver_global_config"
+#define DRIVER_CORE_TABLE_NAME    "/pynvme_core_table"  // posix shm
+#define DRIVER_MAX_CORES          (64)  // cores in the 64-bit core mask
+#define DRIVER_CORE_WAIT_S        (10)  // seconds to wait for a free core
+#define DRIVER_STAT_TABLE_NAME    "driver_stat_table"
+#define DRIVER_INFLIGHT_NAME      "driver_inflight_table"
+#define DRIVER_INFLIGHT_NUM       (64*1024)  // latest writes tracked
+#define DRIVER_INFLIGHT_WAIT_US   (10*1000)  // wait a write to publish its entry
+#define DRIVER_PENDING_NAME       "driver_pending_table"
 
 // TODO: support multiple namespace
 static uint64_t g_driver_table_size = 0;
 static uint64_t* g_driver_io_token_ptr = NULL;
 static uint32_t* g_driver_csum_table_ptr = NULL;
+static struct inflight_table* g_driver_inflight_ptr = NULL;
+static uint16_t* g_driver_pending_ptr = NULL;
 static uint64_t* g_driver_global_config_ptr = NULL;
+// NUMA socket of DMA buffers allocated by this process
+static int g_driver_numa_socket = SPDK_ENV_SOCKET_ID_ANY;
+// owner pid of each core, shared by all processes. It is not a memzone,
+// since the core is claimed before spdk env init.
+static pid_t* g_driver_core_table_ptr = NULL;
+// cores allowed to this process, and the one it claimed
+static int g_driver_core_allowed[DRIVER_MAX_CORES];
+static int g_driver_core_allowed_count = 0;
+static int g_driver_core = -1;
+
+// in-flight writes: crc is committed to the table when the write
+// completes, and a mismatched read is skipped if it races with any
+// write to the lba. Writes are kept in a ring in the order of
+// submission, and stamps order submissions and completions.
+struct inflight_entry {
+  uint64_t seq;  // published at last, to detect a reused entry
+  uint64_t lba;
+  uint64_t submit_stamp;
+  uint64_t complete_stamp;  // 0 if it is still in flight
+  uint32_t lba_count;
+  uint32_t rsvd;
+};
+
+struct inflight_table {
+  uint64_t write_seq;
+  uint64_t stamp;
+  struct inflight_entry entry[DRIVER_INFLIGHT_NUM];
+};
+
+// write: its seq and submit stamp; read: the latest seq and stamp
+struct inflight_snapshot {
+  uint64_t seq;
+  uint64_t stamp;
+};
 
 static int memzone_reserve_shared_memory(uint64_t table_size)
 {
@@ -91,6 +150,26 @@ static int memzone_reserve_shared_memory(uint64_t table_size)
     g_driver_io_token_ptr = spdk_memzone_reserve(DRIVER_IO_TOKEN_NAME,
                                                  sizeof(uint64_t),
                                                  0, 0);
+    g_driver_inflight_ptr = spdk_memzone_reserve(DRIVER_INFLIGHT_NAME,
+                                                 sizeof(struct inflight_table),
+                                                 0, SPDK_MEMZONE_NO_IOVA_CONTIG);
+    if (g_driver_inflight_ptr != NULL)
+    {
+      // stamp 0 is reserved for writes in flight, and seq 0 is never
+      // used, so the empty entries are not taken as published
+      memset(g_driver_inflight_ptr, 0, sizeof(struct inflight_table));
+      g_driver_inflight_ptr->stamp = 1;
+      g_driver_inflight_ptr->write_seq = 1;
+    }
+
+    // pending writes of each lba, half size of the crc table
+    g_driver_pending_ptr = spdk_memzone_reserve(DRIVER_PENDING_NAME,
+                                                table_size/2,
+                                                0, SPDK_MEMZONE_NO_IOVA_CONTIG);
+    if (g_driver_pending_ptr != NULL)
+    {
+      memset(g_driver_pending_ptr, 0, table_size/2);
+    }
   }
   else
   {
@@ -98,6 +177,8 @@ static int memzone_reserve_shared_memory(uint64_t table_size)
     g_driver_table_size = table_size;
     g_driver_io_token_ptr = spdk_memzone_lookup(DRIVER_IO_TOKEN_NAME);
     g_driver_csum_table_ptr = spdk_memzone_lookup(DRIVER_CRC32_TABLE_NAME);
+    g_driver_inflight_ptr = spdk_memzone_lookup(DRIVER_INFLIGHT_NAME);
+    g_driver_pending_ptr = spdk_memzone_lookup(DRIVER_PENDING_NAME);
   }
 
   if (g_driver_csum_table_ptr == NULL)
@@ -141,9 +222,226 @@ static void crc32_fini(void)
   {
     spdk_memzone_free(DRIVER_IO_TOKEN_NAME);
     spdk_memzone_free(DRIVER_CRC32_TABLE_NAME);
+    spdk_memzone_free(DRIVER_INFLIGHT_NAME);
+    spdk_memzone_free(DRIVER_PENDING_NAME);
   }
   g_driver_io_token_ptr = NULL;
   g_driver_csum_table_ptr = NULL;
+  g_driver_inflight_ptr = NULL;
+  g_driver_pending_ptr = NULL;
+}
+
+static void inflight_write_begin(struct inflight_snapshot* w,
+                                 uint64_t lba,
+                                 uint32_t lba_count)
+{
+  struct inflight_entry* e;
+
+  if (g_driver_inflight_ptr == NULL)
+  {
+    return;
+  }
+
+  w->seq = __atomic_fetch_add(&g_driver_inflight_ptr->write_seq, 1, __ATOMIC_RELAXED);
+  w->stamp = __atomic_fetch_add(&g_driver_inflight_ptr->stamp, 1, __ATOMIC_SEQ_CST);
+  e = &g_driver_inflight_ptr->entry[w->seq % DRIVER_INFLIGHT_NUM];
+  e->lba = lba;
+  e->lba_count = lba_count;
+  e->submit_stamp = w->stamp;
+  e->complete_stamp = 0;
+  __atomic_store_n(&e->seq, w->seq, __ATOMIC_RELEASE);
+}
+
+// after the crc is committed
+static void inflight_write_end(struct inflight_snapshot* w)
+{
+  struct inflight_entry* e;
+  uint64_t stamp;
+
+  if (g_driver_inflight_ptr == NULL)
+  {
+    return;
+  }
+
+  stamp = __atomic_fetch_add(&g_driver_inflight_ptr->stamp, 1, __ATOMIC_SEQ_CST);
+  e = &g_driver_inflight_ptr->entry[w->seq % DRIVER_INFLIGHT_NUM];
+  if (__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) == w->seq)
+  {
+    __atomic_store_n(&e->complete_stamp, stamp, __ATOMIC_RELEASE);
+  }
+}
+
+static void inflight_read_begin(struct inflight_snapshot* r)
+{
+  if (g_driver_inflight_ptr == NULL)
+  {
+    return;
+  }
+
+  r->seq = __atomic_load_n(&g_driver_inflight_ptr->write_seq, __ATOMIC_SEQ_CST);
+  r->stamp = __atomic_load_n(&g_driver_inflight_ptr->stamp, __ATOMIC_SEQ_CST);
+}
+
+// get the entry of write seq s. A write takes its seq before it
+// publishes the entry, so wait a while for an entry not published yet.
+// Returns -1 if the entry is reused by a newer write, or never published.
+static int inflight_entry_get(uint64_t s,
+                              uint64_t* lba,
+                              uint32_t* lba_count,
+                              uint64_t* complete)
+{
+  struct inflight_entry* e = &g_driver_inflight_ptr->entry[s % DRIVER_INFLIGHT_NUM];
+  uint64_t timeout = 0;
+
+  while (1)
+  {
+    uint64_t seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+
+    if (seq == s)
+    {
+      *lba = e->lba;
+      *lba_count = e->lba_count;
+      *complete = __atomic_load_n(&e->complete_stamp, __ATOMIC_ACQUIRE);
+
+      // re-read to make sure fields are not changed by a newer write
+      if (__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) == s)
+      {
+        return 0;
+      }
+      return -1;
+    }
+
+    if (seq > s)
+    {
+      return -1;
+    }
+
+    if (timeout == 0)
+    {
+      timeout = spdk_get_ticks() + DRIVER_INFLIGHT_WAIT_US*spdk_get_ticks_hz()/US_PER_S;
+    }
+    else if (spdk_get_ticks() > timeout)
+    {
+      return -1;
+    }
+  }
+}
+
+// a write races with the read when it overlaps the lba, and it was not
+// completed before the read is submitted. Only checked on mismatch. If
+// any write cannot be told from the ring, the mismatch is reported.
+static bool inflight_racing(const struct inflight_snapshot* r, uint64_t lba)
+{
+  uint64_t seq;
+
+  if (g_driver_inflight_ptr == NULL || r == NULL)
+  {
+    return false;
+  }
+
+  seq = __atomic_load_n(&g_driver_inflight_ptr->write_seq, __ATOMIC_SEQ_CST);
+  if (seq - r->seq >= DRIVER_INFLIGHT_NUM)
+  {
+    SPDK_ERRLOG("in-flight writes overflow, report mismatch of lba 0x%lx\n", lba);
+    return false;
+  }
+
+  for (uint64_t i=0; i<MIN(seq-1, DRIVER_INFLIGHT_NUM); i++)
+  {
+    uint64_t s = seq-1-i;
+    uint64_t e_lba;
+    uint32_t e_count;
+    uint64_t complete;
+
+    if (inflight_entry_get(s, &e_lba, &e_count, &complete) != 0)
+    {
+      SPDK_ERRLOG("in-flight write %ld is unknown, report mismatch of lba 0x%lx\n", s, lba);
+      return false;
+    }
+
+    if (lba >= e_lba && lba < e_lba+e_count &&
+        (complete == 0 || complete > r->stamp))
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// pending writes of each lba: the count of writes in flight, and a flag
+// set when they overlap. The order of overlapping writes on the media is
+// unknown, so the lba is unmapped when any of them completes. The flag
+// is cleared by the last one.
+#define PENDING_OVERLAP  (0x8000)
+
+static void pending_write_begin(uint64_t lba, uint32_t lba_count)
+{
+  if (g_driver_pending_ptr == NULL)
+  {
+    return;
+  }
+
+  for (uint32_t i=0; i<lba_count; i++)
+  {
+    uint16_t* p = &g_driver_pending_ptr[lba+i];
+
+    if ((__atomic_fetch_add(p, 1, __ATOMIC_SEQ_CST) & ~PENDING_OVERLAP) != 0)
+    {
+      __atomic_fetch_or(p, PENDING_OVERLAP, __ATOMIC_SEQ_CST);
+    }
+  }
+}
+
+static inline void pending_write_done(uint64_t lba, uint32_t crc)
+{
+  uint16_t* p = &g_driver_pending_ptr[lba];
+  uint16_t old;
+
+  // the crc is committed before the write is removed, so a write
+  // submitted meanwhile is taken as overlapped
+  if (g_driver_csum_table_ptr != NULL && crc != 0)
+  {
+    g_driver_csum_table_ptr[lba] = crc;
+  }
+
+  old = __atomic_fetch_sub(p, 1, __ATOMIC_SEQ_CST);
+  if ((old & PENDING_OVERLAP) != 0 || (old & ~PENDING_OVERLAP) > 1)
+  {
+    if (g_driver_csum_table_ptr != NULL)
+    {
+      g_driver_csum_table_ptr[lba] = 0;
+    }
+  }
+
+  if (old == (PENDING_OVERLAP|1))
+  {
+    __sync_bool_compare_and_swap(p, PENDING_OVERLAP, 0);
+  }
+}
+
+// commit crc of the lbas when the write completes, or 0 to only remove
+// the write not submitted. Suppose device modify data correctly. If the
+// command fail, we cannot tell what part of data is updated, while what
+// not. Even when atomic write is supported, we still cannot tell that.
+static void pending_write_end(uint64_t lba,
+                              uint32_t lba_count,
+                              const uint32_t* crc,
+                              uint32_t crc_all)
+{
+  for (uint32_t i=0; i<lba_count; i++)
+  {
+    uint32_t c = crc ? crc[i] : crc_all;
+
+    if (g_driver_pending_ptr != NULL)
+    {
+      pending_write_done(lba+i, c);
+    }
+    else if (g_driver_csum_table_ptr != NULL && c != 0)
+    {
+      g_driver_csum_table_ptr[lba+i] = c;
+    }
+  }
 }
 
 
@@ -161,18 +459,58 @@ void* buffer_init(size_t bytes, uint64_t *phys_addr)
   return buf;
 }
 
+// known pattern: the first 64bit-word is lba, and all others are the
+// pattern, so the data is verified without crc
+#define BUFFER_KNOWN_CRC      (0xfefefefe)
+#define BUFFER_KNOWN_PATTERN  (0x5a5aa5a5c3c33c3cULL)
+
 static inline uint32_t buffer_calc_csum(uint64_t* ptr, int len)
 {
   uint32_t crc = spdk_crc32c_update(ptr, len, 0);
 
   //reserve 0: nomapping
   //reserve 0xffffffff: uncorrectable
+  //reserve 0xfefefefe: known pattern
   if (crc == 0) crc = 1;
   if (crc == 0xffffffff) crc = 0xfffffffe;
+  if (crc == BUFFER_KNOWN_CRC) crc = BUFFER_KNOWN_CRC-1;
   
   return crc;
 }
 
+static inline void buffer_fill_lba(uint64_t* ptr,
+                                   uint64_t lba,
+                                   uint64_t token,
+                                   uint32_t lba_size)
+{
+  //first and last 64bit-words are filled with special data, and crc
+  //is committed when the write completes
+  ptr[0] = lba;
+  ptr[lba_size/sizeof(uint64_t)-1] = token;
+}
+
+// crc of the data is calculated when the write is submitted, since the
+// buffer could be changed before the write completes, and it is kept
+// with the command till it is committed at completion
+static uint32_t* buffer_calc_data(void* buf,
+                                  uint32_t lba_count,
+                                  uint32_t lba_size)
+{
+  uint32_t* crc = malloc(lba_count*sizeof(uint32_t));
+
+  if (crc == NULL)
+  {
+    return NULL;
+  }
+
+  for (uint32_t i=0; i<lba_count; i++)
+  {
+    crc[i] = buffer_calc_csum((uint64_t*)(buf+i*lba_size), lba_size);
+  }
+
+  return crc;
+}
+
 static void buffer_fill_data(void* buf,
                              uint64_t lba,
                              uint32_t lba_count,
@@ -188,1105 +526,4078 @@ static void buffer_fill_data(void* buf,
 
   for (uint32_t i=0; i<lba_count; i++, lba++)
   {
-    uint64_t* ptr = (uint64_t*)(buf+i*lba_size);
+    buffer_fill_lba((uint64_t*)(buf+i*lba_size), lba, token+i, lba_size);
+  }
+}
 
-    //first and last 64bit-words are filled with special data
-    ptr[0] = lba;
-    ptr[lba_size/sizeof(uint64_t)-1] = token+i;
+// fill the buffer of known pattern once, only lba is updated for each IO
+static void buffer_known_init(void* buf, size_t len)
+{
+  uint64_t* ptr = (uint64_t*)buf;
 
-    //keep crc in memory if allocated
-    // suppose device modify data correctly. If the command fail, we cannot
-    // tell what part of data is updated, while what not. Even when atomic
-    // write is supported, we still cannot tell that.
-    if (g_driver_csum_table_ptr != NULL)
+  for (size_t i=0; i<len/sizeof(uint64_t); i++)
+  {
+    ptr[i] = BUFFER_KNOWN_PATTERN;
+  }
+}
+
+static void buffer_known_fill(void* buf,
+                              uint64_t lba,
+                              uint32_t lba_count,
+                              uint32_t lba_size)
+{
+  for (uint32_t i=0; i<lba_count; i++)
+  {
+    *(uint64_t*)(buf+i*lba_size) = lba+i;
+  }
+}
+
+static int buffer_known_verify_lba(const uint64_t* ptr,
+                                   const uint64_t lba,
+                                   const uint32_t lba_size,
+                                   const bool quiet)
+{
+  for (uint32_t i=1; i<lba_size/sizeof(uint64_t); i++)
+  {
+    if (ptr[i] != BUFFER_KNOWN_PATTERN)
     {
-      g_driver_csum_table_ptr[lba] = buffer_calc_csum(ptr, lba_size);
+      if (!quiet)
+      {
+        SPDK_WARNLOG("pattern mismatch: lba 0x%lx, offset %ld, got: 0x%lx\n",
+                     lba, i*sizeof(uint64_t), ptr[i]);
+      }
+      return -3;
     }
   }
+
+  return 0;
 }
 
-static int buffer_verify_data(const void* buf,
-                              const unsigned long lba_first,
-                              const uint32_t lba_count,
-                              const uint32_t lba_size)
+// quiet check is used by scanners which report mismatches by themselves
+static int buffer_check_lba(const uint64_t* ptr,
+                            const uint64_t lba,
+                            const uint32_t lba_size,
+                            const bool quiet)
 {
-  unsigned long lba = lba_first;
+  uint32_t computed_crc;
+  uint32_t expected_crc;
 
-  for (uint32_t i=0; i<lba_count; i++, lba++)
+  // if crc table is not available, just use computed crc as
+  //expected crc, to bypass verification
+  if (g_driver_csum_table_ptr != NULL)
+  {
+    expected_crc = g_driver_csum_table_ptr[lba];
+  }
+  else
   {
-    unsigned long* ptr = (unsigned long*)(buf+i*lba_size);
-    uint32_t computed_crc = buffer_calc_csum(ptr, lba_size);
-    uint32_t expected_crc = computed_crc;
+    expected_crc = buffer_calc_csum((uint64_t*)ptr, lba_size);
+  }
 
-    // if crc table is not available, just use computed crc as
-    //expected crc, to bypass verification
-    if (g_driver_csum_table_ptr != NULL)
-    {
-      expected_crc = g_driver_csum_table_ptr[lba];
-    }
+  if (expected_crc == 0)
+  {
+    //no mapping, nothing to verify
+    return 0;
+  }
 
-    if (expected_crc == 0)
-    {
-      //no mapping, nothing to verify
-      continue;
-    }
-    
-    if (expected_crc == 0xffffffff)
+  if (expected_crc == 0xffffffff)
+  {
+    if (!quiet)
     {
       SPDK_WARNLOG("lba uncorrectable: lba 0x%lx\n", lba);
-      return -1;
     }
+    return -1;
+  }
 
-    if (lba != ptr[0])
+  if (lba != ptr[0])
+  {
+    if (!quiet)
     {
       SPDK_WARNLOG("lba mismatch: lba 0x%lx, but got: 0x%lx\n", lba, ptr[0]);
-      return -2;
     }
-    
-    if (computed_crc != expected_crc)
+    return -2;
+  }
+
+  if (expected_crc == BUFFER_KNOWN_CRC)
+  {
+    return buffer_known_verify_lba(ptr, lba, lba_size, quiet);
+  }
+
+  computed_crc = buffer_calc_csum((uint64_t*)ptr, lba_size);
+  if (computed_crc != expected_crc)
+  {
+    if (!quiet)
     {
       SPDK_WARNLOG("crc mismatch: lba 0x%lx, expected crc 0x%x, but got: 0x%x\n",
                    lba, expected_crc, computed_crc);
-      return -3;
     }
+    return -3;
   }
-  
+
   return 0;
 }
 
-void buffer_fini(void* buf)
+static inline int buffer_verify_lba(const uint64_t* ptr,
+                                    const uint64_t lba,
+                                    const uint32_t lba_size,
+                                    const struct inflight_snapshot* r)
 {
-  SPDK_DEBUGLOG(SPDK_LOG_NVME, "buffer: free ptr at %p\n", buf);
-  assert(buf != NULL);
-  spdk_dma_free(buf);
-}
-
+  if (0 == buffer_check_lba(ptr, lba, lba_size, true))
+  {
+    return 0;
+  }
 
-////cmd log
-///////////////////////////////
+  // skip the lba racing with writes, the data could be old or new
+  if (true == inflight_racing(r, lba))
+  {
+    SPDK_DEBUGLOG(SPDK_LOG_NVME, "skip verify lba 0x%lx in flight\n", lba);
+    return 0;
+  }
 
-// log_table contains latest cmd and cpl and their timestamps
-// queue_table traces cmd log tables by queue pairs
-// CMD_LOG_DEPTH should be larger than Q depth to keep all outstanding commands.
-#define CMD_LOG_DEPTH (2048-1)  // reserved one slot space for tail value
-#define CMD_LOG_MAX_Q (16)
+  return buffer_check_lba(ptr, lba, lba_size, false);
+}
 
-struct cmd_log_entry_t {
-  // cmd and cpl
-  struct timeval time_cmd;
-  struct spdk_nvme_cmd cmd;
-  struct timeval time_cpl;
-  struct spdk_nvme_cpl cpl;
+static int buffer_verify_data(const void* buf,
+                              const unsigned long lba_first,
+                              const uint32_t lba_count,
+                              const uint32_t lba_size,
+                              const struct inflight_snapshot* r)
+{
+  unsigned long lba = lba_first;
 
-  // for data verification after read
-  void* buf;
-  uint64_t lba;
-  uint16_t lba_count;
-  uint32_t lba_size;
+  for (uint32_t i=0; i<lba_count; i++, lba++)
+  {
+    int ret = buffer_verify_lba((uint64_t*)(buf+i*lba_size), lba, lba_size, r);
+    if (ret != 0)
+    {
+      return ret;
+    }
+  }
   
-  // callback to user functions
-  spdk_nvme_cmd_cb cb_fn;
-  void* cb_arg;
-
-  uint64_t dummy[5];
-};
-static_assert(sizeof(struct cmd_log_entry_t) == 192, "cacheline aligned");
+  return 0;
+}
 
-struct cmd_log_table_t {
-  struct cmd_log_entry_t table[CMD_LOG_DEPTH];
-  uint32_t tail_index;
-  uint32_t dummy[47];
-};
-static_assert(sizeof(struct cmd_log_table_t) == sizeof(struct cmd_log_entry_t)*(CMD_LOG_DEPTH+1), "cacheline aligned");
 
-#define DRIVER_CMDLOG_TABLE_NAME  "driver_cmdlog_table"
-static struct cmd_log_table_t* cmd_log_queue_table;
+// scattered buffers: an LBA may cross the boundary of segments, and
+// it is gathered into (or scattered from) a bounce buffer then
+#define IOV_BOUNCE_SIZE       (4096)
 
+struct iov_cursor {
+  const struct iovec* iov;
+  int iovcnt;
+  int index;
+  size_t offset;
+};
 
-static unsigned int timeval_to_us(struct timeval* t)
+static void iov_cursor_init(struct iov_cursor* c,
+                            const struct iovec* iov,
+                            int iovcnt)
 {
-  return t->tv_sec*US_PER_S + t->tv_usec;
+  c->iov = iov;
+  c->iovcnt = iovcnt;
+  c->index = 0;
+  c->offset = 0;
 }
 
-
-static void cmd_log_qpair_init(uint16_t qid)
+// get the pointer of next len bytes if they are in one segment, or NULL
+static void* iov_cursor_contig(struct iov_cursor* c, size_t len)
 {
-  assert(qid < CMD_LOG_MAX_Q);
+  void* ptr;
 
-  // set tail to invalid value, means the qpair is empty
-  cmd_log_queue_table[qid].tail_index = 0;
-}
+  // skip exhausted segments
+  while (c->index < c->iovcnt && c->offset == c->iov[c->index].iov_len)
+  {
+    c->index ++;
+    c->offset = 0;
+  }
 
+  assert(c->index < c->iovcnt);
+  if (c->iov[c->index].iov_len - c->offset < len)
+  {
+    return NULL;
+  }
 
-static void cmd_log_qpair_clear(uint16_t qid)
+  ptr = c->iov[c->index].iov_base + c->offset;
+  c->offset += len;
+  return ptr;
+}
+
+static void iov_cursor_copy(struct iov_cursor* c,
+                            void* buf,
+                            size_t len,
+                            bool to_iov)
 {
-  assert(qid < CMD_LOG_MAX_Q);
+  while (len > 0)
+  {
+    size_t n;
+    void* seg;
 
-  // set tail to invalid value, means the qpair is empty
-  cmd_log_queue_table[qid].tail_index = CMD_LOG_DEPTH;
-}
+    while (c->offset == c->iov[c->index].iov_len)
+    {
+      c->index ++;
+      c->offset = 0;
+      assert(c->index < c->iovcnt);
+    }
 
+    n = MIN(len, c->iov[c->index].iov_len - c->offset);
+    seg = c->iov[c->index].iov_base + c->offset;
+    if (to_iov)
+    {
+      memcpy(seg, buf, n);
+    }
+    else
+    {
+      memcpy(buf, seg, n);
+    }
 
-static int cmd_log_init(void)
+    c->offset += n;
+    buf += n;
+    len -= n;
+  }
+}
+
+static void buffer_fill_data_iov(const struct iovec* iov,
+                                 int iovcnt,
+                                 uint64_t lba,
+                                 uint32_t lba_count,
+                                 uint32_t lba_size)
 {
-  if (spdk_process_is_primary())
+  uint64_t bounce[IOV_BOUNCE_SIZE/sizeof(uint64_t)];
+  struct iov_cursor c;
+  uint64_t token = __atomic_fetch_add(g_driver_io_token_ptr,
+                                      lba_count,
+                                      __ATOMIC_SEQ_CST);
+
+  assert(lba_size <= sizeof(bounce));
+  iov_cursor_init(&c, iov, iovcnt);
+  for (uint32_t i=0; i<lba_count; i++, lba++)
   {
-    cmd_log_queue_table = spdk_memzone_reserve(DRIVER_CMDLOG_TABLE_NAME,
-                                               sizeof(struct cmd_log_table_t)*CMD_LOG_MAX_Q, 
-                                               0, SPDK_MEMZONE_NO_IOVA_CONTIG);
+    struct iov_cursor start = c;
+    uint64_t* ptr = iov_cursor_contig(&c, lba_size);
 
-    // clear all qpair's cmd log
-    for (int i=0; i<CMD_LOG_MAX_Q; i++)
+    if (ptr != NULL)
     {
-      cmd_log_qpair_clear(i);
+      buffer_fill_lba(ptr, lba, token+i, lba_size);
+    }
+    else
+    {
+      // the lba crosses segments: gather, fill, and scatter back
+      c = start;
+      iov_cursor_copy(&c, bounce, lba_size, false);
+      buffer_fill_lba(bounce, lba, token+i, lba_size);
+      c = start;
+      iov_cursor_copy(&c, bounce, lba_size, true);
     }
-
-    // also init config word with cmdlog
-    g_driver_global_config_ptr = spdk_memzone_reserve(DRIVER_GLOBAL_CONFIG_NAME,
-                                                      sizeof(uint64_t),
-                                                      0, 0);
-    *g_driver_global_config_ptr = 0;
   }
-  else
+}
+
+static uint32_t* buffer_calc_data_iov(const struct iovec* iov,
+                                      int iovcnt,
+                                      uint32_t lba_count,
+                                      uint32_t lba_size)
+{
+  uint64_t bounce[IOV_BOUNCE_SIZE/sizeof(uint64_t)];
+  struct iov_cursor c;
+  uint32_t* crc = malloc(lba_count*sizeof(uint32_t));
+
+  if (crc == NULL)
   {
-    cmd_log_queue_table = spdk_memzone_lookup(DRIVER_CMDLOG_TABLE_NAME);
-    g_driver_global_config_ptr = spdk_memzone_lookup(DRIVER_GLOBAL_CONFIG_NAME);
+    return NULL;
   }
 
-  if (cmd_log_queue_table == NULL)
+  assert(lba_size <= sizeof(bounce));
+  iov_cursor_init(&c, iov, iovcnt);
+  for (uint32_t i=0; i<lba_count; i++)
   {
-    fprintf(stderr, "Cannot allocate or find the cmdlog memory!\n");
-    return -1;
+    struct iov_cursor start = c;
+    uint64_t* ptr = iov_cursor_contig(&c, lba_size);
+
+    if (ptr == NULL)
+    {
+      c = start;
+      iov_cursor_copy(&c, bounce, lba_size, false);
+      ptr = bounce;
+    }
+
+    crc[i] = buffer_calc_csum(ptr, lba_size);
   }
 
-  return 0;
+  return crc;
 }
 
-
-static void cmd_log_finish(void)
+static int buffer_verify_data_iov(const struct iovec* iov,
+                                  int iovcnt,
+                                  uint64_t lba,
+                                  uint32_t lba_count,
+                                  uint32_t lba_size,
+                                  const struct inflight_snapshot* r)
 {
-  spdk_memzone_free(DRIVER_CMDLOG_TABLE_NAME);
-  spdk_memzone_free(DRIVER_GLOBAL_CONFIG_NAME);
-}
+  uint64_t bounce[IOV_BOUNCE_SIZE/sizeof(uint64_t)];
+  struct iov_cursor c;
 
+  assert(lba_size <= sizeof(bounce));
+  iov_cursor_init(&c, iov, iovcnt);
+  for (uint32_t i=0; i<lba_count; i++, lba++)
+  {
+    struct iov_cursor start = c;
+    int ret;
+    uint64_t* ptr = iov_cursor_contig(&c, lba_size);
 
-static struct cmd_log_entry_t*
-cmd_log_add_cmd(uint16_t qid,
-                void* buf,
-                uint64_t lba,
-                uint16_t lba_count,
-                uint32_t lba_size,
-                const struct spdk_nvme_cmd* cmd,
-                spdk_nvme_cmd_cb cb_fn,
-                void *cb_arg)
+    if (ptr == NULL)
+    {
+      c = start;
+      iov_cursor_copy(&c, bounce, lba_size, false);
+      ptr = bounce;
+    }
+
+    ret = buffer_verify_lba(ptr, lba, lba_size, r);
+    if (ret != 0)
+    {
+      return ret;
+    }
+  }
+
+  return 0;
+}
+
+void buffer_fill_pattern(void* buf,
+                         size_t len,
+                         const void* pattern,
+                         size_t pattern_len)
 {
-  struct cmd_log_table_t* log_table = &cmd_log_queue_table[qid];
-  uint32_t tail_index = log_table->tail_index;
-  struct cmd_log_entry_t* log_entry = &log_table->table[tail_index];
+  size_t filled;
 
-  assert(qid < CMD_LOG_MAX_Q);
-  assert(log_table != NULL);
-  assert(tail_index < CMD_LOG_DEPTH);
+  assert(buf != NULL);
+  assert(pattern_len > 0);
 
-  log_entry->buf = buf;
-  log_entry->lba = lba;
-  log_entry->lba_count = lba_count;
-  log_entry->lba_size = lba_size;
-  log_entry->cb_fn = cb_fn;
-  log_entry->cb_arg = cb_arg;
-  memcpy(&log_entry->cmd, cmd, sizeof(struct spdk_nvme_cmd));
-  gettimeofday(&log_entry->time_cmd, NULL);
-  tail_index += 1;
-  if (tail_index == CMD_LOG_DEPTH)
+  if (pattern_len == 1)
   {
-    tail_index = 0;
+    memset(buf, *(const uint8_t*)pattern, len);
+    return;
   }
-  log_table->tail_index = tail_index;
 
-  return log_entry;
+  // copy the pattern once, and then double the filled area in each copy
+  filled = MIN(len, pattern_len);
+  memcpy(buf, pattern, filled);
+  while (filled < len)
+  {
+    size_t n = MIN(filled, len-filled);
+    memcpy(buf+filled, buf, n);
+    filled += n;
+  }
 }
 
-static void cmd_log_add_cpl_cb(void* cb_ctx, const struct spdk_nvme_cpl* cpl)
+int64_t buffer_mismatch(const void* buf1, const void* buf2, size_t len)
 {
-  struct timeval diff;
-  struct cmd_log_entry_t* log_entry = (struct cmd_log_entry_t*)cb_ctx;
-
-  assert(cpl != NULL);
-  assert(log_entry != NULL);
+  const size_t chunk = 64;
+  size_t offset = 0;
 
-  //reuse dword2 of cpl as latency value
-  gettimeofday(&log_entry->time_cpl, NULL);
-  memcpy(&log_entry->cpl, cpl, sizeof(struct spdk_nvme_cpl));
-  timersub(&log_entry->time_cpl, &log_entry->time_cmd, &diff);
-  (&log_entry->cpl.cdw0)[2] = timeval_to_us(&diff);
-  //SPDK_DEBUGLOG(SPDK_LOG_NVME, "cmd completed, cid %d\n", log_entry->cpl.cid);
-  
-  //verify read data
-  if (log_entry->cmd.opc == 2 && log_entry->buf != NULL)
+  // find the mismatched chunk by memcmp, and then the byte in it
+  while (offset < len)
   {
-    if ((*g_driver_global_config_ptr & DCFG_VERIFY_READ) != 0)
+    size_t n = MIN(chunk, len-offset);
+    if (memcmp(buf1+offset, buf2+offset, n) != 0)
     {
-      int ret = 0;
-    
-      assert (log_entry->lba_count != 0);
-      assert (log_entry->lba_size != 0);
-      assert (log_entry->lba_size == 512);
-
-      ret = buffer_verify_data(log_entry->buf,
-                               log_entry->lba,
-                               log_entry->lba_count,
-                               log_entry->lba_size);
-      if (ret != 0)
+      while (((const uint8_t*)buf1)[offset] == ((const uint8_t*)buf2)[offset])
       {
-        //Unrecovered Read Error: The read data could not be recovered from the media.
-        log_entry->cpl.status.sct = 0x02;
-        log_entry->cpl.status.sc = 0x81;
+        offset ++;
       }
+      return offset;
     }
+    offset += n;
   }
-  
-  //callback to cython layer
-  if (log_entry->cb_fn)
-  {
-    log_entry->cb_fn(log_entry->cb_arg, &log_entry->cpl);
-  }
+
+  return -1;
 }
 
+uint32_t buffer_crc32c(const void* buf, size_t len)
+{
+  return spdk_crc32c_update(buf, len, 0);
+}
 
-//// probe callbacks
-///////////////////////////////
+void buffer_fini(void* buf)
+{
+  SPDK_DEBUGLOG(SPDK_LOG_NVME, "buffer: free ptr at %p\n", buf);
+  assert(buf != NULL);
+  spdk_dma_free(buf);
+}
 
-struct cb_ctx {
-  struct spdk_nvme_transport_id* trid;
-  struct spdk_nvme_ctrlr* ctrlr;
-};
 
-static bool probe_cb(void *cb_ctx,
-                     const struct spdk_nvme_transport_id *trid,
-                     struct spdk_nvme_ctrlr_opts *opts)
-{
-	if (trid->trtype == SPDK_NVME_TRANSPORT_PCIE)
-  {
-    struct spdk_nvme_transport_id* target = ((struct cb_ctx*)cb_ctx)->trid;
-    if (0 != spdk_nvme_transport_id_compare(target, trid))
-    {
-      SPDK_ERRLOG("Wrong address %s\n", trid->traddr);
-      return false;
-    }
+////module: buffer pool
+///////////////////////////////
 
-    opts->use_cmb_sqs = false;
-		SPDK_INFOLOG(SPDK_LOG_NVME, "Attaching to NVMe Controller at %s\n",
-                 trid->traddr);
-	}
-  else
-  {
-    SPDK_INFOLOG(SPDK_LOG_NVME, "Attaching to NVMe over Fabrics controller at %s:%s: %s\n",
-                 trid->traddr, trid->trsvcid, trid->subnqn);
-	}
+// buffers are recycled in size classes of power of 2, from 4KB to 2MB.
+// Larger buffers are allocated and freed directly. Free buffers are
+// linked by the node kept in its own memory.
+#define BUFFER_POOL_DEFAULT_MAX_CACHED  (64ULL*1024*1024)
 
-	/* Set io_queue_size to UINT16_MAX, NVMe driver
-	 * will then reduce this to MQES to maximize
-	 * the io_queue_size as much as possible.
-	 */
-  opts->io_queue_size = UINT16_MAX;
+struct buffer_pool_node {
+  struct buffer_pool_node* next;
+  uint64_t phys_addr;
+};
 
-	/* Set the header and data_digest */
-  opts->header_digest = false;
-	opts->data_digest = false;
+// default pool of this process, used when no pool is specified
+static struct buffer_pool g_default_buffer_pool = {
+  .max_cached_bytes = BUFFER_POOL_DEFAULT_MAX_CACHED,
+  .socket_id = SPDK_ENV_SOCKET_ID_ANY,
+};
 
-	return true;
+static inline struct buffer_pool* buffer_pool_get(struct buffer_pool* pool)
+{
+  return pool ? pool : &g_default_buffer_pool;
 }
 
-
-static void attach_cb(void *cb_ctx,
-                      const struct spdk_nvme_transport_id *trid,
-                      struct spdk_nvme_ctrlr *ctrlr,
-                      const struct spdk_nvme_ctrlr_opts *opts)
+// pool without specified socket follows the socket of the process
+static inline int buffer_pool_socket(struct buffer_pool* pool)
 {
-	const struct spdk_nvme_ctrlr_data *cdata = spdk_nvme_ctrlr_get_data(ctrlr);
+  return pool->socket_id != SPDK_ENV_SOCKET_ID_ANY ?
+      pool->socket_id : g_driver_numa_socket;
+}
 
-  SPDK_INFOLOG(SPDK_LOG_NVME,
-               "attached device %s: %s, %d namespaces, pid %d\n",
-               trid->traddr, cdata->mn,
-               spdk_nvme_ctrlr_get_num_ns(ctrlr),
-               getpid());
+static inline int buffer_pool_class(size_t bytes)
+{
+  int shift = BUFFER_POOL_MIN_SHIFT;
 
-  ((struct cb_ctx*)cb_ctx)->ctrlr = ctrlr;
+  while ((1UL<<shift) < bytes)
+  {
+    shift ++;
+  }
+  return shift - BUFFER_POOL_MIN_SHIFT;
 }
 
+struct buffer_pool* buffer_pool_create(uint64_t max_cached_bytes, int socket_id)
+{
+  struct buffer_pool* pool = calloc(1, sizeof(struct buffer_pool));
 
-////rpc
-///////////////////////////////
+  if (pool != NULL)
+  {
+    pool->max_cached_bytes = max_cached_bytes;
+    pool->socket_id = socket_id;
+  }
+  return pool;
+}
 
-static void* rpc_server(void* args)
+void* buffer_pool_alloc(struct buffer_pool* pool,
+                        size_t bytes,
+                        uint64_t* phys_addr,
+                        int zero)
 {
-  int rc = 0;
+  int c;
+  int socket_id;
+  void* buf;
+  uint64_t phys;
+  struct buffer_pool_node* node;
 
-  SPDK_DEBUGLOG(SPDK_LOG_NVME, "starting rpc server ...\n");
-  
-  // start the rpc
-  rc = spdk_rpc_listen("/var/tmp/spdk.sock");
-  if (rc != 0)
+  pool = buffer_pool_get(pool);
+  pool->count_alloc ++;
+  socket_id = buffer_pool_socket(pool);
+  if (bytes > (1UL<<BUFFER_POOL_MAX_SHIFT))
   {
-    SPDK_ERRLOG("rpc fail to get the sock \n");
-    return NULL;
+    return zero ? spdk_dma_zmalloc_socket(bytes, 0x1000, phys_addr, socket_id) :
+                  spdk_dma_malloc_socket(bytes, 0x1000, phys_addr, socket_id);
   }
 
-  spdk_rpc_set_state(SPDK_RPC_STARTUP);
-
-  while(1)
+  c = buffer_pool_class(bytes);
+  node = pool->free_list[c];
+  if (node == NULL)
   {
-    spdk_rpc_accept();
-    usleep(100000);
+    // no free buffer in the class, get a new one in its class size
+    buf = spdk_dma_malloc_socket(1UL<<(c+BUFFER_POOL_MIN_SHIFT), 0x1000,
+                                 &phys, socket_id);
+    if (buf == NULL)
+    {
+      return NULL;
+    }
+  }
+  else
+  {
+    // recycle the free buffer
+    pool->free_list[c] = node->next;
+    pool->cached_bytes -= 1UL<<(c+BUFFER_POOL_MIN_SHIFT);
+    pool->count_reuse ++;
+    phys = node->phys_addr;
+    buf = node;
   }
 
-  spdk_rpc_close();
+  if (zero)
+  {
+    memset(buf, 0, bytes);
+  }
+  if (phys_addr != NULL)
+  {
+    *phys_addr = phys;
+  }
+  return buf;
 }
 
-
-static void
-rpc_get_nvme_controllers(struct spdk_jsonrpc_request *request,
-                         const struct spdk_json_val *params)
+void buffer_pool_free(struct buffer_pool* pool, void* buf, size_t bytes)
 {
-  struct spdk_json_write_ctx *w;
+  int c;
+  size_t class_bytes;
+  struct buffer_pool_node* node = (struct buffer_pool_node*)buf;
 
-  w = spdk_jsonrpc_begin_result(request);
-  if (w == NULL) {
+  assert(buf != NULL);
+  pool = buffer_pool_get(pool);
+  if (bytes > (1UL<<BUFFER_POOL_MAX_SHIFT))
+  {
+    spdk_dma_free(buf);
     return;
   }
 
-  spdk_json_write_array_begin(w);
+  c = buffer_pool_class(bytes);
+  class_bytes = 1UL<<(c+BUFFER_POOL_MIN_SHIFT);
+  if (pool->cached_bytes + class_bytes > pool->max_cached_bytes)
+  {
+    // pool is full, release the buffer to the hugepage memory
+    spdk_dma_free(buf);
+    return;
+  }
 
-  for (int i=0; i<CMD_LOG_MAX_Q; i++)
+  node->phys_addr = spdk_vtophys(buf);
+  node->next = pool->free_list[c];
+  pool->free_list[c] = node;
+  pool->cached_bytes += class_bytes;
+}
+
+void buffer_pool_clear(struct buffer_pool* pool)
+{
+  pool = buffer_pool_get(pool);
+  for (int c=0; c<BUFFER_POOL_CLASS_NUM; c++)
   {
-    if (cmd_log_queue_table[i].tail_index < CMD_LOG_DEPTH)
+    while (pool->free_list[c] != NULL)
     {
-      uint32_t tail = cmd_log_queue_table[i].tail_index;
-      struct cmd_log_entry_t* table = cmd_log_queue_table[i].table;
+      struct buffer_pool_node* node = pool->free_list[c];
+      pool->free_list[c] = node->next;
+      spdk_dma_free(node);
+    }
+  }
+  pool->cached_bytes = 0;
+}
 
-      spdk_json_write_uint32(w, tail);
+void buffer_pool_destroy(struct buffer_pool* pool)
+{
+  if (pool != NULL)
+  {
+    buffer_pool_clear(pool);
+    free(pool);
+  }
+}
 
-      // send commands details
-      spdk_json_write_array_begin(w);
-      for (int j=0; j<4; j++)
-      {
-        uint32_t index = (tail+CMD_LOG_DEPTH-1-j)%CMD_LOG_DEPTH;
-        spdk_json_write_uint32(w, table[index].cmd.opc);
-      }
-      spdk_json_write_array_end(w);
-    }
+// data buffer in the Controller Memory Buffer, device accesses it
+// without DMA through PCIe. Driver translates its address in PRP.
+void* buffer_cmb_alloc(struct spdk_nvme_ctrlr* ctrlr, size_t bytes, int zero)
+{
+  void* buf = spdk_nvme_ctrlr_alloc_cmb_io_buffer(ctrlr, bytes);
+
+  if (buf == NULL)
+  {
+    SPDK_ERRLOG("fail to allocate %ld bytes in cmb\n", bytes);
+    return NULL;
   }
 
-  spdk_json_write_array_end(w);
-  
-  spdk_jsonrpc_end_result(request, w);
+  if (zero)
+  {
+    memset(buf, 0, bytes);
+  }
+  return buf;
 }
-SPDK_RPC_REGISTER("get_nvme_controllers", rpc_get_nvme_controllers, SPDK_RPC_STARTUP | SPDK_RPC_RUNTIME)
 
+void buffer_cmb_free(struct spdk_nvme_ctrlr* ctrlr, void* buf, size_t bytes)
+{
+  assert(buf != NULL);
+  spdk_nvme_ctrlr_free_cmb_io_buffer(ctrlr, buf, bytes);
+}
 
-////driver system
+
+////cmd log
 ///////////////////////////////
 
-int driver_init(void)
-{
-  int ret = 0;
-  char buf[20];
-  struct spdk_env_opts opts;
+// log_table contains latest cmd and cpl and their timestamps
+// queue_table traces cmd log tables by queue pairs
+// CMD_LOG_DEPTH should be larger than Q depth to keep all outstanding commands.
+#define CMD_LOG_DEPTH (2048-1)  // reserved one slot space for tail value
+#define CMD_LOG_MAX_Q (16)
 
-  //init random sequence reproducible
-  srandom(1);
+struct cmd_log_entry_t {
+  // cmd and cpl
+  struct timeval time_cmd;
+  struct spdk_nvme_cmd cmd;
+  struct timeval time_cpl;
+  struct spdk_nvme_cpl cpl;
+
+  // read: buffer for data verification, write: crc of its data to commit
+  union
+  {
+    void* buf;
+    uint32_t* crc;
+  };
+  uint64_t lba;
+  uint32_t lba_count;
+  uint32_t lba_size;
   
-  // distribute multiprocessing to different cores
-  spdk_env_opts_init(&opts);
-  sprintf(buf, "0x%x", 1<<(getpid()%get_nprocs()));
-  opts.core_mask = buf;
-  opts.shm_id = 0;
-  opts.name = "pynvme";
-  opts.mem_size = 2048;
-  if (spdk_env_init(&opts) < 0)
+  // callback to user functions
+  spdk_nvme_cmd_cb cb_fn;
+  void* cb_arg;
+
+  // scattered data buffer, and the position of sge callbacks
+  struct iovec* iov;
+  uint32_t iovcnt;
+  uint32_t iov_index;
+  uint32_t iov_offset;
+  uint16_t known;  // write of known pattern, committed without crc
+  int16_t stat;    // entry of the controller in the stat table
+
+  // write: its entry of in-flight writes, read: snapshot at submission
+  struct inflight_snapshot inflight;
+};
+static_assert(sizeof(struct cmd_log_entry_t) == 192, "cacheline aligned");
+
+struct cmd_log_table_t {
+  struct cmd_log_entry_t table[CMD_LOG_DEPTH];
+  uint32_t tail_index;
+  uint32_t dummy[47];
+};
+static_assert(sizeof(struct cmd_log_table_t) == sizeof(struct cmd_log_entry_t)*(CMD_LOG_DEPTH+1), "cacheline aligned");
+static_assert(CMD_LOG_MAX_Q*CMD_LOG_DEPTH < PENDING_OVERLAP, "pending writes of an lba are counted in 15 bits");
+
+#define DRIVER_CMDLOG_TABLE_NAME  "driver_cmdlog_table"
+static struct cmd_log_table_t* cmd_log_queue_table;
+
+// completions are collected in the batch of the qpair, when it is reaped
+// in batch, instead of calling back one by one. Process local.
+static struct cpl_batch* cmd_log_batch[CMD_LOG_MAX_Q];
+
+// doorbell of each qpair in this process. When doorbell is delayed, cmds
+// are pending in SQ until the qpair is polled, and then the device is
+// notified by one doorbell write for the whole batch.
+struct qpair_doorbell {
+  bool delayed;
+  uint32_t pending;
+  struct qpair_doorbell_stat stat;
+};
+static struct qpair_doorbell qpair_doorbell_table[CMD_LOG_MAX_Q];
+
+static inline void qpair_doorbell_ring(struct qpair_doorbell* db, uint32_t count)
+{
+  int bucket = 31 - __builtin_clz(count);
+
+  db->stat.batch_hist[MIN(bucket, DOORBELL_BATCH_HIST_NUM-1)] ++;
+  db->stat.rings ++;
+}
+
+// count the cmd when it is in SQ. spdk writes the SQ tail doorbell for
+// each cmd, or in the next poll of the qpair when the doorbell is delayed.
+static inline void qpair_doorbell_submit(uint16_t qid)
+{
+  struct qpair_doorbell* db = &qpair_doorbell_table[qid];
+
+  db->stat.cmds ++;
+  if (db->delayed)
   {
-    fprintf(stderr, "Unable to initialize SPDK env\n");
-    return -1;
+    db->pending ++;
+  }
+  else
+  {
+    qpair_doorbell_ring(db, 1);
   }
+}
 
-  // distribute multiprocessing to different cores  
-  // log level setup
-  spdk_log_set_flag("nvme");
-  spdk_log_set_print_level(SPDK_LOG_INFO);
+// io statistics of qpairs and ioworkers, shared by all processes. They are
+// counted in the IO path, and exported by rpc when the test is running.
+#define DRIVER_STAT_LATENCY_NUM   (24)  // log2 buckets of latency: <=1us, <=2us, ..., >4s
+#define DRIVER_STAT_IOWORKER_MAX  (64)
+#define DRIVER_STAT_CTRLR_MAX     (8)   // qpair statistics are kept by controller and qid
+
+struct driver_io_stat {
+  uint64_t submitted;
+  uint64_t completed;
+  uint64_t reads;
+  uint64_t writes;
+  uint64_t bytes_read;
+  uint64_t bytes_written;
+  uint64_t errors;
+  uint64_t latency_sum_us;
+  uint64_t latency_hist[DRIVER_STAT_LATENCY_NUM];
+};
 
-  // start rpc server in primary process only
-  if (spdk_process_is_primary())
+struct driver_ioworker_stat {
+  pid_t pid;
+  int cpu_core;
+  uint32_t qdepth;
+  uint32_t rsvd;
+  struct driver_io_stat stat;
+};
+
+// a controller entry is claimed by its address, and kept till driver fini,
+// so all processes get the same entry of the controller
+#define DRIVER_STAT_CTRLR_FREE    (0)
+#define DRIVER_STAT_CTRLR_BUSY    (1)
+#define DRIVER_STAT_CTRLR_READY   (2)
+
+struct driver_stat_table {
+  uint32_t ctrlr_state[DRIVER_STAT_CTRLR_MAX];
+  char ctrlr[DRIVER_STAT_CTRLR_MAX][SPDK_NVMF_TRADDR_MAX_LEN+1];
+  bool qpair_active[DRIVER_STAT_CTRLR_MAX][CMD_LOG_MAX_Q];
+  struct driver_io_stat qpair[DRIVER_STAT_CTRLR_MAX][CMD_LOG_MAX_Q];
+  struct driver_ioworker_stat ioworker[DRIVER_STAT_IOWORKER_MAX];
+};
+static struct driver_stat_table* g_driver_stat_table_ptr = NULL;
+// controllers of the entries looked up by this process
+static struct spdk_nvme_ctrlr* g_driver_stat_ctrlr[DRIVER_STAT_CTRLR_MAX];
+
+// get the entry of the controller in the stat table, -1 if not available
+static int driver_stat_ctrlr_get(struct spdk_nvme_ctrlr* ctrlr)
+{
+  struct driver_stat_table* t = g_driver_stat_table_ptr;
+
+  if (t == NULL || ctrlr == NULL)
   {
-    pthread_t rpc_t;
-    pthread_create(&rpc_t, NULL, rpc_server, NULL);
+    return -1;
   }
 
-  // init cmd log
-  ret = cmd_log_init();
-  if (ret != 0)
+  for (int i=0; i<DRIVER_STAT_CTRLR_MAX; i++)
   {
-    return ret;
+    if (g_driver_stat_ctrlr[i] == ctrlr)
+    {
+      return i;
+    }
   }
 
-  cmd_log_qpair_init(0);
+  // find the entry of the address, or claim the first free one
+  for (int i=0; i<DRIVER_STAT_CTRLR_MAX; i++)
+  {
+    if (__sync_bool_compare_and_swap(&t->ctrlr_state[i],
+                                     DRIVER_STAT_CTRLR_FREE,
+                                     DRIVER_STAT_CTRLR_BUSY))
+    {
+      snprintf(t->ctrlr[i], sizeof(t->ctrlr[i]), "%s", ctrlr->trid.traddr);
+      memset(t->qpair[i], 0, sizeof(t->qpair[i]));
+      __atomic_store_n(&t->ctrlr_state[i], DRIVER_STAT_CTRLR_READY, __ATOMIC_RELEASE);
+    }
 
-  return ret;
-}
+    while (__atomic_load_n(&t->ctrlr_state[i], __ATOMIC_ACQUIRE) != DRIVER_STAT_CTRLR_READY);
+    if (strcmp(t->ctrlr[i], ctrlr->trid.traddr) == 0)
+    {
+      g_driver_stat_ctrlr[i] = ctrlr;
+      return i;
+    }
+  }
 
+  SPDK_ERRLOG("no statistics for controller %s\n", ctrlr->trid.traddr);
+  return -1;
+}
 
-int driver_fini(void)
+// the controller is detached, its pointer may be reused
+static void driver_stat_ctrlr_put(struct spdk_nvme_ctrlr* ctrlr)
 {
-  //delete cmd log of admin queue
-  if (spdk_process_is_primary())
+  for (int i=0; i<DRIVER_STAT_CTRLR_MAX; i++)
   {
-    cmd_log_qpair_clear(0);
-    cmd_log_finish();
-    SPDK_DEBUGLOG(SPDK_LOG_NVME, "pynvme driver unloaded.\n");
-  }  
-	return 0;
+    if (g_driver_stat_ctrlr[i] == ctrlr)
+    {
+      g_driver_stat_ctrlr[i] = NULL;
+    }
+  }
 }
 
-
-void driver_config(uint64_t cfg_word)
+static inline struct driver_io_stat* driver_stat_qpair(int ctrlr, uint16_t qid)
 {
-  *g_driver_global_config_ptr = cfg_word;
+  if (g_driver_stat_table_ptr == NULL || ctrlr < 0)
+  {
+    return NULL;
+  }
+
+  return &g_driver_stat_table_ptr->qpair[ctrlr][qid];
 }
 
+// clear the statistics of the new qpair, and report it
+static void driver_stat_qpair_open(struct spdk_nvme_ctrlr* ctrlr, uint16_t qid)
+{
+  int c = driver_stat_ctrlr_get(ctrlr);
 
-////module: pcie ctrlr
-///////////////////////////////
+  if (c >= 0)
+  {
+    memset(&g_driver_stat_table_ptr->qpair[c][qid], 0, sizeof(struct driver_io_stat));
+    g_driver_stat_table_ptr->qpair_active[c][qid] = true;
+  }
+}
 
-struct spdk_pci_device* pcie_init(struct spdk_nvme_ctrlr* ctrlr)
+static void driver_stat_qpair_close(struct spdk_nvme_ctrlr* ctrlr, uint16_t qid)
 {
-  return spdk_nvme_ctrlr_get_pci_device(ctrlr);
+  int c = driver_stat_ctrlr_get(ctrlr);
+
+  if (c >= 0)
+  {
+    g_driver_stat_table_ptr->qpair_active[c][qid] = false;
+  }
 }
 
-int pcie_cfg_read8(struct spdk_pci_device* pci,
-                   unsigned char* value,
-                   unsigned int offset)
+// admin qpair is created by the primary process, and shared by secondaries
+static void driver_stat_admin_open(struct spdk_nvme_ctrlr* ctrlr)
 {
-  return spdk_pci_device_cfg_read8(pci, value, offset);
+  if (true == spdk_process_is_primary())
+  {
+    driver_stat_qpair_open(ctrlr, 0);
+  }
 }
 
-int pcie_cfg_write8(struct spdk_pci_device* pci,
-                    unsigned char value,
-                    unsigned int offset)
+// counters are updated by one process, and read by the rpc thread
+static inline void driver_stat_submit(struct driver_io_stat* stat)
 {
-  return spdk_pci_device_cfg_write8(pci, value, offset);
+  __atomic_fetch_add(&stat->submitted, 1, __ATOMIC_RELAXED);
 }
 
-
-////module: nvme ctrlr
-///////////////////////////////
-struct spdk_nvme_ctrlr* nvme_probe(char* traddr)
+static void driver_stat_complete(struct driver_io_stat* stat,
+                                 uint8_t opc,
+                                 uint64_t bytes,
+                                 uint32_t latency_us,
+                                 bool error)
 {
-  struct spdk_nvme_transport_id trid;
-  struct cb_ctx cb_ctx;
-	int rc;
-
-  SPDK_DEBUGLOG(SPDK_LOG_NVME, "looking for NVMe @%s\n", traddr);
+  int bucket = latency_us <= 1 ? 0 : 32 - __builtin_clz(latency_us-1);
 
-  // device address
-  memset(&trid, 0, sizeof(trid));
-  if (strchr(traddr, ':') == NULL)
+  __atomic_fetch_add(&stat->completed, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stat->latency_sum_us, latency_us, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stat->latency_hist[MIN(bucket, DRIVER_STAT_LATENCY_NUM-1)],
+                     1, __ATOMIC_RELAXED);
+  if (error)
   {
-    // tcp/ip address: fixed port to 4420
-    trid.trtype = SPDK_NVME_TRANSPORT_TCP;
-    trid.adrfam = SPDK_NVMF_ADRFAM_IPV4;
-    strncpy(trid.traddr, traddr, strlen(traddr)+1);
-    strncpy(trid.trsvcid, "4420", 4+1);
-    snprintf(trid.subnqn, sizeof(trid.subnqn), "%s", SPDK_NVMF_DISCOVERY_NQN);
+    __atomic_fetch_add(&stat->errors, 1, __ATOMIC_RELAXED);
   }
-  else
+  else if (opc == 1)
   {
-    // pcie address: contains ':' characters
-    trid.trtype = SPDK_NVME_TRANSPORT_PCIE;
-    strncpy(trid.traddr, traddr, strlen(traddr)+1);
+    __atomic_fetch_add(&stat->writes, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stat->bytes_written, bytes, __ATOMIC_RELAXED);
   }
-
-  cb_ctx.trid = &trid;
-  cb_ctx.ctrlr = NULL;
-  rc = spdk_nvme_probe(&trid, &cb_ctx, probe_cb, attach_cb, NULL);
-  if (rc != 0 || cb_ctx.ctrlr == NULL)
+  else if (opc == 2)
   {
-    SPDK_ERRLOG("not found device: %s, rc %d, cb_ctx.ctrlr %p\n",
-                trid.traddr, rc, cb_ctx.ctrlr);
-    return NULL;
+    __atomic_fetch_add(&stat->reads, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stat->bytes_read, bytes, __ATOMIC_RELAXED);
   }
-  
-  return cb_ctx.ctrlr;
 }
 
-struct spdk_nvme_ctrlr* nvme_init(char * traddr)
-{
-  struct spdk_nvme_ctrlr* ctrlr;
 
-  //enum the device
-  ctrlr = nvme_probe(traddr);
-  if (ctrlr == NULL)
-  {
-    return NULL;
-  }
+static unsigned int timeval_to_us(struct timeval* t)
+{
+  return t->tv_sec*US_PER_S + t->tv_usec;
+}
 
-  SPDK_DEBUGLOG(SPDK_LOG_NVME, "found device: %s\n", ctrlr->trid.traddr);
-  return ctrlr;
+static inline uint64_t ticks_to_us(uint64_t ticks)
+{
+  return ticks*US_PER_S/spdk_get_ticks_hz();
 }
 
-int nvme_fini(struct spdk_nvme_ctrlr* ctrlr)
+
+// host cycles of the ioworker process in each stage of io. The elapsed
+// cycles are charged to the current stage when it switches, so nested
+// stages are exclusive. Only enabled in ioworkers.
+enum cycles_stage {
+  CYCLES_OTHER = 0,
+  CYCLES_SUBMIT,
+  CYCLES_FILL,
+  CYCLES_CMDLOG,
+  CYCLES_COMPLETION,
+  CYCLES_VERIFY,
+  CYCLES_POLL,
+  CYCLES_POLL_EMPTY,
+  CYCLES_IDLE,
+  CYCLES_NUM
+};
+
+static uint64_t* g_cycles = NULL;
+static enum cycles_stage g_cycles_stage = CYCLES_OTHER;
+static uint64_t g_cycles_stamp = 0;
+
+static inline enum cycles_stage cycles_switch(enum cycles_stage stage)
 {
-  SPDK_DEBUGLOG(SPDK_LOG_NVME, "free ctrlr: %s\n", ctrlr->trid.traddr);
+  uint64_t now;
+  enum cycles_stage prev = g_cycles_stage;
 
-  if (ctrlr == NULL)
+  if (g_cycles == NULL)
   {
-    return 0;
+    return prev;
   }
 
-  // io qpairs should all be deleted before closing master controller 
-  if (true == spdk_process_is_primary() &&
-      false == TAILQ_EMPTY(&ctrlr->active_io_qpairs))
-  {
-    return -1;
-  }
-  
-  SPDK_DEBUGLOG(SPDK_LOG_NVME, "close device: %s\n", ctrlr->trid.traddr);
-  return spdk_nvme_detach(ctrlr);
+  now = spdk_get_ticks();
+  g_cycles[prev] += now-g_cycles_stamp;
+  g_cycles_stamp = now;
+  g_cycles_stage = stage;
+  return prev;
 }
 
-int nvme_set_reg32(struct spdk_nvme_ctrlr* ctrlr,
-                   unsigned int offset,
-                   unsigned int value)
+static void cycles_start(uint64_t* cycles)
 {
-  return nvme_pcie_ctrlr_set_reg_4(ctrlr, offset, value);
+  memset(cycles, 0, sizeof(uint64_t)*CYCLES_NUM);
+  g_cycles = cycles;
+  g_cycles_stage = CYCLES_OTHER;
+  g_cycles_stamp = spdk_get_ticks();
 }
 
-int nvme_get_reg32(struct spdk_nvme_ctrlr* ctrlr,
-                   unsigned int offset,
-                   unsigned int* value)
+static void cycles_stop(void)
 {
-  return nvme_pcie_ctrlr_get_reg_4(ctrlr, offset, value);
+  cycles_switch(CYCLES_OTHER);
+  g_cycles = NULL;
 }
 
-int nvme_wait_completion_admin(struct spdk_nvme_ctrlr* ctrlr)
+// time of the latest controller reset in this process. The start tick is
+// kept till the first IO completes successfully after reset.
+static uint64_t g_nvme_reset_start_tick = 0;
+static struct nvme_reset_stat g_nvme_reset_stat;
+
+// completed admin commands changing identify data and log pages: fw
+// commit, ns management, format, ns attachment and sanitize
+static uint64_t g_nvme_admin_change_count = 0;
+
+static inline bool cmd_log_admin_changes(uint8_t opc)
 {
-  return spdk_nvme_ctrlr_process_admin_completions(ctrlr);
+  return opc == 0x10 || opc == 0x0d || opc == 0x80 || opc == 0x15 || opc == 0x84;
 }
 
-static void nvme_deallocate_ranges(struct spdk_nvme_dsm_range *ranges,
-                                   unsigned int count)
+
+static void cmd_log_qpair_init(uint16_t qid)
 {
-  for (unsigned int i=0; i<count; i++)
-  {
-    SPDK_DEBUGLOG(SPDK_LOG_NVME, "deallocate lba 0x%lx, count %d\n",
-                 ranges[i].starting_lba,
-                 ranges[i].length);
-    crc32_clear(ranges[i].starting_lba, ranges[i].length, 0, 0);
-  }
+  assert(qid < CMD_LOG_MAX_Q);
+
+  // set tail to invalid value, means the qpair is empty
+  cmd_log_queue_table[qid].tail_index = 0;
 }
 
-int nvme_send_cmd_raw(struct spdk_nvme_ctrlr* ctrlr,
-                      struct spdk_nvme_qpair *qpair,
-                      unsigned int opcode,
-                      unsigned int nsid,
-                      void* buf, size_t len,
-                      unsigned int cdw10,
-                      unsigned int cdw11,
-                      unsigned int cdw12,
-                      unsigned int cdw13,
-                      unsigned int cdw14,
-                      unsigned int cdw15,
-                      spdk_nvme_cmd_cb cb_fn,
-                      void* cb_arg)
+
+static void cmd_log_qpair_clear(uint16_t qid)
 {
-  uint16_t qid;
-  struct spdk_nvme_cmd cmd;
-  struct cmd_log_entry_t* log_entry;
+  assert(qid < CMD_LOG_MAX_Q);
 
-  assert(ctrlr != NULL);
+  // set tail to invalid value, means the qpair is empty
+  cmd_log_queue_table[qid].tail_index = CMD_LOG_DEPTH;
+}
 
-  //setup cmd structure
+
+static int cmd_log_init(void)
+{
+  if (spdk_process_is_primary())
+  {
+    cmd_log_queue_table = spdk_memzone_reserve(DRIVER_CMDLOG_TABLE_NAME,
+                                               sizeof(struct cmd_log_table_t)*CMD_LOG_MAX_Q, 
+                                               0, SPDK_MEMZONE_NO_IOVA_CONTIG);
+
+    // clear all qpair's cmd log
+    for (int i=0; i<CMD_LOG_MAX_Q; i++)
+    {
+      cmd_log_qpair_clear(i);
+    }
+
+    // also init config word with cmdlog
+    g_driver_global_config_ptr = spdk_memzone_reserve(DRIVER_GLOBAL_CONFIG_NAME,
+                                                      sizeof(uint64_t),
+                                                      0, 0);
+    *g_driver_global_config_ptr = 0;
+
+    // and the io statistics
+    g_driver_stat_table_ptr = spdk_memzone_reserve(DRIVER_STAT_TABLE_NAME,
+                                                   sizeof(struct driver_stat_table),
+                                                   0, 0);
+    if (g_driver_stat_table_ptr != NULL)
+    {
+      memset(g_driver_stat_table_ptr, 0, sizeof(struct driver_stat_table));
+    }
+  }
+  else
+  {
+    cmd_log_queue_table = spdk_memzone_lookup(DRIVER_CMDLOG_TABLE_NAME);
+    g_driver_global_config_ptr = spdk_memzone_lookup(DRIVER_GLOBAL_CONFIG_NAME);
+    g_driver_stat_table_ptr = spdk_memzone_lookup(DRIVER_STAT_TABLE_NAME);
+  }
+
+  if (cmd_log_queue_table == NULL)
+  {
+    fprintf(stderr, "Cannot allocate or find the cmdlog memory!\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+
+static void cmd_log_finish(void)
+{
+  spdk_memzone_free(DRIVER_CMDLOG_TABLE_NAME);
+  spdk_memzone_free(DRIVER_GLOBAL_CONFIG_NAME);
+  shm_unlink(DRIVER_CORE_TABLE_NAME);
+  spdk_memzone_free(DRIVER_STAT_TABLE_NAME);
+  g_driver_stat_table_ptr = NULL;
+}
+
+
+static struct cmd_log_entry_t*
+cmd_log_add_cmd(struct spdk_nvme_ctrlr* ctrlr,
+                uint16_t qid,
+                void* buf,
+                uint64_t lba,
+                uint32_t lba_count,
+                uint32_t lba_size,
+                const struct spdk_nvme_cmd* cmd,
+                spdk_nvme_cmd_cb cb_fn,
+                void *cb_arg)
+{
+  struct cmd_log_table_t* log_table = &cmd_log_queue_table[qid];
+  uint32_t tail_index = log_table->tail_index;
+  struct cmd_log_entry_t* log_entry = &log_table->table[tail_index];
+
+  assert(qid < CMD_LOG_MAX_Q);
+  assert(log_table != NULL);
+  assert(tail_index < CMD_LOG_DEPTH);
+
+  log_entry->buf = buf;
+  log_entry->lba = lba;
+  log_entry->lba_count = lba_count;
+  log_entry->lba_size = lba_size;
+  log_entry->cb_fn = cb_fn;
+  log_entry->cb_arg = cb_arg;
+  log_entry->iov = NULL;
+  log_entry->iovcnt = 0;
+  log_entry->known = 0;
+  log_entry->stat = driver_stat_ctrlr_get(ctrlr);
+  memcpy(&log_entry->cmd, cmd, sizeof(struct spdk_nvme_cmd));
+  gettimeofday(&log_entry->time_cmd, NULL);
+
+  if (log_entry->stat >= 0)
+  {
+    driver_stat_submit(driver_stat_qpair(log_entry->stat, qid));
+  }
+
+  tail_index += 1;
+  if (tail_index == CMD_LOG_DEPTH)
+  {
+    tail_index = 0;
+  }
+  log_table->tail_index = tail_index;
+
+  return log_entry;
+}
+
+// track the io in flight before it is submitted
+static void cmd_log_inflight_begin(struct cmd_log_entry_t* log_entry)
+{
+  if (log_entry->cmd.opc == 1)
+  {
+    pending_write_begin(log_entry->lba, log_entry->lba_count);
+    inflight_write_begin(&log_entry->inflight,
+                         log_entry->lba, log_entry->lba_count);
+  }
+  else
+  {
+    inflight_read_begin(&log_entry->inflight);
+  }
+}
+
+// writes tracked in flight are committed at completion
+static inline bool cmd_log_write_tracked(struct cmd_log_entry_t* log_entry)
+{
+  return log_entry->cmd.opc == 1 &&
+         (log_entry->known || log_entry->crc != NULL);
+}
+
+static void cmd_log_commit_write(struct cmd_log_entry_t* log_entry)
+{
+  pending_write_end(log_entry->lba, log_entry->lba_count,
+                    log_entry->crc, BUFFER_KNOWN_CRC);
+  inflight_write_end(&log_entry->inflight);
+  free(log_entry->crc);
+  log_entry->crc = NULL;
+}
+
+// the write is not submitted, the crc in table is still valid
+static void cmd_log_cancel_write(struct cmd_log_entry_t* log_entry)
+{
+  pending_write_end(log_entry->lba, log_entry->lba_count, NULL, 0);
+  inflight_write_end(&log_entry->inflight);
+  free(log_entry->crc);
+  log_entry->crc = NULL;
+}
+
+// slow io records of this process, enabled by log_slow_io_trace()
+static uint32_t g_slow_io_threshold_us = 0;
+static struct slow_io_record* g_slow_io_records = NULL;
+static uint32_t g_slow_io_count = 0;
+static uint32_t g_slow_io_max = 0;
+static uint64_t g_slow_io_dropped = 0;
+
+static void cmd_log_slow_io_cmd(struct slow_io_cmd* c,
+                                struct cmd_log_entry_t* log_entry,
+                                bool completed)
+{
+  c->time_cmd_us = log_entry->time_cmd.tv_sec*US_PER_S + log_entry->time_cmd.tv_usec;
+  memcpy(c->cmd, &log_entry->cmd, sizeof(c->cmd));
+  if (completed)
+  {
+    c->time_cpl_us = log_entry->time_cpl.tv_sec*US_PER_S + log_entry->time_cpl.tv_usec;
+    memcpy(c->cpl, &log_entry->cpl, sizeof(c->cpl));
+  }
+  else
+  {
+    c->time_cpl_us = 0;
+    memset(c->cpl, 0, sizeof(c->cpl));
+  }
+}
+
+static void cmd_log_slow_io_capture(struct cmd_log_entry_t* log_entry,
+                                    uint32_t qid)
+{
+  struct slow_io_record* r;
+  struct cmd_log_table_t* log_table = &cmd_log_queue_table[qid];
+  uint32_t index = log_entry-log_table->table;
+
+  if (g_slow_io_count >= g_slow_io_max)
+  {
+    g_slow_io_dropped ++;
+    return;
+  }
+
+  r = &g_slow_io_records[g_slow_io_count++];
+  r->qid = qid;
+  r->latency_us = (&log_entry->cpl.cdw0)[2];
+  r->inflight = 0;
+  if (log_entry->stat >= 0)
+  {
+    struct driver_io_stat* stat = driver_stat_qpair(log_entry->stat, qid);
+
+    // the slow command is not counted as completed yet, exclude it
+    r->inflight = stat->submitted-stat->completed-1;
+  }
+  cmd_log_slow_io_cmd(&r->io, log_entry, true);
+
+  // commands submitted around the slow one: half before and half after.
+  // Skip the entries left by the previous round of the ring.
+  r->neighbour_count = 0;
+  for (int i=-SLOW_IO_NEIGHBOUR_NUM/2; i<=SLOW_IO_NEIGHBOUR_NUM/2; i++)
+  {
+    struct cmd_log_entry_t* e;
+
+    if (i == 0)
+    {
+      continue;
+    }
+
+    e = &log_table->table[(index+CMD_LOG_DEPTH+i)%CMD_LOG_DEPTH];
+    if (e->time_cmd.tv_sec == 0 ||
+        (i < 0 && timercmp(&e->time_cmd, &log_entry->time_cmd, >)) ||
+        (i > 0 && timercmp(&e->time_cmd, &log_entry->time_cmd, <)))
+    {
+      continue;
+    }
+
+    cmd_log_slow_io_cmd(&r->neighbour[r->neighbour_count++], e,
+                        !timercmp(&e->time_cpl, &e->time_cmd, <));
+  }
+}
+
+static void cmd_log_add_cpl_cb(void* cb_ctx, const struct spdk_nvme_cpl* cpl)
+{
+  uint32_t qid;
+  struct timeval diff;
+  struct cpl_batch* batch;
+  struct cmd_log_entry_t* log_entry = (struct cmd_log_entry_t*)cb_ctx;
+  enum cycles_stage stage = cycles_switch(CYCLES_CMDLOG);
+
+  assert(cpl != NULL);
+  assert(log_entry != NULL);
+
+  //reuse dword2 of cpl as latency value
+  gettimeofday(&log_entry->time_cpl, NULL);
+  memcpy(&log_entry->cpl, cpl, sizeof(struct spdk_nvme_cpl));
+  timersub(&log_entry->time_cpl, &log_entry->time_cmd, &diff);
+  (&log_entry->cpl.cdw0)[2] = timeval_to_us(&diff);
+  //SPDK_DEBUGLOG(SPDK_LOG_NVME, "cmd completed, cid %d\n", log_entry->cpl.cid);
+  
+  //verify read data
+  if (log_entry->cmd.opc == 2 &&
+      (log_entry->buf != NULL || log_entry->iov != NULL))
+  {
+    if ((*g_driver_global_config_ptr & DCFG_VERIFY_READ) != 0)
+    {
+      int ret = 0;
+
+      cycles_switch(CYCLES_VERIFY);
+      assert (log_entry->lba_count != 0);
+      assert (log_entry->lba_size != 0);
+      assert (log_entry->lba_size == 512);
+
+      if (log_entry->iov != NULL)
+      {
+        ret = buffer_verify_data_iov(log_entry->iov,
+                                     log_entry->iovcnt,
+                                     log_entry->lba,
+                                     log_entry->lba_count,
+                                     log_entry->lba_size,
+                                     &log_entry->inflight);
+      }
+      else
+      {
+        ret = buffer_verify_data(log_entry->buf,
+                                 log_entry->lba,
+                                 log_entry->lba_count,
+                                 log_entry->lba_size,
+                                 &log_entry->inflight);
+      }
+      
+      if (ret != 0)
+      {
+        //Unrecovered Read Error: The read data could not be recovered from the media.
+        log_entry->cpl.status.sct = 0x02;
+        log_entry->cpl.status.sc = 0x81;
+      }
+      cycles_switch(CYCLES_CMDLOG);
+    }
+  }
+  
+  //commit crc of written data
+  if (cmd_log_write_tracked(log_entry))
+  {
+    cycles_switch(CYCLES_VERIFY);
+    cmd_log_commit_write(log_entry);
+    cycles_switch(CYCLES_CMDLOG);
+  }
+
+  //the copy of scattered segments is not used after completion
+  if (log_entry->iov != NULL)
+  {
+    free(log_entry->iov);
+    log_entry->iov = NULL;
+  }
+
+  //count the completion in the statistics of the qpair
+  qid = (log_entry-cmd_log_queue_table[0].table)/(CMD_LOG_DEPTH+1);
+  assert(qid < CMD_LOG_MAX_Q);
+  if (g_slow_io_threshold_us != 0 &&
+      (&log_entry->cpl.cdw0)[2] >= g_slow_io_threshold_us)
+  {
+    cmd_log_slow_io_capture(log_entry, qid);
+  }
+  if (qid == 0 && cmd_log_admin_changes(log_entry->cmd.opc))
+  {
+    g_nvme_admin_change_count ++;
+  }
+  if (g_nvme_reset_start_tick != 0 && qid != 0 &&
+      !nvme_cpl_is_error(&log_entry->cpl))
+  {
+    g_nvme_reset_stat.first_io_us = ticks_to_us(spdk_get_ticks()-g_nvme_reset_start_tick);
+    g_nvme_reset_start_tick = 0;
+  }
+  if (log_entry->stat >= 0)
+  {
+    // admin opcodes are not read or write, e.g. 01h/02h
+    driver_stat_complete(driver_stat_qpair(log_entry->stat, qid),
+                         qid != 0 ? log_entry->cmd.opc : 0,
+                         (uint64_t)log_entry->lba_count*log_entry->lba_size,
+                         (&log_entry->cpl.cdw0)[2],
+                         nvme_cpl_is_error(&log_entry->cpl));
+  }
+
+  //collect the completion in the batch, cython layer handles them together.
+  //Other callbacks, e.g. of internal commands, are called back directly.
+  batch = cmd_log_batch[qid];
+  if (batch != NULL)
+  {
+    batch->completed ++;
+  }
+  if (batch != NULL && batch->count < batch->max &&
+      batch->cb_fn == log_entry->cb_fn)
+  {
+    struct cpl_batch_entry* e = &batch->entries[batch->count++];
+    e->cb_arg = log_entry->cb_arg;
+    e->cdw0 = log_entry->cpl.cdw0;
+    e->latency_us = (&log_entry->cpl.cdw0)[2];
+    e->cid = log_entry->cpl.cid;
+    e->status = *(uint16_t*)&log_entry->cpl.status;
+    cycles_switch(stage);
+    return;
+  }
+  
+  //callback to cython layer
+  if (log_entry->cb_fn)
+  {
+    cycles_switch(CYCLES_COMPLETION);
+    log_entry->cb_fn(log_entry->cb_arg, &log_entry->cpl);
+  }
+  cycles_switch(stage);
+}
+
+
+//// probe callbacks
+///////////////////////////////
+
+// probe one or more devices in one time, and get their ctrlr and the
+// tick when they are attached
+struct cb_ctx {
+  struct spdk_nvme_transport_id* trid;
+  unsigned int count;
+  struct spdk_nvme_ctrlr** ctrlr;
+  uint64_t* attach_tick;
+  bool* probed;  // the device is found, and its initialization is started
+  const struct ctrlr_options* options;
+};
+
+static int cb_ctx_find(struct cb_ctx* ctx,
+                       const struct spdk_nvme_transport_id *trid)
+{
+  // fabrics target is connected by its own probe
+  if (ctx->count == 1 && trid->trtype != SPDK_NVME_TRANSPORT_PCIE)
+  {
+    return 0;
+  }
+
+  for (unsigned int i=0; i<ctx->count; i++)
+  {
+    if (0 == spdk_nvme_transport_id_compare(&ctx->trid[i], trid))
+    {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+static bool probe_cb(void *cb_ctx,
+                     const struct spdk_nvme_transport_id *trid,
+                     struct spdk_nvme_ctrlr_opts *opts)
+{
+  const struct ctrlr_options* options = ((struct cb_ctx*)cb_ctx)->options;
+  bool* probed = ((struct cb_ctx*)cb_ctx)->probed;
+  int i = cb_ctx_find(cb_ctx, trid);
+
+	if (trid->trtype == SPDK_NVME_TRANSPORT_PCIE)
+  {
+    if (i < 0)
+    {
+      // other devices are also found when probing multiple devices
+      if (((struct cb_ctx*)cb_ctx)->count == 1)
+      {
+        SPDK_ERRLOG("Wrong address %s\n", trid->traddr);
+      }
+      return false;
+    }
+
+    // place IO SQs in CMB, if the controller supports it
+    opts->use_cmb_sqs = options ? options->use_cmb_sqs : false;
+		SPDK_INFOLOG(SPDK_LOG_NVME, "Attaching to NVMe Controller at %s\n",
+                 trid->traddr);
+	}
+  else
+  {
+    SPDK_INFOLOG(SPDK_LOG_NVME, "Attaching to NVMe over Fabrics controller at %s:%s: %s\n",
+                 trid->traddr, trid->trsvcid, trid->subnqn);
+	}
+
+	/* Set io_queue_size to UINT16_MAX, NVMe driver
+	 * will then reduce this to MQES to maximize
+	 * the io_queue_size as much as possible.
+	 */
+  opts->io_queue_size = UINT16_MAX;
+  if (options != NULL && options->io_queue_size != 0)
+  {
+    opts->io_queue_size = options->io_queue_size;
+  }
+  if (options != NULL && options->num_io_queues != 0)
+  {
+    opts->num_io_queues = options->num_io_queues;
+  }
+
+	/* Set the header and data_digest */
+  opts->header_digest = options ? options->header_digest : false;
+	opts->data_digest = options ? options->data_digest : false;
+
+  if (probed != NULL && i >= 0)
+  {
+    probed[i] = true;
+  }
+	return true;
+}
+
+
+static void attach_cb(void *cb_ctx,
+                      const struct spdk_nvme_transport_id *trid,
+                      struct spdk_nvme_ctrlr *ctrlr,
+                      const struct spdk_nvme_ctrlr_opts *opts)
+{
+	const struct spdk_nvme_ctrlr_data *cdata = spdk_nvme_ctrlr_get_data(ctrlr);
+  struct cb_ctx* ctx = (struct cb_ctx*)cb_ctx;
+  int i = cb_ctx_find(ctx, trid);
+
+  SPDK_INFOLOG(SPDK_LOG_NVME,
+               "attached device %s: %s, %d namespaces, pid %d\n",
+               trid->traddr, cdata->mn,
+               spdk_nvme_ctrlr_get_num_ns(ctrlr),
+               getpid());
+
+  if (i < 0)
+  {
+    // not requested by the caller, nobody else will release it
+    SPDK_ERRLOG("unexpected device attached: %s\n", trid->traddr);
+    spdk_nvme_detach(ctrlr);
+    return;
+  }
+
+  ctx->ctrlr[i] = ctrlr;
+  if (ctx->attach_tick != NULL)
+  {
+    ctx->attach_tick[i] = spdk_get_ticks();
+  }
+}
+
+
+////rpc
+///////////////////////////////
+
+// move the calling thread to the other allowed cores of the process, so
+// it does not delay the IO polled in the driver core. Returns the number of
+// these cores, and the thread is kept where it is when there is none.
+static int driver_thread_off_core(void)
+{
+  cpu_set_t cpuset;
+  int cores = 0;
+
+  CPU_ZERO(&cpuset);
+  for (int i=0; i<g_driver_core_allowed_count; i++)
+  {
+    if (g_driver_core_allowed[i] != g_driver_core)
+    {
+      CPU_SET(g_driver_core_allowed[i], &cpuset);
+      cores ++;
+    }
+  }
+  if (cores != 0)
+  {
+    pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+  }
+
+  return cores;
+}
+
+static void* rpc_server(void* args)
+{
+  int rc = 0;
+
+  SPDK_DEBUGLOG(SPDK_LOG_NVME, "starting rpc server ...\n");
+  
+  // start the rpc
+  rc = spdk_rpc_listen("/var/tmp/spdk.sock");
+  if (rc != 0)
+  {
+    SPDK_ERRLOG("rpc fail to get the sock \n");
+    return NULL;
+  }
+
+  spdk_rpc_set_state(SPDK_RPC_STARTUP);
+  if (driver_thread_off_core() == 0)
+  {
+    SPDK_NOTICELOG("rpc server shares the core %d with IO\n", g_driver_core);
+  }
+
+  // the listen socket is not exposed by spdk rpc, so it is polled in a
+  // short interval to keep the rpc responsive
+  while(1)
+  {
+    spdk_rpc_accept();
+    usleep(1000);
+  }
+
+  spdk_rpc_close();
+}
+
+
+static void
+rpc_get_nvme_controllers(struct spdk_jsonrpc_request *request,
+                         const struct spdk_json_val *params)
+{
+  struct spdk_json_write_ctx *w;
+
+  w = spdk_jsonrpc_begin_result(request);
+  if (w == NULL) {
+    return;
+  }
+
+  spdk_json_write_array_begin(w);
+
+  for (int i=0; i<CMD_LOG_MAX_Q; i++)
+  {
+    if (cmd_log_queue_table[i].tail_index < CMD_LOG_DEPTH)
+    {
+      uint32_t tail = cmd_log_queue_table[i].tail_index;
+      struct cmd_log_entry_t* table = cmd_log_queue_table[i].table;
+
+      spdk_json_write_uint32(w, tail);
+
+      // send commands details
+      spdk_json_write_array_begin(w);
+      for (int j=0; j<4; j++)
+      {
+        uint32_t index = (tail+CMD_LOG_DEPTH-1-j)%CMD_LOG_DEPTH;
+        spdk_json_write_uint32(w, table[index].cmd.opc);
+      }
+      spdk_json_write_array_end(w);
+    }
+  }
+
+  spdk_json_write_array_end(w);
+  
+  spdk_jsonrpc_end_result(request, w);
+}
+SPDK_RPC_REGISTER("get_nvme_controllers", rpc_get_nvme_controllers, SPDK_RPC_STARTUP | SPDK_RPC_RUNTIME)
+
+
+// text of metrics in prometheus exposition format
+struct metrics_text {
+  char* buf;
+  size_t size;
+  size_t len;
+};
+
+static void metrics_printf(struct metrics_text* m, const char* fmt, ...)
+{
+  int n;
+  va_list ap;
+  bool fit = m->len < m->size;
+
+  // only count the length when the buffer is full
+  va_start(ap, fmt);
+  n = vsnprintf(fit ? m->buf+m->len : NULL, fit ? m->size-m->len : 0, fmt, ap);
+  va_end(ap);
+  if (n > 0)
+  {
+    m->len += n;
+  }
+}
+
+static const struct {
+  const char* name;
+  const char* help;
+  size_t offset;
+} metrics_counters[] = {
+  {"commands_submitted_total", "commands submitted", offsetof(struct driver_io_stat, submitted)},
+  {"commands_completed_total", "commands completed", offsetof(struct driver_io_stat, completed)},
+  {"reads_total", "read commands completed", offsetof(struct driver_io_stat, reads)},
+  {"writes_total", "write commands completed", offsetof(struct driver_io_stat, writes)},
+  {"read_bytes_total", "bytes read", offsetof(struct driver_io_stat, bytes_read)},
+  {"written_bytes_total", "bytes written", offsetof(struct driver_io_stat, bytes_written)},
+  {"errors_total", "commands completed with error", offsetof(struct driver_io_stat, errors)},
+};
+
+// one metric family has samples of all sources, e.g. qpairs or ioworkers
+static void metrics_family(struct metrics_text* m,
+                           const char* group,
+                           char (*labels)[128],
+                           struct driver_io_stat** stats,
+                           unsigned int count)
+{
+  if (count == 0)
+  {
+    return;
+  }
+
+  for (unsigned int k=0; k<sizeof(metrics_counters)/sizeof(metrics_counters[0]); k++)
+  {
+    metrics_printf(m, "# HELP pynvme_%s_%s %s\n", group,
+                   metrics_counters[k].name, metrics_counters[k].help);
+    metrics_printf(m, "# TYPE pynvme_%s_%s counter\n", group, metrics_counters[k].name);
+    for (unsigned int i=0; i<count; i++)
+    {
+      uint64_t* v = (uint64_t*)((char*)stats[i]+metrics_counters[k].offset);
+      metrics_printf(m, "pynvme_%s_%s{%s} %lu\n", group, metrics_counters[k].name,
+                     labels[i], __atomic_load_n(v, __ATOMIC_RELAXED));
+    }
+  }
+
+  metrics_printf(m, "# HELP pynvme_%s_inflight commands outstanding\n", group);
+  metrics_printf(m, "# TYPE pynvme_%s_inflight gauge\n", group);
+  for (unsigned int i=0; i<count; i++)
+  {
+    uint64_t submitted = __atomic_load_n(&stats[i]->submitted, __ATOMIC_RELAXED);
+    uint64_t completed = __atomic_load_n(&stats[i]->completed, __ATOMIC_RELAXED);
+    metrics_printf(m, "pynvme_%s_inflight{%s} %lu\n", group, labels[i],
+                   submitted > completed ? submitted-completed : 0);
+  }
+
+  metrics_printf(m, "# HELP pynvme_%s_latency_us latency of commands in us\n", group);
+  metrics_printf(m, "# TYPE pynvme_%s_latency_us histogram\n", group);
+  for (unsigned int i=0; i<count; i++)
+  {
+    uint64_t cumulative = 0;
+
+    for (int b=0; b<DRIVER_STAT_LATENCY_NUM-1; b++)
+    {
+      cumulative += stats[i]->latency_hist[b];
+      metrics_printf(m, "pynvme_%s_latency_us_bucket{%s,le=\"%lu\"} %lu\n",
+                     group, labels[i], 1UL<<b, cumulative);
+    }
+    cumulative += stats[i]->latency_hist[DRIVER_STAT_LATENCY_NUM-1];
+    metrics_printf(m, "pynvme_%s_latency_us_bucket{%s,le=\"+Inf\"} %lu\n",
+                   group, labels[i], cumulative);
+    metrics_printf(m, "pynvme_%s_latency_us_sum{%s} %lu\n",
+                   group, labels[i], stats[i]->latency_sum_us);
+    metrics_printf(m, "pynvme_%s_latency_us_count{%s} %lu\n",
+                   group, labels[i], cumulative);
+  }
+}
+
+// returns the length of the whole text, which may be truncated in buf
+size_t driver_metrics(char* buf, size_t size)
+{
+  unsigned int count = 0;
+  char labels[DRIVER_STAT_IOWORKER_MAX][128];
+  struct driver_io_stat* stats[DRIVER_STAT_IOWORKER_MAX];
+  struct metrics_text m = {buf, size, 0};
+
+  if (size != 0)
+  {
+    buf[0] = '\0';
+  }
+
+  if (g_driver_stat_table_ptr == NULL)
+  {
+    return 0;
+  }
+
+  // active qpairs of all controllers
+  for (int c=0; c<DRIVER_STAT_CTRLR_MAX; c++)
+  {
+    for (int i=0; i<CMD_LOG_MAX_Q && count<DRIVER_STAT_IOWORKER_MAX; i++)
+    {
+      if (g_driver_stat_table_ptr->qpair_active[c][i])
+      {
+        snprintf(labels[count], sizeof(labels[0]), "ctrlr=\"%s\",qid=\"%d\"",
+                 g_driver_stat_table_ptr->ctrlr[c], i);
+        stats[count++] = &g_driver_stat_table_ptr->qpair[c][i];
+      }
+    }
+  }
+  metrics_family(&m, "qpair", labels, stats, count);
+
+  // running ioworkers
+  count = 0;
+  for (int i=0; i<DRIVER_STAT_IOWORKER_MAX; i++)
+  {
+    struct driver_ioworker_stat* s = &g_driver_stat_table_ptr->ioworker[i];
+
+    if (__atomic_load_n(&s->pid, __ATOMIC_ACQUIRE) != 0)
+    {
+      snprintf(labels[count], sizeof(labels[0]), "pid=\"%d\",core=\"%d\"",
+               s->pid, s->cpu_core);
+      stats[count++] = &s->stat;
+    }
+  }
+  metrics_family(&m, "ioworker", labels, stats, count);
+
+  return m.len;
+}
+
+// bytes transferred by the ioworker process, used to report its progress
+uint64_t driver_ioworker_bytes(int pid)
+{
+  if (g_driver_stat_table_ptr == NULL)
+  {
+    return 0;
+  }
+
+  for (int i=0; i<DRIVER_STAT_IOWORKER_MAX; i++)
+  {
+    struct driver_ioworker_stat* s = &g_driver_stat_table_ptr->ioworker[i];
+
+    if (__atomic_load_n(&s->pid, __ATOMIC_ACQUIRE) == pid)
+    {
+      return __atomic_load_n(&s->stat.bytes_read, __ATOMIC_RELAXED) +
+             __atomic_load_n(&s->stat.bytes_written, __ATOMIC_RELAXED);
+    }
+  }
+
+  return 0;
+}
+
+
+static void rpc_write_io_stat(struct spdk_json_write_ctx *w,
+                              const struct driver_io_stat* stat)
+{
+  uint64_t submitted = __atomic_load_n(&stat->submitted, __ATOMIC_RELAXED);
+  uint64_t completed = __atomic_load_n(&stat->completed, __ATOMIC_RELAXED);
+
+  spdk_json_write_named_uint64(w, "submitted", submitted);
+  spdk_json_write_named_uint64(w, "completed", completed);
+  spdk_json_write_named_uint64(w, "inflight", submitted > completed ? submitted-completed : 0);
+  spdk_json_write_named_uint64(w, "reads", stat->reads);
+  spdk_json_write_named_uint64(w, "writes", stat->writes);
+  spdk_json_write_named_uint64(w, "bytes_read", stat->bytes_read);
+  spdk_json_write_named_uint64(w, "bytes_written", stat->bytes_written);
+  spdk_json_write_named_uint64(w, "errors", stat->errors);
+  spdk_json_write_named_uint64(w, "latency_sum_us", stat->latency_sum_us);
+
+  spdk_json_write_name(w, "latency_hist");
+  spdk_json_write_array_begin(w);
+  for (int i=0; i<DRIVER_STAT_LATENCY_NUM; i++)
+  {
+    spdk_json_write_uint64(w, stat->latency_hist[i]);
+  }
+  spdk_json_write_array_end(w);
+}
+
+static void
+rpc_get_nvme_qpair_stats(struct spdk_jsonrpc_request *request,
+                         const struct spdk_json_val *params)
+{
+  struct spdk_json_write_ctx *w;
+
+  if (g_driver_stat_table_ptr == NULL)
+  {
+    spdk_jsonrpc_send_error_response(request, SPDK_JSONRPC_ERROR_INTERNAL_ERROR,
+                                     "io statistics not available");
+    return;
+  }
+
+  w = spdk_jsonrpc_begin_result(request);
+  if (w == NULL) {
+    return;
+  }
+
+  spdk_json_write_array_begin(w);
+  for (int c=0; c<DRIVER_STAT_CTRLR_MAX; c++)
+  {
+    for (int i=0; i<CMD_LOG_MAX_Q; i++)
+    {
+      if (g_driver_stat_table_ptr->qpair_active[c][i])
+      {
+        spdk_json_write_object_begin(w);
+        spdk_json_write_named_string(w, "ctrlr", g_driver_stat_table_ptr->ctrlr[c]);
+        spdk_json_write_named_uint32(w, "qid", i);
+        rpc_write_io_stat(w, &g_driver_stat_table_ptr->qpair[c][i]);
+        spdk_json_write_object_end(w);
+      }
+    }
+  }
+  spdk_json_write_array_end(w);
+
+  spdk_jsonrpc_end_result(request, w);
+}
+SPDK_RPC_REGISTER("get_nvme_qpair_stats", rpc_get_nvme_qpair_stats, SPDK_RPC_STARTUP | SPDK_RPC_RUNTIME)
+
+
+static void
+rpc_get_nvme_ioworker_stats(struct spdk_jsonrpc_request *request,
+                            const struct spdk_json_val *params)
+{
+  struct spdk_json_write_ctx *w;
+
+  if (g_driver_stat_table_ptr == NULL)
+  {
+    spdk_jsonrpc_send_error_response(request, SPDK_JSONRPC_ERROR_INTERNAL_ERROR,
+                                     "io statistics not available");
+    return;
+  }
+
+  w = spdk_jsonrpc_begin_result(request);
+  if (w == NULL) {
+    return;
+  }
+
+  spdk_json_write_array_begin(w);
+  for (int i=0; i<DRIVER_STAT_IOWORKER_MAX; i++)
+  {
+    struct driver_ioworker_stat* s = &g_driver_stat_table_ptr->ioworker[i];
+
+    if (__atomic_load_n(&s->pid, __ATOMIC_ACQUIRE) != 0)
+    {
+      spdk_json_write_object_begin(w);
+      spdk_json_write_named_int32(w, "pid", s->pid);
+      spdk_json_write_named_int32(w, "cpu_core", s->cpu_core);
+      spdk_json_write_named_uint32(w, "qdepth", s->qdepth);
+      rpc_write_io_stat(w, &s->stat);
+      spdk_json_write_object_end(w);
+    }
+  }
+  spdk_json_write_array_end(w);
+
+  spdk_jsonrpc_end_result(request, w);
+}
+SPDK_RPC_REGISTER("get_nvme_ioworker_stats", rpc_get_nvme_ioworker_stats, SPDK_RPC_STARTUP | SPDK_RPC_RUNTIME)
+
+
+static void
+rpc_get_nvme_metrics(struct spdk_jsonrpc_request *request,
+                     const struct spdk_json_val *params)
+{
+  char* buf;
+  size_t size;
+  struct spdk_json_write_ctx *w;
+
+  // the text grows with active qpairs and ioworkers, get the size first
+  size = driver_metrics(NULL, 0) + 1;
+  buf = malloc(size);
+  if (buf == NULL)
+  {
+    spdk_jsonrpc_send_error_response(request, SPDK_JSONRPC_ERROR_INTERNAL_ERROR,
+                                     "no memory for metrics");
+    return;
+  }
+  driver_metrics(buf, size);
+
+  w = spdk_jsonrpc_begin_result(request);
+  if (w != NULL) {
+    spdk_json_write_string(w, buf);
+    spdk_jsonrpc_end_result(request, w);
+  }
+  free(buf);
+}
+SPDK_RPC_REGISTER("get_nvme_metrics", rpc_get_nvme_metrics, SPDK_RPC_STARTUP | SPDK_RPC_RUNTIME)
+
+
+////driver system
+///////////////////////////////
+
+// get cpus of the NUMA node from sysfs, the list is like "0-13,28-41"
+static int driver_numa_node_cpus(int node, int* cpus, int max)
+{
+  FILE* f;
+  char path[64];
+  char sep;
+  int first, last;
+  int count = 0;
+
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+  f = fopen(path, "r");
+  if (f == NULL)
+  {
+    return 0;
+  }
+
+  while (fscanf(f, "%d", &first) == 1)
+  {
+    last = first;
+    if (fscanf(f, "%c", &sep) == 1 && sep == '-')
+    {
+      if (fscanf(f, "%d%c", &last, &sep) < 1)
+      {
+        break;
+      }
+    }
+
+    for (int c=first; c<=last && c<DRIVER_MAX_CORES && count<max; c++)
+    {
+      cpus[count++] = c;
+    }
+  }
+
+  fclose(f);
+  return count;
+}
+
+// get the cores allowed to this process, and pick one of them as the
+// initial core, if no core can be claimed. The NUMA node can be specified by the environment
+// variable PYNVME_NUMA_NODE, which is usually the node of the device,
+// so the process runs and allocates buffers in local socket.
+static int driver_init_core(void)
+{
+  int cpus[DRIVER_MAX_CORES];
+  int count = 0;
+  cpu_set_t affinity;
+  const char* node = getenv("PYNVME_NUMA_NODE");
+
+  if (node != NULL && atoi(node) >= 0)
+  {
+    g_driver_numa_socket = atoi(node);
+    count = driver_numa_node_cpus(g_driver_numa_socket, cpus, DRIVER_MAX_CORES);
+    SPDK_DEBUGLOG(SPDK_LOG_NVME, "%d cpus in numa node %d\n",
+                  count, g_driver_numa_socket);
+  }
+
+  if (count == 0)
+  {
+    // no numa information, use any core
+    for (int c=0; c<get_nprocs() && c<DRIVER_MAX_CORES; c++)
+    {
+      cpus[count++] = c;
+    }
+  }
+
+  // limited by the affinity of the process, e.g. by taskset
+  CPU_ZERO(&affinity);
+  if (sched_getaffinity(0, sizeof(affinity), &affinity) != 0)
+  {
+    CPU_ZERO(&affinity);
+  }
+
+  g_driver_core_allowed_count = 0;
+  for (int i=0; i<count; i++)
+  {
+    if (CPU_COUNT(&affinity) == 0 || CPU_ISSET(cpus[i], &affinity))
+    {
+      g_driver_core_allowed[g_driver_core_allowed_count++] = cpus[i];
+    }
+  }
+
+  if (g_driver_core_allowed_count == 0)
+  {
+    return getpid()%get_nprocs();
+  }
+
+  return g_driver_core_allowed[getpid()%g_driver_core_allowed_count];
+}
+
+// the core table is created by the first process, others map it. New
+// shared memory is zero filled.
+static pid_t* driver_core_table_map(bool* created)
+{
+  int fd;
+  void* ptr;
+  size_t size = sizeof(pid_t)*DRIVER_MAX_CORES;
+
+  *created = true;
+  fd = shm_open(DRIVER_CORE_TABLE_NAME, O_RDWR|O_CREAT|O_EXCL, 0600);
+  if (fd < 0 && errno == EEXIST)
+  {
+    *created = false;
+    fd = shm_open(DRIVER_CORE_TABLE_NAME, O_RDWR, 0600);
+  }
+
+  if (fd < 0)
+  {
+    SPDK_ERRLOG("fail to open the core table, errno %d\n", errno);
+    return NULL;
+  }
+
+  if (ftruncate(fd, size) != 0)
+  {
+    SPDK_ERRLOG("fail to size the core table, errno %d\n", errno);
+    close(fd);
+    return NULL;
+  }
+
+  ptr = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+// the owner process of the core is gone without releasing it
+static inline bool driver_core_is_stale(pid_t owner)
+{
+  return owner != 0 && kill(owner, 0) != 0 && errno == ESRCH;
+}
+
+static int driver_core_try_claim(pid_t pid)
+{
+  int count = g_driver_core_allowed_count;
+
+  // start from different cores to reduce collisions
+  for (int i=0; i<count; i++)
+  {
+    int core = g_driver_core_allowed[(pid+i)%count];
+    pid_t owner = g_driver_core_table_ptr[core];
+
+    if (owner == 0 || driver_core_is_stale(owner))
+    {
+      if (__sync_bool_compare_and_swap(&g_driver_core_table_ptr[core],
+                                       owner, pid))
+      {
+        return core;
+      }
+    }
+  }
+
+  return -1;
+}
+
+// claim an exclusive core from the allowed cores, and run on it. The
+// first process does not wait, other processes (e.g. ioworkers) wait
+// some seconds for a free core.
+static int driver_core_claim(bool wait)
+{
+  int core;
+  cpu_set_t cpuset;
+  pid_t pid = getpid();
+  unsigned int retry = wait ? DRIVER_CORE_WAIT_S*100 : 0;
+
+  assert(g_driver_core_table_ptr != NULL);
+  while ((core = driver_core_try_claim(pid)) < 0 && retry--)
+  {
+    usleep(10*1000);
+  }
+
+  if (core < 0)
+  {
+    SPDK_ERRLOG("no free core for process %d\n", pid);
+    return -1;
+  }
+
+  CPU_ZERO(&cpuset);
+  CPU_SET(core, &cpuset);
+  if (sched_setaffinity(0, sizeof(cpuset), &cpuset) != 0)
+  {
+    SPDK_ERRLOG("fail to run process %d on core %d\n", pid, core);
+  }
+
+  SPDK_DEBUGLOG(SPDK_LOG_NVME, "process %d claims core %d\n", pid, core);
+  return core;
+}
+
+static void driver_core_release(void)
+{
+  if (g_driver_core >= 0 && g_driver_core_table_ptr != NULL)
+  {
+    __sync_bool_compare_and_swap(&g_driver_core_table_ptr[g_driver_core],
+                                 getpid(), 0);
+    g_driver_core = -1;
+  }
+}
+
+uint64_t driver_get_ticks(void)
+{
+  return spdk_get_ticks();
+}
+
+uint64_t driver_get_ticks_hz(void)
+{
+  return spdk_get_ticks_hz();
+}
+
+int driver_core_get(void)
+{
+  return g_driver_core;
+}
+
+// the number of allowed cores not claimed by any live process
+int driver_core_free(void)
+{
+  int count = 0;
+
+  if (g_driver_core_table_ptr == NULL)
+  {
+    return 0;
+  }
+
+  for (int i=0; i<g_driver_core_allowed_count; i++)
+  {
+    pid_t owner = g_driver_core_table_ptr[g_driver_core_allowed[i]];
+
+    if (owner == 0 || driver_core_is_stale(owner))
+    {
+      count ++;
+    }
+  }
+
+  return count;
+}
+
+int driver_init(void)
+{
+  int ret = 0;
+  int core;
+  bool first;
+  char buf[20];
+  struct spdk_env_opts opts;
+
+  //init random sequence reproducible
+  srandom(1);
+  
+  // every process runs on its own core, which is claimed before spdk
+  // env init and used as the core mask of EAL
+  core = driver_init_core();
+  g_driver_core_table_ptr = driver_core_table_map(&first);
+  if (g_driver_core_table_ptr != NULL)
+  {
+    g_driver_core = driver_core_claim(!first);
+  }
+
+  spdk_env_opts_init(&opts);
+  sprintf(buf, "0x%llx", 1ULL<<(g_driver_core >= 0 ? g_driver_core : core));
+  opts.core_mask = buf;
+  opts.shm_id = 0;
+  opts.name = "pynvme";
+  opts.mem_size = 2048;
+  if (spdk_env_init(&opts) < 0)
+  {
+    fprintf(stderr, "Unable to initialize SPDK env\n");
+    return -1;
+  }
+
+  // distribute multiprocessing to different cores  
+  // log level setup
+  spdk_log_set_flag("nvme");
+  spdk_log_set_print_level(SPDK_LOG_INFO);
+
+  if (DRIVER_CRC32C_SLOW && spdk_process_is_primary())
+  {
+    SPDK_WARNLOG("crc32c is not accelerated by SSE4.2, build with CONFIG_ARCH=native\n");
+  }
+
+  // init cmd log
+  ret = cmd_log_init();
+  if (ret != 0)
+  {
+    return ret;
+  }
+
+  // start rpc server in primary process only, after the shared tables
+  // it reports are ready
+  if (spdk_process_is_primary())
+  {
+    pthread_t rpc_t;
+    pthread_create(&rpc_t, NULL, rpc_server, NULL);
+  }
+
+  cmd_log_qpair_init(0);
+
+  return ret;
+}
+
+
+int driver_fini(void)
+{
+  // release recycled buffers and the core of this process
+  buffer_pool_clear(NULL);
+  driver_core_release();
+  
+  //delete cmd log of admin queue
+  if (spdk_process_is_primary())
+  {
+    cmd_log_qpair_clear(0);
+    cmd_log_finish();
+    SPDK_DEBUGLOG(SPDK_LOG_NVME, "pynvme driver unloaded.\n");
+  }  
+	return 0;
+}
+
+
+void driver_config(uint64_t cfg_word)
+{
+  *g_driver_global_config_ptr = cfg_word;
+}
+
+uint64_t driver_config_read(void)
+{
+  return *g_driver_global_config_ptr;
+}
+
+int driver_numa_socket_get(void)
+{
+  return g_driver_numa_socket;
+}
+
+void driver_numa_socket_set(int socket_id)
+{
+  g_driver_numa_socket = socket_id;
+}
+
+
+////module: pcie ctrlr
+///////////////////////////////
+
+struct spdk_pci_device* pcie_init(struct spdk_nvme_ctrlr* ctrlr)
+{
+  return spdk_nvme_ctrlr_get_pci_device(ctrlr);
+}
+
+int pcie_get_numa_node(struct spdk_pci_device* pci)
+{
+  if (pci == NULL)
+  {
+    // no pcie device, e.g. nvme over tcp
+    return SPDK_ENV_SOCKET_ID_ANY;
+  }
+  return spdk_pci_device_get_socket_id(pci);
+}
+
+int pcie_cfg_read8(struct spdk_pci_device* pci,
+                   unsigned char* value,
+                   unsigned int offset)
+{
+  return spdk_pci_device_cfg_read8(pci, value, offset);
+}
+
+int pcie_cfg_write8(struct spdk_pci_device* pci,
+                    unsigned char value,
+                    unsigned int offset)
+{
+  return spdk_pci_device_cfg_write8(pci, value, offset);
+}
+
+
+////module: nvme ctrlr
+///////////////////////////////
+static void nvme_trid_init(struct spdk_nvme_transport_id* trid,
+                           const char* traddr,
+                           const struct ctrlr_options* options)
+{
+  // device address
+  memset(trid, 0, sizeof(*trid));
+  if (strchr(traddr, ':') == NULL)
+  {
+    // tcp/ip address: default port 4420 and discovery nqn
+    trid->trtype = SPDK_NVME_TRANSPORT_TCP;
+    trid->adrfam = SPDK_NVMF_ADRFAM_IPV4;
+    snprintf(trid->traddr, sizeof(trid->traddr), "%s", traddr);
+    snprintf(trid->trsvcid, sizeof(trid->trsvcid), "%s",
+             (options && options->trsvcid[0]) ? options->trsvcid : "4420");
+    snprintf(trid->subnqn, sizeof(trid->subnqn), "%s",
+             (options && options->subnqn[0]) ? options->subnqn : SPDK_NVMF_DISCOVERY_NQN);
+  }
+  else
+  {
+    // pcie address: contains ':' characters
+    trid->trtype = SPDK_NVME_TRANSPORT_PCIE;
+    snprintf(trid->traddr, sizeof(trid->traddr), "%s", traddr);
+  }
+}
+
+// the reason of a device not attached: the error of spdk probe, -ENODEV
+// when the device is not found, or -EIO when its initialization fails
+static int nvme_probe_error(int rc, bool probed)
+{
+  if (rc != 0)
+  {
+    return rc;
+  }
+
+  return probed ? -EIO : -ENODEV;
+}
+
+static struct spdk_nvme_ctrlr* nvme_probe_one(char* traddr,
+                                              const struct ctrlr_options* options,
+                                              int* error)
+{
+  struct spdk_nvme_transport_id trid;
+  struct spdk_nvme_ctrlr* ctrlr = NULL;
+  struct cb_ctx cb_ctx;
+  bool probed = false;
+	int rc;
+
+  SPDK_DEBUGLOG(SPDK_LOG_NVME, "looking for NVMe @%s\n", traddr);
+  nvme_trid_init(&trid, traddr, options);
+
+  cb_ctx.trid = &trid;
+  cb_ctx.count = 1;
+  cb_ctx.ctrlr = &ctrlr;
+  cb_ctx.attach_tick = NULL;
+  cb_ctx.probed = &probed;
+  cb_ctx.options = options;
+  rc = spdk_nvme_probe(&trid, &cb_ctx, probe_cb, attach_cb, NULL);
+  if (rc != 0 || ctrlr == NULL)
+  {
+    SPDK_ERRLOG("not found device: %s, rc %d, cb_ctx.ctrlr %p\n",
+                trid.traddr, rc, ctrlr);
+    *error = nvme_probe_error(rc, probed);
+    return NULL;
+  }
+
+  *error = 0;
+  return ctrlr;
+}
+
+struct spdk_nvme_ctrlr* nvme_probe(char* traddr,
+                                   const struct ctrlr_options* options)
+{
+  int error;
+
+  return nvme_probe_one(traddr, options, &error);
+}
+
+// probe and attach multiple devices. PCIe devices are enumerated in one
+// probe, where spdk initializes all controllers together, so the time is
+// decided by the slowest device. Fabrics targets are connected one by one.
+// Returns the number of attached devices, and the time and the error of
+// each device, refer to nvme_probe_error().
+int nvme_probe_multi(char** traddrs,
+                     unsigned int count,
+                     const struct ctrlr_options* options,
+                     struct spdk_nvme_ctrlr** ctrlrs,
+                     uint64_t* attach_us,
+                     int* errors)
+{
+  int rc = 0;
+  int attached = 0;
+  unsigned int pcie_count = 0;
+  uint64_t start = spdk_get_ticks();
+  uint64_t* attach_tick = calloc(count, sizeof(uint64_t));
+  bool* probed = calloc(count, sizeof(bool));
+  struct spdk_nvme_transport_id* trid = calloc(count, sizeof(*trid));
+  struct spdk_nvme_transport_id pcie_trid;
+  struct cb_ctx cb_ctx;
+
+  if (trid == NULL || attach_tick == NULL || probed == NULL)
+  {
+    free(trid);
+    free(attach_tick);
+    free(probed);
+    return -1;
+  }
+
+  for (unsigned int i=0; i<count; i++)
+  {
+    nvme_trid_init(&trid[i], traddrs[i], options);
+    pcie_count += (trid[i].trtype == SPDK_NVME_TRANSPORT_PCIE);
+    ctrlrs[i] = NULL;
+  }
+
+  // enumerate all pcie devices, probe_cb picks the targets
+  if (pcie_count != 0)
+  {
+    memset(&pcie_trid, 0, sizeof(pcie_trid));
+    pcie_trid.trtype = SPDK_NVME_TRANSPORT_PCIE;
+    cb_ctx.trid = trid;
+    cb_ctx.count = count;
+    cb_ctx.ctrlr = ctrlrs;
+    cb_ctx.attach_tick = attach_tick;
+    cb_ctx.probed = probed;
+    cb_ctx.options = options;
+    rc = spdk_nvme_probe(&pcie_trid, &cb_ctx, probe_cb, attach_cb, NULL);
+    if (rc != 0)
+    {
+      SPDK_ERRLOG("fail to probe pcie devices, rc %d\n", rc);
+    }
+  }
+
+  for (unsigned int i=0; i<count; i++)
+  {
+    if (trid[i].trtype != SPDK_NVME_TRANSPORT_PCIE)
+    {
+      ctrlrs[i] = nvme_probe_one(traddrs[i], options, &errors[i]);
+      attach_tick[i] = spdk_get_ticks();
+    }
+    else
+    {
+      errors[i] = nvme_probe_error(rc, probed[i]);
+    }
+
+    if (ctrlrs[i] != NULL)
+    {
+      attach_us[i] = ticks_to_us(attach_tick[i]-start);
+      errors[i] = 0;
+      driver_stat_admin_open(ctrlrs[i]);
+      attached ++;
+    }
+    else
+    {
+      SPDK_ERRLOG("not found device: %s, error %d\n", traddrs[i], errors[i]);
+      attach_us[i] = 0;
+    }
+  }
+
+  free(trid);
+  free(attach_tick);
+  free(probed);
+  return attached;
+}
+
+struct spdk_nvme_ctrlr* nvme_init(char * traddr,
+                                  const struct ctrlr_options* options)
+{
+  struct spdk_nvme_ctrlr* ctrlr;
+
+  //enum the device
+  ctrlr = nvme_probe(traddr, options);
+  if (ctrlr == NULL)
+  {
+    return NULL;
+  }
+
+  SPDK_DEBUGLOG(SPDK_LOG_NVME, "found device: %s\n", ctrlr->trid.traddr);
+  driver_stat_admin_open(ctrlr);
+  return ctrlr;
+}
+
+int nvme_fini(struct spdk_nvme_ctrlr* ctrlr)
+{
+  SPDK_DEBUGLOG(SPDK_LOG_NVME, "free ctrlr: %s\n", ctrlr->trid.traddr);
+
+  if (ctrlr == NULL)
+  {
+    return 0;
+  }
+
+  // io qpairs should all be deleted before closing master controller 
+  if (true == spdk_process_is_primary() &&
+      false == TAILQ_EMPTY(&ctrlr->active_io_qpairs))
+  {
+    return -1;
+  }
+  
+  SPDK_DEBUGLOG(SPDK_LOG_NVME, "close device: %s\n", ctrlr->trid.traddr);
+  if (true == spdk_process_is_primary())
+  {
+    driver_stat_qpair_close(ctrlr, 0);
+  }
+  driver_stat_ctrlr_put(ctrlr);
+  return spdk_nvme_detach(ctrlr);
+}
+
+// reset the controller, and re-create its io qpairs in place. Outstanding
+// commands are aborted. Qpairs, namespaces and buffers are still valid.
+int nvme_reset(struct spdk_nvme_ctrlr* ctrlr)
+{
+  int ret;
+  struct spdk_nvme_qpair* qpair;
+  uint64_t start = spdk_get_ticks();
+
+  // first IO is only counted after reset is done
+  g_nvme_reset_start_tick = 0;
+  memset(&g_nvme_reset_stat, 0, sizeof(g_nvme_reset_stat));
+
+  SPDK_DEBUGLOG(SPDK_LOG_NVME, "reset device: %s\n", ctrlr->trid.traddr);
+  ret = spdk_nvme_ctrlr_reset(ctrlr);
+  if (ret != 0)
+  {
+    SPDK_ERRLOG("fail to reset controller %s: %d\n", ctrlr->trid.traddr, ret);
+    return ret;
+  }
+
+  // cmds waiting for the delayed doorbell are dropped with the SQ
+  TAILQ_FOREACH(qpair, &ctrlr->active_io_qpairs, tailq)
+  {
+    if (qpair->id < CMD_LOG_MAX_Q)
+    {
+      qpair_doorbell_table[qpair->id].pending = 0;
+    }
+  }
+
+  g_nvme_reset_stat.reset_us = ticks_to_us(spdk_get_ticks()-start);
+  g_nvme_reset_start_tick = start;
+  return 0;
+}
+
+struct nvme_reset_stat* nvme_get_reset_stat(void)
+{
+  return &g_nvme_reset_stat;
+}
+
+uint64_t nvme_admin_change_count(void)
+{
+  return g_nvme_admin_change_count;
+}
+
+// recovery monitor: a thread polls CC and CSTS registers, and timestamps
+// their transitions by TSC, while the main thread is resetting the device
+static pthread_t g_nvme_monitor_thread;
+static volatile bool g_nvme_monitor_running = false;
+static struct spdk_nvme_ctrlr* g_nvme_monitor_ctrlr = NULL;
+static struct nvme_recovery_ticks g_nvme_monitor_ticks;
+static int g_nvme_monitor_core = -1;
+
+static inline void nvme_monitor_mark(uint64_t* tick, bool happen)
+{
+  if (happen && *tick == 0)
+  {
+    *tick = spdk_get_ticks();
+  }
+}
+
+static void* nvme_monitor_thread(void* args)
+{
+  cpu_set_t cpuset;
+  struct nvme_recovery_ticks* t = &g_nvme_monitor_ticks;
+
+  // busy polling in its own core, not to delay the reset or other processes
+  CPU_ZERO(&cpuset);
+  CPU_SET(g_nvme_monitor_core, &cpuset);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0)
+  {
+    SPDK_ERRLOG("fail to run recovery monitor on core %d\n", g_nvme_monitor_core);
+  }
+
+  while (g_nvme_monitor_running)
+  {
+    uint32_t cc;
+    uint32_t csts;
+
+    // registers are all 1s when the device is not accessible
+    nvme_get_reg32(g_nvme_monitor_ctrlr, 0x14, &cc);
+    nvme_get_reg32(g_nvme_monitor_ctrlr, 0x1c, &csts);
+    if (cc != 0xffffffff)
+    {
+      nvme_monitor_mark(&t->cc_en_clear, (cc&1) == 0);
+      nvme_monitor_mark(&t->cc_en_set, t->cc_en_clear && (cc&1) == 1);
+    }
+    if (csts != 0xffffffff)
+    {
+      nvme_monitor_mark(&t->csts_rdy_clear, (csts&1) == 0);
+      nvme_monitor_mark(&t->csts_rdy_set, t->csts_rdy_clear && (csts&1) == 1);
+      nvme_monitor_mark(&t->shst_complete, (csts&0xc) == 0x8);
+    }
+  }
+
+  return NULL;
+}
+
+static void nvme_recovery_monitor_release(void)
+{
+  if (g_nvme_monitor_core >= 0)
+  {
+    __sync_bool_compare_and_swap(&g_driver_core_table_ptr[g_nvme_monitor_core],
+                                 getpid(), 0);
+    g_nvme_monitor_core = -1;
+  }
+}
+
+int nvme_recovery_monitor_start(struct spdk_nvme_ctrlr* ctrlr)
+{
+  assert(ctrlr != NULL);
+  assert(g_nvme_monitor_running == false);
+
+  if (ctrlr->trid.trtype != SPDK_NVME_TRANSPORT_PCIE)
+  {
+    SPDK_ERRLOG("recovery monitor only supports PCIe controller\n");
+    return -1;
+  }
+
+  // the monitor claims a free core in the core table by this process
+  g_nvme_monitor_core = -1;
+  if (g_driver_core_table_ptr != NULL)
+  {
+    g_nvme_monitor_core = driver_core_try_claim(getpid());
+  }
+  if (g_nvme_monitor_core < 0)
+  {
+    SPDK_ERRLOG("no free core for the recovery monitor\n");
+    return -1;
+  }
+
+  memset(&g_nvme_monitor_ticks, 0, sizeof(g_nvme_monitor_ticks));
+  g_nvme_monitor_ctrlr = ctrlr;
+  g_nvme_monitor_running = true;
+  g_nvme_monitor_ticks.start = spdk_get_ticks();
+  if (pthread_create(&g_nvme_monitor_thread, NULL, nvme_monitor_thread, NULL) != 0)
+  {
+    SPDK_ERRLOG("fail to create the recovery monitor thread\n");
+    g_nvme_monitor_running = false;
+    nvme_recovery_monitor_release();
+    return -1;
+  }
+
+  return 0;
+}
+
+struct nvme_recovery_ticks* nvme_recovery_monitor_stop(void)
+{
+  if (g_nvme_monitor_running)
+  {
+    g_nvme_monitor_running = false;
+    pthread_join(g_nvme_monitor_thread, NULL);
+    nvme_recovery_monitor_release();
+  }
+
+  return &g_nvme_monitor_ticks;
+}
+
+int nvme_set_reg32(struct spdk_nvme_ctrlr* ctrlr,
+                   unsigned int offset,
+                   unsigned int value)
+{
+  return nvme_pcie_ctrlr_set_reg_4(ctrlr, offset, value);
+}
+
+int nvme_get_reg32(struct spdk_nvme_ctrlr* ctrlr,
+                   unsigned int offset,
+                   unsigned int* value)
+{
+  return nvme_pcie_ctrlr_get_reg_4(ctrlr, offset, value);
+}
+
+int nvme_wait_completion_admin(struct spdk_nvme_ctrlr* ctrlr)
+{
+  return spdk_nvme_ctrlr_process_admin_completions(ctrlr);
+}
+
+static void nvme_deallocate_ranges(struct spdk_nvme_dsm_range *ranges,
+                                   unsigned int count)
+{
+  for (unsigned int i=0; i<count; i++)
+  {
+    SPDK_DEBUGLOG(SPDK_LOG_NVME, "deallocate lba 0x%lx, count %d\n",
+                 ranges[i].starting_lba,
+                 ranges[i].length);
+    crc32_clear(ranges[i].starting_lba, ranges[i].length, 0, 0);
+  }
+}
+
+int nvme_send_cmd_raw(struct spdk_nvme_ctrlr* ctrlr,
+                      struct spdk_nvme_qpair *qpair,
+                      unsigned int opcode,
+                      unsigned int nsid,
+                      void* buf, size_t len,
+                      unsigned int cdw10,
+                      unsigned int cdw11,
+                      unsigned int cdw12,
+                      unsigned int cdw13,
+                      unsigned int cdw14,
+                      unsigned int cdw15,
+                      spdk_nvme_cmd_cb cb_fn,
+                      void* cb_arg)
+{
+  int ret;
+  uint16_t qid;
+  struct spdk_nvme_cmd cmd;
+  struct cmd_log_entry_t* log_entry;
+
+  assert(ctrlr != NULL);
+
+  //setup cmd structure
+  memset(&cmd, 0, sizeof(struct spdk_nvme_cmd));
+  cmd.opc = opcode;
+  cmd.nsid = nsid;
+  cmd.cdw10 = cdw10;
+  cmd.cdw11 = cdw11;
+  cmd.cdw12 = cdw12;
+  cmd.cdw13 = cdw13;
+  cmd.cdw14 = cdw14;
+  cmd.cdw15 = cdw15;
+
+  qid = qpair ? qpair->id : 0;
+  log_entry = cmd_log_add_cmd(ctrlr, qid, NULL, 0, 0, 0,
+                              &cmd, cb_fn, cb_arg);
+
+  if (qpair)
+  {
+    // update host-side table for the trimed data
+    // other write-like operation updates crc32 table in driver wraper
+    if (opcode == 9)
+    {
+      nvme_deallocate_ranges(buf, cdw10+1);
+    }
+    
+    //send io cmd in qpair
+    ret = spdk_nvme_ctrlr_cmd_io_raw(ctrlr, qpair, &cmd, buf, len,
+                                     cmd_log_add_cpl_cb, log_entry);
+  }
+  else
+  {
+    //not qpair, admin cmd
+    ret = spdk_nvme_ctrlr_cmd_admin_raw(ctrlr, &cmd, buf, len,
+                                        cmd_log_add_cpl_cb, log_entry);
+  }
+
+  if (ret == 0)
+  {
+    qpair_doorbell_submit(qid);
+  }
+  return ret;
+}
+
+
+void nvme_register_aer_cb(struct spdk_nvme_ctrlr* ctrlr,
+                          spdk_nvme_aer_cb aer_cb,
+                          void* aer_cb_arg)
+{
+  spdk_nvme_ctrlr_register_aer_callback(ctrlr, aer_cb, aer_cb_arg);
+}
+
+void nvme_register_timeout_cb(struct spdk_nvme_ctrlr* ctrlr,
+                              spdk_nvme_timeout_cb timeout_cb,
+                              unsigned int timeout)
+{
+  spdk_nvme_ctrlr_register_timeout_callback(
+      ctrlr, (uint64_t)timeout*US_PER_S, timeout_cb, NULL);
+}
+
+int nvme_cpl_is_error(const struct spdk_nvme_cpl* cpl)
+{
+  return spdk_nvme_cpl_is_error(cpl);
+}
+
+
+////module: qpair
+///////////////////////////////
+
+struct spdk_nvme_qpair *qpair_create(struct spdk_nvme_ctrlr* ctrlr,
+                                      int prio, int depth,
+                                      bool delay_doorbell,
+                                      int cmb_sq)
+{
+  struct spdk_nvme_qpair* qpair;
+  struct spdk_nvme_io_qpair_opts opts;
+  bool use_cmb_sqs;
+
+  //user options
+  spdk_nvme_ctrlr_get_default_io_qpair_opts(ctrlr, &opts, sizeof(opts));
+  opts.qprio = prio;
+  opts.io_queue_size = depth;
+  opts.io_queue_requests = depth*2;
+  opts.delay_pcie_doorbell = delay_doorbell;
+
+  // place SQ in CMB or not, overriding the option of the controller. The
+  // ctrlr is shared by processes, so the option is only changed for this
+  // allocation under the recursive lock of the ctrlr.
+  nvme_robust_mutex_lock(&ctrlr->ctrlr_lock);
+  use_cmb_sqs = ctrlr->opts.use_cmb_sqs;
+  if (cmb_sq >= 0)
+  {
+    ctrlr->opts.use_cmb_sqs = cmb_sq;
+  }
+  qpair = spdk_nvme_ctrlr_alloc_io_qpair(ctrlr, &opts, sizeof(opts));
+  ctrlr->opts.use_cmb_sqs = use_cmb_sqs;
+  nvme_robust_mutex_unlock(&ctrlr->ctrlr_lock);
+  if (qpair == NULL)
+  {
+    SPDK_ERRLOG("alloc io qpair fail\n");
+    return NULL;
+  }
+
+  // limited qpair count
+  if (qpair->id >= CMD_LOG_MAX_Q)
+  {
+    SPDK_ERRLOG("not support so many queue pairs\n");
+    spdk_nvme_ctrlr_free_io_qpair(qpair);
+    return NULL;
+  }
+
+  cmd_log_qpair_init(qpair->id);
+  memset(&qpair_doorbell_table[qpair->id], 0, sizeof(struct qpair_doorbell));
+  qpair_doorbell_table[qpair->id].delayed = delay_doorbell;
+  driver_stat_qpair_open(ctrlr, qpair->id);
+  return qpair;
+}
+
+// the delayed doorbell is written at the end of polling the qpair, for
+// all pending cmds including the ones submitted in callbacks
+static int32_t qpair_process_completions(struct spdk_nvme_qpair *qpair,
+                                         uint32_t max_completions)
+{
+  int32_t ret;
+  struct qpair_doorbell* db = &qpair_doorbell_table[qpair->id];
+
+  ret = spdk_nvme_qpair_process_completions(qpair, max_completions);
+  if (db->delayed && db->pending != 0)
+  {
+    qpair_doorbell_ring(db, db->pending);
+    db->pending = 0;
+  }
+
+  return ret;
+}
+
+int qpair_wait_completion(struct spdk_nvme_qpair *qpair, uint32_t max_completions)
+{
+  return qpair_process_completions(qpair, max_completions);
+}
+
+int qpair_wait_completion_batch(struct spdk_nvme_qpair *qpair,
+                                struct cpl_batch* batch)
+{
+  int ret;
+  uint16_t qid = qpair->id;
+
+  assert(qid < CMD_LOG_MAX_Q);
+  assert(batch->max > 0);
+
+  // reap at most max completions, so all of them fit in the batch
+  batch->count = 0;
+  batch->completed = 0;
+  cmd_log_batch[qid] = batch;
+  ret = qpair_process_completions(qpair, batch->max);
+  cmd_log_batch[qid] = NULL;
+
+  if (ret < 0)
+  {
+    return ret;
+  }
+
+  // split requests complete more CQEs than callbacks, so count the
+  // requests, including the ones not batched
+  return batch->completed;
+}
+
+int qpair_get_id(struct spdk_nvme_qpair* q)
+{
+  // q NULL is admin queue
+  return q ? q->id : 0;
+}
+
+struct qpair_doorbell_stat* qpair_get_doorbell_stat(struct spdk_nvme_qpair* q)
+{
+  return &qpair_doorbell_table[q ? q->id : 0].stat;
+}
+
+int qpair_free(struct spdk_nvme_qpair* q)
+{
+  if (q == NULL)
+  {
+    return 0;
+  }
+  
+  SPDK_DEBUGLOG(SPDK_LOG_NVME, "free qpair: %d\n", q->id);
+  cmd_log_qpair_clear(q->id);
+  driver_stat_qpair_close(q->ctrlr, q->id);
+
+  return spdk_nvme_ctrlr_free_io_qpair(q);
+}
+
+
+////module: namespace
+///////////////////////////////
+
+struct spdk_nvme_ns* ns_init(struct spdk_nvme_ctrlr* ctrlr, uint32_t nsid)
+{
+  struct spdk_nvme_ns* ns = spdk_nvme_ctrlr_get_ns(ctrlr, nsid);
+  uint64_t nsze = spdk_nvme_ns_get_num_sectors(ns);
+
+  assert(ns != NULL);
+  if (0 != memzone_reserve_shared_memory(sizeof(uint32_t)*nsze))
+  {
+    return NULL;
+  }
+
+  return ns;
+}
+
+// send the io with the data already in buffer
+static int ns_cmd_read_write_raw(int is_read,
+                                 struct spdk_nvme_ns* ns,
+                                 struct spdk_nvme_qpair* qpair,
+                                 void* buf,
+                                 size_t len,
+                                 uint64_t lba,
+                                 uint16_t lba_count,
+                                 uint32_t io_flags,
+                                 bool verify,
+                                 bool known,
+                                 spdk_nvme_cmd_cb cb_fn,
+                                 void* cb_arg)
+{
+  struct spdk_nvme_cmd cmd;
+  struct cmd_log_entry_t* log_entry;
+  int ret;
+  enum cycles_stage stage;
+  uint32_t* crc = NULL;
+  uint32_t lba_size = spdk_nvme_ns_get_sector_size(ns);
+
+  assert(ns != NULL);
+  assert(qpair != NULL);
+
+  //only support 1 namespace now
+  assert(ns->id == 1);
+  
+  //validate data buffer
+  assert(buf != NULL);
+  assert(lba_size == 512);
+  assert(len >= lba_count*lba_size);
+  assert((io_flags&0xffff) == 0);
+  
+  //setup cmd structure
   memset(&cmd, 0, sizeof(struct spdk_nvme_cmd));
-  cmd.opc = opcode;
-  cmd.nsid = nsid;
-  cmd.cdw10 = cdw10;
-  cmd.cdw11 = cdw11;
-  cmd.cdw12 = cdw12;
-  cmd.cdw13 = cdw13;
-  cmd.cdw14 = cdw14;
-  cmd.cdw15 = cdw15;
+  cmd.opc = is_read ? 2 : 1;
+  cmd.nsid = ns->id;
+  cmd.cdw10 = lba;
+  cmd.cdw11 = lba>>32;
+  cmd.cdw12 = io_flags | (lba_count-1);
+  cmd.cdw13 = 0;
+  cmd.cdw14 = 0;
+  cmd.cdw15 = 0;
+
+  //crc of written data is kept with the command. Write of known
+  //pattern is committed without crc.
+  stage = cycles_switch(CYCLES_VERIFY);
+  if (is_read != true && verify && !known && g_driver_csum_table_ptr != NULL)
+  {
+    crc = buffer_calc_data(buf, lba_count, lba_size);
+    if (crc == NULL)
+    {
+      cycles_switch(stage);
+      return -ENOMEM;
+    }
+  }
+
+  //get entry in cmd log, without buffer to skip the verification
+  cycles_switch(CYCLES_CMDLOG);
+  log_entry = cmd_log_add_cmd(ns->ctrlr, qpair->id, (is_read && verify) ? buf : NULL,
+                              lba, lba_count, lba_size,
+                              &cmd, cb_fn, cb_arg);
+  if (is_read != true)
+  {
+    log_entry->crc = crc;
+    log_entry->known = known;
+  }
+  if (log_entry->buf != NULL || log_entry->known)
+  {
+    cmd_log_inflight_begin(log_entry);
+  }
+  cycles_switch(stage);
+
+  //send io cmd in qpair
+  ret = spdk_nvme_ctrlr_cmd_io_raw(ns->ctrlr, qpair, &cmd, buf, len,
+                                   cmd_log_add_cpl_cb, log_entry);
+  if (ret != 0 && cmd_log_write_tracked(log_entry))
+  {
+    cmd_log_cancel_write(log_entry);
+  }
+  if (ret == 0)
+  {
+    qpair_doorbell_submit(qpair->id);
+  }
+  return ret;
+}
+
+int ns_cmd_read_write(int is_read,
+                      struct spdk_nvme_ns* ns,
+                      struct spdk_nvme_qpair* qpair,
+                      void* buf,
+                      size_t len,
+                      uint64_t lba,
+                      uint16_t lba_count,
+                      uint32_t io_flags,
+                      spdk_nvme_cmd_cb cb_fn,
+                      void* cb_arg)
+{
+  //fill write buffer with lba and token, checksum is committed at completion
+  if (is_read != true)
+  {
+    //for write buffer
+    enum cycles_stage stage = cycles_switch(CYCLES_FILL);
+    buffer_fill_data(buf, lba, lba_count, spdk_nvme_ns_get_sector_size(ns));
+    cycles_switch(stage);
+  }
+
+  return ns_cmd_read_write_raw(is_read, ns, qpair, buf, len, lba, lba_count,
+                               io_flags, true, false, cb_fn, cb_arg);
+}
+
+static void ns_cmd_reset_sgl_cb(void* cb_ctx, uint32_t offset)
+{
+  struct cmd_log_entry_t* log_entry = (struct cmd_log_entry_t*)cb_ctx;
+
+  // locate the segment of the offset
+  log_entry->iov_index = 0;
+  while (offset >= log_entry->iov[log_entry->iov_index].iov_len)
+  {
+    offset -= log_entry->iov[log_entry->iov_index].iov_len;
+    log_entry->iov_index ++;
+    assert(log_entry->iov_index < log_entry->iovcnt);
+  }
+  log_entry->iov_offset = offset;
+}
+
+// segments are mapped to PRP list when SGL is not supported, so the
+// wrapper checks they are page aligned, except the first and last ones
+static int ns_cmd_next_sge_cb(void* cb_ctx, void** address, uint32_t* length)
+{
+  struct cmd_log_entry_t* log_entry = (struct cmd_log_entry_t*)cb_ctx;
+  struct iovec* iov = &log_entry->iov[log_entry->iov_index];
+
+  assert(log_entry->iov_index < log_entry->iovcnt);
+
+  *address = iov->iov_base + log_entry->iov_offset;
+  *length = iov->iov_len - log_entry->iov_offset;
+  log_entry->iov_index ++;
+  log_entry->iov_offset = 0;
+  return 0;
+}
+
+int ns_cmd_read_write_vec(int is_read,
+                          struct spdk_nvme_ns* ns,
+                          struct spdk_nvme_qpair* qpair,
+                          const struct iovec* iov,
+                          int iovcnt,
+                          uint64_t lba,
+                          uint32_t lba_count,
+                          uint32_t io_flags,
+                          spdk_nvme_cmd_cb cb_fn,
+                          void* cb_arg)
+{
+  int ret;
+  size_t len = 0;
+  struct spdk_nvme_cmd cmd;
+  struct iovec* iov_copy;
+  struct cmd_log_entry_t* log_entry;
+  uint32_t* crc = NULL;
+  uint32_t lba_size = spdk_nvme_ns_get_sector_size(ns);
+
+  assert(ns != NULL);
+  assert(qpair != NULL);
+  assert(ns->id == 1);
+
+  //validate data segments
+  assert(iov != NULL);
+  assert(iovcnt > 0);
+  assert(lba_count >= 1 && lba_count <= 0x10000);
+  assert(lba_size == 512);
+  assert((io_flags&0xffff) == 0);
+  for (int i=0; i<iovcnt; i++)
+  {
+    assert(iov[i].iov_base != NULL);
+    len += iov[i].iov_len;
+  }
+  assert(len >= lba_count*lba_size);
+
+  //setup cmd structure for cmdlog, spdk builds PRP list or SGL from segments
+  memset(&cmd, 0, sizeof(struct spdk_nvme_cmd));
+  cmd.opc = is_read ? 2 : 1;
+  cmd.nsid = ns->id;
+  cmd.cdw10 = lba;
+  cmd.cdw11 = lba>>32;
+  cmd.cdw12 = io_flags | (lba_count-1);
+
+  //fill write segments with lba and token, checksum is committed at completion
+  if (is_read != true)
+  {
+    buffer_fill_data_iov(iov, iovcnt, lba, lba_count, lba_size);
+    if (g_driver_csum_table_ptr != NULL)
+    {
+      crc = buffer_calc_data_iov(iov, iovcnt, lba_count, lba_size);
+      if (crc == NULL)
+      {
+        return -ENOMEM;
+      }
+    }
+  }
+
+  //keep the segments till completion, before taking the entry in cmd log
+  iov_copy = malloc(sizeof(struct iovec)*iovcnt);
+  if (iov_copy == NULL)
+  {
+    free(crc);
+    return -ENOMEM;
+  }
+  memcpy(iov_copy, iov, sizeof(struct iovec)*iovcnt);
+
+  log_entry = cmd_log_add_cmd(ns->ctrlr, qpair->id, NULL, lba, lba_count, lba_size,
+                              &cmd, cb_fn, cb_arg);
+  log_entry->iov = iov_copy;
+  log_entry->iovcnt = iovcnt;
+  log_entry->iov_index = 0;
+  log_entry->iov_offset = 0;
+  if (is_read != true)
+  {
+    log_entry->crc = crc;
+  }
+  if (is_read || crc != NULL)
+  {
+    cmd_log_inflight_begin(log_entry);
+  }
+
+  //send io cmd in qpair
+  if (is_read)
+  {
+    ret = spdk_nvme_ns_cmd_readv(ns, qpair, lba, lba_count,
+                                 cmd_log_add_cpl_cb, log_entry, io_flags,
+                                 ns_cmd_reset_sgl_cb, ns_cmd_next_sge_cb);
+  }
+  else
+  {
+    ret = spdk_nvme_ns_cmd_writev(ns, qpair, lba, lba_count,
+                                  cmd_log_add_cpl_cb, log_entry, io_flags,
+                                  ns_cmd_reset_sgl_cb, ns_cmd_next_sge_cb);
+  }
+
+  if (ret != 0)
+  {
+    if (cmd_log_write_tracked(log_entry))
+    {
+      cmd_log_cancel_write(log_entry);
+    }
+    free(log_entry->iov);
+    log_entry->iov = NULL;
+  }
+  else
+  {
+    qpair_doorbell_submit(qpair->id);
+  }
+  return ret;
+}
+
+uint32_t ns_get_sector_size(struct spdk_nvme_ns* ns)
+{
+  return spdk_nvme_ns_get_sector_size(ns);
+}
+
+uint64_t ns_get_num_sectors(struct spdk_nvme_ns* ns)
+{
+  return spdk_nvme_ns_get_num_sectors(ns);
+}
+
+int ns_fini(struct spdk_nvme_ns* ns)
+{
+  crc32_fini();
+  return 0;
+}
+
+
+////module: ioworker
+///////////////////////////////
+
+// used for callback
+struct ioworker_io_ctx {
+  void* data_buf;
+  size_t data_buf_len;
+  bool is_read;
+  bool outstanding;
+  uint32_t target;
+  uint64_t lba;
+  uint16_t lba_count;
+  struct timeval time_sent;
+  struct ioworker_global_ctx* gctx;
+};
+
+// latency SLO: adjust queue depth every interval, and report the
+// operating point of the last window of intervals
+#define IOWORKER_SLO_INTERVAL_US    (100*1000UL)
+#define IOWORKER_SLO_WINDOW         (10)
+#define IOWORKER_SLO_HIST_NUM       (240)
+#define IOWORKER_SLO_MIN_IOS        (8)
+
+struct ioworker_slo_sample {
+  uint32_t depth;
+  uint32_t latency_us;
+  uint64_t iops;
+};
+
+struct ioworker_global_ctx {
+  struct ioworker_args* args;
+  struct ioworker_rets* rets;
+  struct spdk_nvme_ns** ns;
+  struct spdk_nvme_qpair** qpair;
+  struct ioworker_rets* target_rets;
+  uint32_t target_count;
+  struct timeval due_time;
+  struct timeval io_due_time;
+  struct timeval io_delay_time;
+  struct timeval time_next_sec;
+  uint64_t io_count_till_last_sec;
+  uint64_t sequential_lba;
+  uint64_t io_count_sent;
+  uint64_t io_count_cplt;
+  uint32_t last_sec;
+  bool flag_finish;
+  // adaptive polling: paced IOs waiting to be sent in main loop
+  struct ioworker_io_ctx* io_ctx;
+  struct ioworker_io_ctx** pending;
+  uint32_t pending_count;
+  uint32_t latency_avg_us;
+  uint32_t poll_backoff_us;
+  uint32_t poll_slept_us;
+  // io statistics exported by rpc, NULL if no slot is available
+  struct driver_ioworker_stat* stat;
+  // latency SLO: queue depth adjusted by the latency of each interval
+  uint32_t slo_depth;
+  bool slo_slow_start;
+  struct timeval slo_next_time;
+  struct timeval slo_last_time;
+  uint64_t slo_last_cplt;
+  uint32_t slo_hist[IOWORKER_SLO_HIST_NUM];
+  uint32_t slo_hist_count;
+  struct ioworker_io_ctx** slo_parked;
+  uint32_t slo_parked_count;
+  struct ioworker_slo_sample slo_window[IOWORKER_SLO_WINDOW];
+  uint32_t slo_window_index;
+  // known pattern and verify scan: the end of the region, not included
+  uint64_t range_end;
+  // host cycles in each stage, and polls of completions
+  uint64_t cycles[CYCLES_NUM];
+  uint64_t poll_count;
+  uint64_t poll_empty_count;
+};
+
+// shorter waits are polled, since sleep itself costs tens of us
+#define IOWORKER_POLL_SLEEP_MIN_US  (20)
+
+#define ALIGN_UP(n, a)    (((n)%(a))?((n)+(a)-((n)%(a))):((n)))
+#define ALIGN_DOWN(n, a)  ((n)-((n)%(a)))
+
+static int ioworker_send_one(struct ioworker_io_ctx* ctx,
+                             struct ioworker_global_ctx* gctx);
+
 
-  qid = qpair ? qpair->id : 0;
-  log_entry = cmd_log_add_cmd(qid, NULL, 0, 0, 0,
-                              &cmd, cb_fn, cb_arg);
+// get a free slot of io statistics for this ioworker
+static struct driver_ioworker_stat* ioworker_stat_claim(uint32_t qdepth)
+{
+  pid_t pid = getpid();
 
-  if (qpair)
+  if (g_driver_stat_table_ptr == NULL)
+  {
+    return NULL;
+  }
+
+  for (int i=0; i<DRIVER_STAT_IOWORKER_MAX; i++)
+  {
+    pid_t expected = 0;
+    struct driver_ioworker_stat* s = &g_driver_stat_table_ptr->ioworker[i];
+
+    if (__atomic_compare_exchange_n(&s->pid, &expected, -1, false,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+      memset(&s->stat, 0, sizeof(s->stat));
+      s->cpu_core = driver_core_get();
+      s->qdepth = qdepth;
+      __atomic_store_n(&s->pid, pid, __ATOMIC_RELEASE);
+      return s;
+    }
+  }
+
+  SPDK_DEBUGLOG(SPDK_LOG_NVME, "no slot of io statistics for ioworker %d\n", pid);
+  return NULL;
+}
+
+static void ioworker_stat_release(struct driver_ioworker_stat* s)
+{
+  if (s != NULL)
+  {
+    __atomic_store_n(&s->pid, 0, __ATOMIC_RELEASE);
+  }
+}
+
+
+static inline void timeradd_second(struct timeval* now,
+                                     unsigned int seconds,
+                                     struct timeval* due)
+{
+  struct timeval duration;
+
+  duration.tv_sec = seconds;
+  duration.tv_usec = 0;
+  timeradd(now, &duration, due);
+}
+
+static bool ioworker_send_one_is_finish(struct ioworker_args* args,
+                                        struct ioworker_global_ctx* c)
+{
+  struct timeval now;
+
+  // limit by io count, and/or time, which happens first
+  if (c->io_count_sent == args->io_count)
+  {
+    SPDK_DEBUGLOG(SPDK_LOG_NVME, "ioworker finish, sent %ld io\n", c->io_count_sent);
+    return true;
+  }
+
+  if ((args->known_pattern || args->verify_scan) &&
+      c->sequential_lba >= c->range_end)
+  {
+    SPDK_DEBUGLOG(SPDK_LOG_NVME, "ioworker finish, range till lba %ld\n", c->range_end);
+    return true;
+  }
+
+  assert(c->io_count_sent < args->io_count);
+  gettimeofday(&now, NULL);
+  if (true == timercmp(&now, &c->due_time, >))
+  {
+    SPDK_DEBUGLOG(SPDK_LOG_NVME, "ioworker finish, due time %ld us\n", c->due_time.tv_usec);
+    return true;
+  }
+
+  return false;
+}
+
+static void ioworker_one_io_throttle(struct ioworker_global_ctx* gctx,
+                                     struct timeval* now)
+{
+  SPDK_DEBUGLOG(SPDK_LOG_NVME, "this io due at %ld.%06ld\n",
+                gctx->io_due_time.tv_sec, gctx->io_due_time.tv_usec);
+  if (true == timercmp(&gctx->io_due_time, now, >))
+  {
+    //delay usec to meet the IOPS prequisit
+    struct timeval diff;
+    timersub(&gctx->io_due_time, now, &diff);
+    usleep(timeval_to_us(&diff));
+  }
+
+  timeradd(&gctx->io_due_time, &gctx->io_delay_time, &gctx->io_due_time);
+}
+
+static uint32_t ioworker_get_duration(struct timeval* start,
+                                      struct ioworker_global_ctx* gctx)
+{
+  struct timeval now;
+  struct timeval diff;
+  uint32_t msec;
+  
+  gettimeofday(&now, NULL);
+  timersub(&now, start, &diff);
+  msec = diff.tv_sec * 1000UL;
+  return msec + (diff.tv_usec+500)/1000;
+}
+
+static uint32_t ioworker_update_rets(struct ioworker_io_ctx* ctx,
+                                     struct ioworker_rets* ret,
+                                     struct timeval* now)
+{
+  struct timeval diff;
+  uint32_t latency;
+
+  timersub(now, &ctx->time_sent, &diff);
+  latency = timeval_to_us(&diff);
+  if (latency > ret->latency_max_us)
+  {
+    ret->latency_max_us = latency;
+  }
+
+  if (ctx->is_read == true)
+  {
+    ret->io_count_read ++;
+  }
+  else
+  {
+    ret->io_count_write ++;
+  }
+
+  return latency;
+}
+
+// SNIA PTS steady state of the measurement window: the excursion of
+// round IOPS is within 20% of the average, and the excursion of the
+// linear fit is within 10% of the average
+static bool ioworker_steady_state(struct ioworker_args* args,
+                                  uint32_t seconds)
+{
+  double x_avg;
+  double y_avg = 0;
+  double y_min = 0;
+  double y_max = 0;
+  double xy = 0;
+  double xx = 0;
+  double slope;
+  uint32_t rounds = seconds/args->ss_round_seconds;
+  uint32_t window = args->ss_window;
+  double y[IOWORKER_SS_WINDOW_MAX];
+
+  assert(window <= IOWORKER_SS_WINDOW_MAX);
+  if (seconds%args->ss_round_seconds != 0 || rounds < window)
+  {
+    return false;
+  }
+
+  // average IOPS of the latest rounds
+  for (uint32_t i=0; i<window; i++)
+  {
+    uint32_t start = (rounds-window+i)*args->ss_round_seconds;
+    uint64_t sum = 0;
+
+    for (uint32_t j=0; j<args->ss_round_seconds; j++)
+    {
+      sum += args->io_counter_per_second[start+j];
+    }
+
+    y[i] = (double)sum/args->ss_round_seconds;
+    y_min = (i == 0) ? y[i] : MIN(y_min, y[i]);
+    y_max = (i == 0) ? y[i] : MAX(y_max, y[i]);
+    y_avg += y[i]/window;
+  }
+
+  // least-squares slope of round IOPS
+  x_avg = (window-1)/2.0;
+  for (uint32_t i=0; i<window; i++)
+  {
+    xy += (i-x_avg)*(y[i]-y_avg);
+    xx += (i-x_avg)*(i-x_avg);
+  }
+  slope = xy/xx;
+
+  SPDK_DEBUGLOG(SPDK_LOG_NVME, "steady state round %d: avg %f, range %f, slope %f\n",
+                rounds, y_avg, y_max-y_min, slope);
+  return y_avg != 0 &&
+         y_max-y_min <= y_avg*0.2 &&
+         (slope < 0 ? -slope : slope)*(window-1) <= y_avg*0.1;
+}
+
+static inline void ioworker_update_io_count_per_second(
+    struct ioworker_global_ctx* gctx, 
+    struct ioworker_args* args,
+    struct ioworker_rets* rets)
+{
+  uint64_t current_io_count = rets->io_count_read + rets->io_count_write;
+  
+  // update to next second
+  timeradd_second(&gctx->time_next_sec, 1, &gctx->time_next_sec);
+  args->io_counter_per_second[gctx->last_sec ++] = current_io_count - gctx->io_count_till_last_sec;
+  gctx->io_count_till_last_sec = current_io_count;
+
+  // stop the ioworker when it reaches steady state
+  if (args->ss_round_seconds != 0 && rets->ss_seconds == 0 &&
+      true == ioworker_steady_state(args, gctx->last_sec))
+  {
+    SPDK_DEBUGLOG(SPDK_LOG_NVME, "ioworker reaches steady state in %d seconds\n",
+                  gctx->last_sec);
+    rets->ss_seconds = gctx->last_sec;
+    gctx->flag_finish = true;
+  }
+}
+
+// log-linear histogram: 8 buckets per power of 2, error within 12.5%
+static inline uint32_t ioworker_slo_bucket(uint32_t latency_us)
+{
+  uint32_t msb;
+
+  if (latency_us < 8)
+  {
+    return latency_us;
+  }
+
+  msb = 31 - __builtin_clz(latency_us);
+  return (msb-2)*8 + ((latency_us>>(msb-3))&7);
+}
+
+static inline uint32_t ioworker_slo_bucket_max_us(uint32_t bucket)
+{
+  uint32_t width;
+
+  if (bucket < 8)
+  {
+    return bucket;
+  }
+
+  width = 1U<<(bucket/8-1);
+  return (8+bucket%8)*width + width-1;
+}
+
+static uint32_t ioworker_slo_percentile_us(struct ioworker_global_ctx* gctx)
+{
+  uint64_t sum = 0;
+  uint64_t threshold;
+
+  threshold = ((uint64_t)gctx->slo_hist_count*gctx->args->slo_percentile+9999)/10000;
+  for (uint32_t i=0; i<IOWORKER_SLO_HIST_NUM; i++)
+  {
+    sum += gctx->slo_hist[i];
+    if (sum >= threshold && sum != 0)
+    {
+      return ioworker_slo_bucket_max_us(i);
+    }
+  }
+
+  return ioworker_slo_bucket_max_us(IOWORKER_SLO_HIST_NUM-1);
+}
+
+// record the mismatched lba, merged to the last range if adjacent
+static void ioworker_scan_record(struct ioworker_global_ctx* gctx,
+                                 uint64_t lba,
+                                 uint16_t status,
+                                 const uint64_t* ptr,
+                                 uint32_t lba_size)
+{
+  struct ioworker_args* args = gctx->args;
+  struct ioworker_rets* rets = gctx->rets;
+  struct ioworker_mismatch* m;
+
+  rets->mismatch_lba_count ++;
+  if (rets->mismatch_count != 0)
+  {
+    m = &args->mismatch[rets->mismatch_count-1];
+    if (m->lba+m->lba_count == lba && m->status == status)
+    {
+      m->lba_count ++;
+      return;
+    }
+  }
+
+  if (rets->mismatch_count == args->mismatch_max)
+  {
+    // no more space, only count it
+    return;
+  }
+
+  m = &args->mismatch[rets->mismatch_count++];
+  memset(m, 0, sizeof(*m));
+  m->lba = lba;
+  m->lba_count = 1;
+  m->status = status;
+  if (g_driver_csum_table_ptr != NULL)
+  {
+    m->expected_crc = g_driver_csum_table_ptr[lba];
+  }
+  if (ptr != NULL)
+  {
+    m->actual_crc = buffer_calc_csum((uint64_t*)ptr, lba_size);
+    m->actual_lba = ptr[0];
+    m->actual_token = ptr[lba_size/sizeof(uint64_t)-1];
+  }
+}
+
+// verify all lba of the read, failed read is recorded as a whole
+static void ioworker_scan_verify(struct ioworker_global_ctx* gctx,
+                                 struct ioworker_io_ctx* ctx,
+                                 const struct spdk_nvme_cpl* cpl)
+{
+  uint32_t lba_size = spdk_nvme_ns_get_sector_size(gctx->ns[0]);
+
+  for (uint32_t i=0; i<ctx->lba_count; i++)
+  {
+    const uint64_t* ptr = (const uint64_t*)(ctx->data_buf+i*lba_size);
+
+    if (true == nvme_cpl_is_error(cpl))
+    {
+      uint16_t status = ((*(unsigned short*)(&cpl->status))>>1)&0x7ff;
+      ioworker_scan_record(gctx, ctx->lba+i, status, NULL, lba_size);
+    }
+    else if (0 != buffer_check_lba(ptr, ctx->lba+i, lba_size, true))
+    {
+      ioworker_scan_record(gctx, ctx->lba+i, 0, ptr, lba_size);
+    }
+  }
+}
+
+static void ioworker_one_cb(void* ctx_in, const struct spdk_nvme_cpl *cpl)
+{
+  uint32_t latency_us;
+  struct timeval now;
+  struct ioworker_io_ctx* ctx = (struct ioworker_io_ctx*)ctx_in;
+  struct ioworker_args* args = ctx->gctx->args;
+  struct ioworker_global_ctx* gctx = ctx->gctx;
+  struct ioworker_rets* rets = gctx->rets;
+
+  SPDK_DEBUGLOG(SPDK_LOG_NVME, "one io completed, ctx %p, io delay time: %ld\n",
+               ctx, gctx->io_delay_time.tv_usec);
+
+  gctx->io_count_cplt ++;
+  ctx->outstanding = false;
+
+  // update statistics in ret structure
+  gettimeofday(&now, NULL);
+  latency_us = ioworker_update_rets(ctx, rets, &now);
+  if (gctx->target_rets != NULL)
+  {
+    ioworker_update_rets(ctx, &gctx->target_rets[ctx->target], &now);
+  }
+
+  // update io count per latency
+  if (args->io_counter_per_latency != NULL)
+  {
+    args->io_counter_per_latency[MIN(US_PER_S-1, latency_us)] ++;
+  }
+
+  // moving average of latency to expect the next completion
+  gctx->latency_avg_us = (gctx->latency_avg_us*7 + latency_us)/8;
+
+  if (args->slo_latency_us != 0)
+  {
+    gctx->slo_hist[ioworker_slo_bucket(latency_us)] ++;
+    gctx->slo_hist_count ++;
+  }
+
+  if (gctx->stat != NULL)
+  {
+    driver_stat_complete(&gctx->stat->stat, ctx->is_read ? 2 : 1,
+                         ctx->data_buf_len, latency_us,
+                         nvme_cpl_is_error(cpl));
+  }
+  
+  // throttle IOPS by delay, adaptive polling sends paced IO in main loop
+  if (gctx->io_delay_time.tv_usec != 0 && args->poll_idle_us == 0)
+  {
+    ioworker_one_io_throttle(gctx, &now);
+  }
+
+  if (args->verify_scan)
+  {
+    // scanner records failed reads and continues
+    ioworker_scan_verify(gctx, ctx, cpl);
+  }
+  else if (true == nvme_cpl_is_error(cpl))
+  {
+    // terminate ioworker when any error happen
+    // only keep the first error code
+    uint16_t error = ((*(unsigned short*)(&cpl->status))>>1)&0x7ff;
+    SPDK_DEBUGLOG(SPDK_LOG_NVME, "ioworker error happen in cpl\n");
+    gctx->flag_finish = true;
+    if (rets->error == 0)
+    {
+      rets->error = error;
+    }
+    if (gctx->target_rets != NULL &&
+        gctx->target_rets[ctx->target].error == 0)
+    {
+      gctx->target_rets[ctx->target].error = error;
+    }
+  }
+
+  // update io counter per second when required
+  if (args->io_counter_per_second != NULL)
   {
-    // update host-side table for the trimed data
-    // other write-like operation updates crc32 table in driver wraper
-    if (opcode == 9)
+    if (true == timercmp(&now, &gctx->time_next_sec, >))
     {
-      nvme_deallocate_ranges(buf, cdw10+1);
+      ioworker_update_io_count_per_second(gctx, args, rets);
     }
-    
-    //send io cmd in qpair
-    return spdk_nvme_ctrlr_cmd_io_raw(ctrlr, qpair, &cmd, buf, len,
-                                      cmd_log_add_cpl_cb, log_entry);
   }
-  else
+
+  // check if all io are sent
+  if (gctx->flag_finish != true)
   {
-    //not qpair, admin cmd
-    return spdk_nvme_ctrlr_cmd_admin_raw(ctrlr, &cmd, buf, len,
-                                         cmd_log_add_cpl_cb, log_entry);
+    //update finish flag
+    gctx->flag_finish = ioworker_send_one_is_finish(args, gctx);
   }
-}
-
 
-void nvme_register_aer_cb(struct spdk_nvme_ctrlr* ctrlr,
-                          spdk_nvme_aer_cb aer_cb,
-                          void* aer_cb_arg)
-{
-  spdk_nvme_ctrlr_register_aer_callback(ctrlr, aer_cb, aer_cb_arg);
+  if (gctx->flag_finish != true)
+  {
+    if (args->slo_latency_us != 0 &&
+        gctx->io_count_sent-gctx->io_count_cplt >= gctx->slo_depth)
+    {
+      // queue depth is reduced, send it when the depth increases
+      gctx->slo_parked[gctx->slo_parked_count++] = ctx;
+    }
+    else if (gctx->io_delay_time.tv_usec != 0 && args->poll_idle_us != 0)
+    {
+      // send it when it is due
+      gctx->pending[gctx->pending_count++] = ctx;
+    }
+    else
+    {
+      // send more io
+      ioworker_send_one(ctx, gctx);
+    }
+  }
 }
 
-void nvme_register_timeout_cb(struct spdk_nvme_ctrlr* ctrlr,
-                              spdk_nvme_timeout_cb timeout_cb,
-                              unsigned int timeout)
+static inline bool ioworker_send_one_is_read(unsigned short read_percentage)
 {
-  spdk_nvme_ctrlr_register_timeout_callback(
-      ctrlr, (uint64_t)timeout*US_PER_S, timeout_cb, NULL);
+  return random()%100 < read_percentage;
 }
 
-int nvme_cpl_is_error(const struct spdk_nvme_cpl* cpl)
+static uint64_t ioworker_send_one_lba_sequential(struct ioworker_args* args,
+                                                 struct ioworker_global_ctx* gctx)
 {
-  return spdk_nvme_cpl_is_error(cpl);
-}
+  uint64_t ret;
 
+  SPDK_DEBUGLOG(SPDK_LOG_NVME, "gctx lba: %ld, align:%d\n", gctx->sequential_lba, args->lba_align);
+  ret = gctx->sequential_lba + args->lba_align;
+  if (ret > args->region_end)
+  {
+    ret = args->region_start;
+  }
 
-////module: qpair
-///////////////////////////////
+  return ret;
+}
 
-struct spdk_nvme_qpair *qpair_create(struct spdk_nvme_ctrlr* ctrlr,
-                                      int prio, int depth)
+static inline uint64_t ioworker_send_one_lba_random(struct ioworker_args* args)
 {
-  struct spdk_nvme_qpair* qpair;
-  struct spdk_nvme_io_qpair_opts opts;
+  return (random()%(args->region_end-args->region_start)) + args->region_start;
+}
 
-  //user options
-  opts.qprio = prio;
-  opts.io_queue_size = depth;
-  opts.io_queue_requests = depth*2;
+static uint64_t ioworker_send_one_lba(struct ioworker_args* args,
+                                      struct ioworker_global_ctx* gctx)
+{
+  uint64_t ret;
 
-  qpair = spdk_nvme_ctrlr_alloc_io_qpair(ctrlr, &opts, sizeof(opts));
-  if (qpair == NULL)
+  if (args->lba_random == 0)
   {
-    SPDK_ERRLOG("alloc io qpair fail\n");
-    return NULL;
+    ret = ioworker_send_one_lba_sequential(args, gctx);
+    gctx->sequential_lba = ret;
   }
-
-  // limited qpair count
-  if (qpair->id >= CMD_LOG_MAX_Q)
+  else
   {
-    SPDK_ERRLOG("not support so many queue pairs\n");
-    spdk_nvme_ctrlr_free_io_qpair(qpair);
-    return NULL;
+    ret = ioworker_send_one_lba_random(args);
   }
 
-  cmd_log_qpair_init(qpair->id);
-  return qpair;
-}
-
-int qpair_wait_completion(struct spdk_nvme_qpair *qpair, uint32_t max_completions)
-{
-  return spdk_nvme_qpair_process_completions(qpair, max_completions);
+  return ALIGN_DOWN(ret, args->lba_align);
 }
 
-int qpair_get_id(struct spdk_nvme_qpair* q)
+// map the lba of the logical space to the lba of the striped target,
+// chunks are distributed to targets in turn, as RAID-0
+static inline uint32_t ioworker_send_one_target(struct ioworker_args* args,
+                                                struct ioworker_global_ctx* gctx,
+                                                uint64_t* lba)
 {
-  // q NULL is admin queue
-  return q ? q->id : 0;
-}
+  uint64_t chunk;
+  uint32_t target;
 
-int qpair_free(struct spdk_nvme_qpair* q)
-{
-  if (q == NULL)
+  if (gctx->target_count == 1)
   {
     return 0;
   }
-  
-  SPDK_DEBUGLOG(SPDK_LOG_NVME, "free qpair: %d\n", q->id);
-  cmd_log_qpair_clear(q->id);
 
-  return spdk_nvme_ctrlr_free_io_qpair(q);
+  chunk = *lba / args->stripe_chunk;
+  target = chunk % gctx->target_count;
+  *lba = (chunk / gctx->target_count) * args->stripe_chunk +
+         (*lba % args->stripe_chunk);
+  return target;
 }
 
-
-////module: namespace
-///////////////////////////////
-
-struct spdk_nvme_ns* ns_init(struct spdk_nvme_ctrlr* ctrlr, uint32_t nsid)
+// io to the next sequential lba of the range: write known pattern, no
+// token and crc, or read to be verified in the scanner
+static int ioworker_send_one_range(struct ioworker_io_ctx* ctx,
+                                   struct ioworker_global_ctx* gctx)
 {
-  struct spdk_nvme_ns* ns = spdk_nvme_ctrlr_get_ns(ctrlr, nsid);
-  uint64_t nsze = spdk_nvme_ns_get_num_sectors(ns);
-
-  assert(ns != NULL);
-  if (0 != memzone_reserve_shared_memory(sizeof(uint32_t)*nsze))
+  struct spdk_nvme_ns* ns = gctx->ns[0];
+  bool is_read = gctx->args->verify_scan;
+
+  ctx->lba = gctx->sequential_lba;
+  ctx->lba_count = MIN(gctx->args->lba_size,
+                       gctx->range_end-gctx->sequential_lba);
+  gctx->sequential_lba += ctx->lba_count;
+  if (!is_read)
   {
-    return NULL;
+    enum cycles_stage stage = cycles_switch(CYCLES_FILL);
+    buffer_known_fill(ctx->data_buf, ctx->lba, ctx->lba_count,
+                      spdk_nvme_ns_get_sector_size(ns));
+    cycles_switch(stage);
   }
-
-  return ns;
+  return ns_cmd_read_write_raw(is_read, ns, gctx->qpair[0],
+                               ctx->data_buf, ctx->data_buf_len,
+                               ctx->lba, ctx->lba_count, 0, false, !is_read,
+                               ioworker_one_cb, ctx);
 }
 
-int ns_cmd_read_write(int is_read,
-                      struct spdk_nvme_ns* ns,
-                      struct spdk_nvme_qpair* qpair,
-                      void* buf,
-                      size_t len,
-                      uint64_t lba,
-                      uint16_t lba_count,
-                      uint32_t io_flags,
-                      spdk_nvme_cmd_cb cb_fn,
-                      void* cb_arg)
+static int ioworker_send_one(struct ioworker_io_ctx* ctx,
+                             struct ioworker_global_ctx* gctx)
 {
-  struct spdk_nvme_cmd cmd;
-  struct cmd_log_entry_t* log_entry;
-  uint32_t lba_size = spdk_nvme_ns_get_sector_size(ns);
-
-  assert(ns != NULL);
-  assert(qpair != NULL);
-
-  //only support 1 namespace now
-  assert(ns->id == 1);
-  
-  //validate data buffer
-  assert(buf != NULL);
-  assert(lba_size == 512);
-  assert(len >= lba_count*lba_size);
-  assert((io_flags&0xffff) == 0);
-  
-  //setup cmd structure
-  memset(&cmd, 0, sizeof(struct spdk_nvme_cmd));
-  cmd.opc = is_read ? 2 : 1;
-  cmd.nsid = ns->id;
-  cmd.cdw10 = lba;
-  cmd.cdw11 = lba>>32;
-  cmd.cdw12 = io_flags | (lba_count-1);
-  cmd.cdw13 = 0;
-  cmd.cdw14 = 0;
-  cmd.cdw15 = 0;
+  int ret;
+  struct ioworker_args* args = gctx->args;
+  enum cycles_stage stage = cycles_switch(CYCLES_SUBMIT);
+  bool is_read = ioworker_send_one_is_read(args->read_percentage);
+  uint32_t target = 0;
 
-  //fill write buffer with lba, token, and checksum
-  if (is_read != true)
+  assert(ctx->data_buf != NULL);
+  if (args->known_pattern || args->verify_scan)
   {
-    //for write buffer
-    buffer_fill_data(buf, lba, lba_count, lba_size);
+    ret = ioworker_send_one_range(ctx, gctx);
+  }
+  else
+  {
+    ctx->lba = ioworker_send_one_lba(args, gctx);
+    ctx->lba_count = args->lba_size;
+    target = ioworker_send_one_target(args, gctx, &ctx->lba);
+    ret = ns_cmd_read_write(is_read, gctx->ns[target], gctx->qpair[target],
+                            ctx->data_buf, ctx->data_buf_len,
+                            ctx->lba, ctx->lba_count,
+                            0,  //do not have more options in ioworkers
+                            ioworker_one_cb, ctx);
   }
 
-  //get entry in cmd log
-  log_entry = cmd_log_add_cmd(qpair->id, buf, lba, lba_count, lba_size,
-                              &cmd, cb_fn, cb_arg);
+  SPDK_DEBUGLOG(SPDK_LOG_NVME, "sending one io, ctx %p, lba %ld, target %d\n",
+                ctx, ctx->lba, target);
+  if (ret != 0)
+  {
+    SPDK_DEBUGLOG(SPDK_LOG_NVME, "ioworker error happen in cpl\n");
+    gctx->flag_finish = true;
+    cycles_switch(stage);
+    return ret;
+  }
 
-  //send io cmd in qpair
-  return spdk_nvme_ctrlr_cmd_io_raw(ns->ctrlr, qpair, &cmd, buf, len,
-                                    cmd_log_add_cpl_cb, log_entry);
+  //sent one io cmd successfully
+  gctx->io_count_sent ++;
+  if (gctx->stat != NULL)
+  {
+    driver_stat_submit(&gctx->stat->stat);
+  }
+  ctx->is_read = is_read;
+  ctx->outstanding = true;
+  ctx->target = target;
+  gettimeofday(&ctx->time_sent, NULL);
+  cycles_switch(stage);
+  return 0;
 }
 
-uint32_t ns_get_sector_size(struct spdk_nvme_ns* ns)
+// data buffers are in host memory, or in the CMB of the controller
+static void* ioworker_buffer_alloc(struct ioworker_global_ctx* gctx,
+                                   size_t len)
 {
-  return spdk_nvme_ns_get_sector_size(ns);
-}
+  void* buf;
 
-uint64_t ns_get_num_sectors(struct spdk_nvme_ns* ns)
-{
-  return spdk_nvme_ns_get_num_sectors(ns);
+  // ioworker fills or reads all data, no need to clear the buffer
+  if (gctx->args->cmb_data)
+  {
+    buf = buffer_cmb_alloc(gctx->ns[0]->ctrlr, len, false);
+  }
+  else
+  {
+    buf = buffer_pool_alloc(NULL, len, NULL, false);
+  }
+
+  // only lba is updated for each IO of known pattern
+  if (buf != NULL && gctx->args->known_pattern)
+  {
+    buffer_known_init(buf, len);
+  }
+  return buf;
 }
 
-int ns_fini(struct spdk_nvme_ns* ns)
+static void ioworker_buffer_free_all(struct ioworker_global_ctx* gctx,
+                                     struct ioworker_io_ctx* io_ctx,
+                                     unsigned int count)
 {
-  crc32_fini();
-  return 0;
+  for (unsigned int i=0; i<count; i++)
+  {
+    if (gctx->args->cmb_data)
+    {
+      buffer_cmb_free(gctx->ns[0]->ctrlr, io_ctx[i].data_buf, io_ctx[i].data_buf_len);
+    }
+    else
+    {
+      buffer_pool_free(NULL, io_ctx[i].data_buf, io_ctx[i].data_buf_len);
+    }
+  }
 }
 
+// send paced IOs which are due, and return the number of sent IOs
+static uint32_t ioworker_send_pending(struct ioworker_global_ctx* gctx,
+                                      struct timeval* now)
+{
+  uint32_t sent = 0;
 
-////module: ioworker
-///////////////////////////////
-
-// used for callback
-struct ioworker_io_ctx {
-  void* data_buf;
-  size_t data_buf_len;
-  bool is_read;
-  struct timeval time_sent;
-  struct ioworker_global_ctx* gctx;
-};
-
-struct ioworker_global_ctx {
-  struct ioworker_args* args;
-  struct ioworker_rets* rets;
-  struct spdk_nvme_ns* ns;
-  struct spdk_nvme_qpair *qpair;
-  struct timeval due_time;
-  struct timeval io_due_time;
-  struct timeval io_delay_time;
-  struct timeval time_next_sec;
-  uint64_t io_count_till_last_sec;
-  uint64_t sequential_lba;
-  uint64_t io_count_sent;
-  uint64_t io_count_cplt;
-  uint32_t last_sec;
-  bool flag_finish;
-};
-
-#define ALIGN_UP(n, a)    (((n)%(a))?((n)+(a)-((n)%(a))):((n)))
-#define ALIGN_DOWN(n, a)  ((n)-((n)%(a)))
+  if (gctx->pending_count == 0)
+  {
+    return 0;
+  }
 
-static int ioworker_send_one(struct spdk_nvme_ns* ns,
-                             struct spdk_nvme_qpair *qpair,
-                             struct ioworker_io_ctx* ctx,
-                             struct ioworker_global_ctx* gctx);
+  if (gctx->flag_finish != true)
+  {
+    gctx->flag_finish = ioworker_send_one_is_finish(gctx->args, gctx);
+  }
 
+  if (gctx->flag_finish == true)
+  {
+    // no more io to send
+    gctx->pending_count = 0;
+    return 0;
+  }
 
-static inline void timeradd_second(struct timeval* now,
-                                     unsigned int seconds,
-                                     struct timeval* due)
-{
-  struct timeval duration;
+  while (gctx->pending_count != 0 &&
+         false == timercmp(&gctx->io_due_time, now, >))
+  {
+    timeradd(&gctx->io_due_time, &gctx->io_delay_time, &gctx->io_due_time);
+    ioworker_send_one(gctx->pending[--gctx->pending_count], gctx);
+    sent ++;
+  }
 
-  duration.tv_sec = seconds;
-  duration.tv_usec = 0;
-  timeradd(now, &duration, due);
+  return sent;
 }
 
-static bool ioworker_send_one_is_finish(struct ioworker_args* args,
-                                        struct ioworker_global_ctx* c)
+// us to the next expected event: the due time of paced IO, or the
+// completion of outstanding IO by average latency. 0 if it is overdue.
+static uint32_t ioworker_poll_wait_us(struct ioworker_global_ctx* gctx,
+                                      struct timeval* now)
 {
-  struct timeval now;
+  bool found = false;
+  struct timeval next;
+  struct timeval diff;
+  struct timeval latency;
 
-  // limit by io count, and/or time, which happens first
-  if (c->io_count_sent == args->io_count)
+  latency.tv_sec = gctx->latency_avg_us / US_PER_S;
+  latency.tv_usec = gctx->latency_avg_us % US_PER_S;
+
+  if (gctx->pending_count != 0)
   {
-    SPDK_DEBUGLOG(SPDK_LOG_NVME, "ioworker finish, sent %ld io\n", c->io_count_sent);
-    return true;
+    next = gctx->io_due_time;
+    found = true;
   }
 
-  assert(c->io_count_sent < args->io_count);
-  gettimeofday(&now, NULL);
-  if (true == timercmp(&now, &c->due_time, >))
+  for (unsigned int i=0; i<gctx->args->qdepth; i++)
   {
-    SPDK_DEBUGLOG(SPDK_LOG_NVME, "ioworker finish, due time %ld us\n", c->due_time.tv_usec);
-    return true;
-  }
+    struct timeval expected;
+    struct ioworker_io_ctx* ctx = &gctx->io_ctx[i];
 
-  return false;
-}
+    if (ctx->outstanding == true)
+    {
+      timeradd(&ctx->time_sent, &latency, &expected);
+      if (found == false || true == timercmp(&expected, &next, <))
+      {
+        next = expected;
+        found = true;
+      }
+    }
+  }
 
-static void ioworker_one_io_throttle(struct ioworker_global_ctx* gctx,
-                                     struct timeval* now)
-{
-  SPDK_DEBUGLOG(SPDK_LOG_NVME, "this io due at %ld.%06ld\n",
-                gctx->io_due_time.tv_sec, gctx->io_due_time.tv_usec);
-  if (true == timercmp(&gctx->io_due_time, now, >))
+  if (found == false || false == timercmp(&next, now, >))
   {
-    //delay usec to meet the IOPS prequisit
-    struct timeval diff;
-    timersub(&gctx->io_due_time, now, &diff);
-    usleep(timeval_to_us(&diff));
+    return 0;
   }
 
-  timeradd(&gctx->io_due_time, &gctx->io_delay_time, &gctx->io_due_time);
+  timersub(&next, now, &diff);
+  return diff.tv_sec ? US_PER_S : timeval_to_us(&diff);
 }
 
-static uint32_t ioworker_get_duration(struct timeval* start,
-                                      struct ioworker_global_ctx* gctx)
+// sleep in the main loop when no io completes and no io is due
+static void ioworker_poll_adaptive(struct ioworker_global_ctx* gctx,
+                                   int32_t cplt)
 {
   struct timeval now;
+  struct timeval after;
   struct timeval diff;
-  uint32_t msec;
-  
-  gettimeofday(&now, NULL);
-  timersub(&now, start, &diff);
-  msec = diff.tv_sec * 1000UL;
-  return msec + (diff.tv_usec+500)/1000;
-}
+  uint32_t sleep_us;
+  struct ioworker_args* args = gctx->args;
+  struct ioworker_rets* rets = gctx->rets;
 
-static uint32_t ioworker_update_rets(struct ioworker_io_ctx* ctx,
-                                     struct ioworker_rets* ret,
-                                     struct timeval* now)
-{
-  struct timeval diff;
-  uint32_t latency;
+  if (cplt > 0)
+  {
+    // these IOs could complete at any time in the last sleep, count
+    // the whole sleep as the latency cost of adaptive polling
+    rets->poll_delay_us += (uint64_t)cplt * gctx->poll_slept_us;
+    gctx->poll_slept_us = 0;
+    gctx->poll_backoff_us = 0;
+  }
 
-  timersub(now, &ctx->time_sent, &diff);
-  latency = timeval_to_us(&diff);
-  if (latency > ret->latency_max_us)
+  gettimeofday(&now, NULL);
+  if (ioworker_send_pending(gctx, &now) != 0 || cplt > 0)
   {
-    ret->latency_max_us = latency;
+    // busy, keep polling
+    return;
   }
 
-  if (ctx->is_read == true)
+  if (gctx->io_count_sent == gctx->io_count_cplt && gctx->pending_count == 0)
   {
-    ret->io_count_read ++;
+    // nothing to wait
+    return;
   }
-  else
+
+  sleep_us = ioworker_poll_wait_us(gctx, &now);
+  if (sleep_us == 0)
   {
-    ret->io_count_write ++;
+    // the expected event is overdue, back off exponentially
+    gctx->poll_backoff_us = gctx->poll_backoff_us ?
+                            MIN(gctx->poll_backoff_us*2, args->poll_idle_us) : 1;
+    sleep_us = gctx->poll_backoff_us;
   }
+  sleep_us = MIN(sleep_us, args->poll_idle_us);
 
-  return latency;
+  if (sleep_us < IOWORKER_POLL_SLEEP_MIN_US)
+  {
+    return;
+  }
+
+  cycles_switch(CYCLES_IDLE);
+  usleep(sleep_us);
+  cycles_switch(CYCLES_OTHER);
+  gettimeofday(&after, NULL);
+  timersub(&after, &now, &diff);
+  gctx->poll_slept_us = timeval_to_us(&diff);
+  rets->poll_sleep_us += gctx->poll_slept_us;
 }
 
-static inline void ioworker_update_io_count_per_second(
-    struct ioworker_global_ctx* gctx, 
-    struct ioworker_args* args,
-    struct ioworker_rets* rets)
+
+// record the operating point of the last interval
+static void ioworker_slo_sample(struct ioworker_global_ctx* gctx,
+                                uint32_t latency_us,
+                                struct timeval* now)
 {
-  uint64_t current_io_count = rets->io_count_read + rets->io_count_write;
-  
-  // update to next second
-  timeradd_second(&gctx->time_next_sec, 1, &gctx->time_next_sec);
-  args->io_counter_per_second[gctx->last_sec ++] = current_io_count - gctx->io_count_till_last_sec;
-  gctx->io_count_till_last_sec = current_io_count;
+  struct timeval diff;
+  uint64_t elapsed_us;
+  struct ioworker_slo_sample* sample;
+
+  timersub(now, &gctx->slo_last_time, &diff);
+  elapsed_us = MAX(1, timeval_to_us(&diff));
+
+  sample = &gctx->slo_window[gctx->slo_window_index++ % IOWORKER_SLO_WINDOW];
+  sample->depth = gctx->slo_depth;
+  sample->latency_us = latency_us;
+  sample->iops = (gctx->io_count_cplt-gctx->slo_last_cplt)*US_PER_S/elapsed_us;
+
+  gctx->slo_last_time = *now;
+  gctx->slo_last_cplt = gctx->io_count_cplt;
 }
 
-static void ioworker_one_cb(void* ctx_in, const struct spdk_nvme_cpl *cpl)
+// AIMD on queue depth: slow start doubles the depth until the latency
+// target is reached, then add 1 when the latency is well under the
+// target, and cut a quarter when the target is missed
+static void ioworker_slo_update(struct ioworker_global_ctx* gctx)
 {
   uint32_t latency_us;
   struct timeval now;
-  struct ioworker_io_ctx* ctx = (struct ioworker_io_ctx*)ctx_in;
-  struct ioworker_args* args = ctx->gctx->args;
-  struct ioworker_global_ctx* gctx = ctx->gctx;
-  struct ioworker_rets* rets = gctx->rets;
-
-  SPDK_DEBUGLOG(SPDK_LOG_NVME, "one io completed, ctx %p, io delay time: %ld\n",
-               ctx, gctx->io_delay_time.tv_usec);
-
-  gctx->io_count_cplt ++;
+  struct ioworker_args* args = gctx->args;
 
-  // update statistics in ret structure
   gettimeofday(&now, NULL);
-  latency_us = ioworker_update_rets(ctx, rets, &now);
-
-  // update io count per latency
-  if (args->io_counter_per_latency != NULL)
-  {
-    args->io_counter_per_latency[MIN(US_PER_S-1, latency_us)] ++;
-  }
-  
-  // throttle IOPS by delay
-  if (gctx->io_delay_time.tv_usec != 0)
+  if (true == timercmp(&now, &gctx->slo_next_time, >) &&
+      gctx->slo_hist_count >= IOWORKER_SLO_MIN_IOS)
   {
-    ioworker_one_io_throttle(gctx, &now);
-  }
+    latency_us = ioworker_slo_percentile_us(gctx);
+    ioworker_slo_sample(gctx, latency_us, &now);
 
-  if (true == nvme_cpl_is_error(cpl))
-  {
-    // terminate ioworker when any error happen
-    // only keep the first error code
-    uint16_t error = ((*(unsigned short*)(&cpl->status))>>1)&0x7ff;
-    SPDK_DEBUGLOG(SPDK_LOG_NVME, "ioworker error happen in cpl\n");
-    gctx->flag_finish = true;
-    if (rets->error == 0)
+    if (latency_us > args->slo_latency_us)
     {
-      rets->error = error;
+      gctx->slo_slow_start = false;
+      gctx->slo_depth -= MIN(gctx->slo_depth-1, MAX(1, gctx->slo_depth/4));
+    }
+    else if (latency_us < args->slo_latency_us*9/10)
+    {
+      gctx->slo_depth = gctx->slo_slow_start ? gctx->slo_depth*2 : gctx->slo_depth+1;
+      gctx->slo_depth = MIN(gctx->slo_depth, args->qdepth);
     }
+
+    SPDK_DEBUGLOG(SPDK_LOG_NVME, "slo latency %d us, depth %d\n",
+                  latency_us, gctx->slo_depth);
+    memset(gctx->slo_hist, 0, sizeof(gctx->slo_hist));
+    gctx->slo_hist_count = 0;
+    gctx->slo_next_time.tv_sec = 0;
+    gctx->slo_next_time.tv_usec = IOWORKER_SLO_INTERVAL_US;
+    timeradd(&now, &gctx->slo_next_time, &gctx->slo_next_time);
   }
 
-  // update io counter per second when required
-  if (args->io_counter_per_second != NULL)
+  if (gctx->slo_parked_count == 0)
   {
-    if (true == timercmp(&now, &gctx->time_next_sec, >))
-    {
-      ioworker_update_io_count_per_second(gctx, args, rets);
-    }
+    return;
   }
 
-  // check if all io are sent
   if (gctx->flag_finish != true)
   {
-    //update finish flag
     gctx->flag_finish = ioworker_send_one_is_finish(args, gctx);
   }
 
-  if (gctx->flag_finish != true)
+  if (gctx->flag_finish == true)
   {
-    // send more io
-    ioworker_send_one(gctx->ns, gctx->qpair, ctx, gctx);
+    // no more io to send
+    gctx->slo_parked_count = 0;
+    return;
   }
-}
 
-static inline bool ioworker_send_one_is_read(unsigned short read_percentage)
-{
-  return random()%100 < read_percentage;
+  while (gctx->slo_parked_count != 0 &&
+         gctx->io_count_sent-gctx->io_count_cplt < gctx->slo_depth)
+  {
+    ioworker_send_one(gctx->slo_parked[--gctx->slo_parked_count], gctx);
+  }
 }
 
-static uint64_t ioworker_send_one_lba_sequential(struct ioworker_args* args,
-                                                 struct ioworker_global_ctx* gctx)
+// report the operating point averaged over the last window
+static void ioworker_slo_rets(struct ioworker_global_ctx* gctx)
 {
-  uint64_t ret;
+  uint32_t count = MIN(gctx->slo_window_index, IOWORKER_SLO_WINDOW);
+  uint64_t depth_sum = 0;
+  uint64_t latency_sum = 0;
+  uint64_t iops_sum = 0;
+  struct ioworker_rets* rets = gctx->rets;
 
-  SPDK_DEBUGLOG(SPDK_LOG_NVME, "gctx lba: %ld, align:%d\n", gctx->sequential_lba, args->lba_align);
-  ret = gctx->sequential_lba + args->lba_align;
-  if (ret > args->region_end)
+  if (count == 0)
   {
-    ret = args->region_start;
+    return;
   }
 
-  return ret;
-}
+  rets->slo_qdepth_min = (uint32_t)-1;
+  rets->slo_iops_min = (uint64_t)-1;
+  for (uint32_t i=0; i<count; i++)
+  {
+    struct ioworker_slo_sample* sample = &gctx->slo_window[i];
+
+    depth_sum += sample->depth;
+    latency_sum += sample->latency_us;
+    iops_sum += sample->iops;
+    rets->slo_qdepth_min = MIN(rets->slo_qdepth_min, sample->depth);
+    rets->slo_qdepth_max = MAX(rets->slo_qdepth_max, sample->depth);
+    rets->slo_iops_min = MIN(rets->slo_iops_min, sample->iops);
+    rets->slo_iops_max = MAX(rets->slo_iops_max, sample->iops);
+  }
 
-static inline uint64_t ioworker_send_one_lba_random(struct ioworker_args* args)
-{
-  return (random()%(args->region_end-args->region_start)) + args->region_start;
+  rets->slo_qdepth = (depth_sum+count/2)/count;
+  rets->slo_latency_us = latency_sum/count;
+  rets->slo_iops = iops_sum/count;
 }
 
-static uint64_t ioworker_send_one_lba(struct ioworker_args* args,
-                                      struct ioworker_global_ctx* gctx)
+// cycles of polling are the cost of completion if any io is reaped, or
+// the time waiting for the device
+static void ioworker_cycles_poll(struct ioworker_global_ctx* gctx,
+                                 int32_t cplt)
 {
-  uint64_t ret;
-
-  if (args->lba_random == 0)
+  cycles_switch(CYCLES_OTHER);
+  gctx->cycles[cplt > 0 ? CYCLES_COMPLETION : CYCLES_POLL_EMPTY] += gctx->cycles[CYCLES_POLL];
+  gctx->cycles[CYCLES_POLL] = 0;
+  gctx->poll_count ++;
+  if (cplt <= 0)
   {
-    ret = ioworker_send_one_lba_sequential(args, gctx);
-    gctx->sequential_lba = ret;
-  }
-  else
-  {
-    ret = ioworker_send_one_lba_random(args);
+    gctx->poll_empty_count ++;
   }
-
-  return ALIGN_DOWN(ret, args->lba_align);
 }
 
-static int ioworker_send_one(struct spdk_nvme_ns* ns,
-                             struct spdk_nvme_qpair *qpair,
-                             struct ioworker_io_ctx* ctx,
-                             struct ioworker_global_ctx* gctx)
+static void ioworker_cycles_rets(struct ioworker_global_ctx* gctx)
 {
-  int ret;
-  struct ioworker_args* args = gctx->args;
-  bool is_read = ioworker_send_one_is_read(args->read_percentage);
-  uint64_t lba_starting = ioworker_send_one_lba(args, gctx);
-  uint16_t lba_count = args->lba_size;
-
-  SPDK_DEBUGLOG(SPDK_LOG_NVME, "sending one io, ctx %p, lba %ld\n", ctx, lba_starting);
-  assert(ctx->data_buf != NULL);
+  struct ioworker_rets* rets = gctx->rets;
 
-  ret = ns_cmd_read_write(is_read, ns, qpair,
-                          ctx->data_buf, ctx->data_buf_len,
-                          lba_starting, lba_count,
-                          0,  //do not have more options in ioworkers
-                          ioworker_one_cb, ctx);
-  if (ret != 0)
+  rets->cycles_total = 0;
+  for (int i=0; i<CYCLES_NUM; i++)
   {
-    SPDK_DEBUGLOG(SPDK_LOG_NVME, "ioworker error happen in cpl\n");
-    gctx->flag_finish = true;
-    return ret;
+    rets->cycles_total += gctx->cycles[i];
   }
-
-  //sent one io cmd successfully
-  gctx->io_count_sent ++;
-  ctx->is_read = is_read;
-  gettimeofday(&ctx->time_sent, NULL);
-  return 0;
+  rets->cycles_submit = gctx->cycles[CYCLES_SUBMIT];
+  rets->cycles_fill = gctx->cycles[CYCLES_FILL];
+  rets->cycles_cmdlog = gctx->cycles[CYCLES_CMDLOG];
+  rets->cycles_completion = gctx->cycles[CYCLES_COMPLETION];
+  rets->cycles_verify = gctx->cycles[CYCLES_VERIFY];
+  rets->cycles_poll_empty = gctx->cycles[CYCLES_POLL_EMPTY];
+  rets->cycles_idle = gctx->cycles[CYCLES_IDLE];
+  rets->cycles_other = gctx->cycles[CYCLES_OTHER];
+  rets->poll_count = gctx->poll_count;
+  rets->poll_empty_count = gctx->poll_empty_count;
 }
 
 
@@ -1295,19 +4606,64 @@ int ioworker_entry(struct spdk_nvme_ns* ns,
                    struct ioworker_args* args,
                    struct ioworker_rets* rets)
 {
-  int ret = 0;
-  uint64_t nsze = spdk_nvme_ns_get_num_sectors(ns);
-  uint32_t sector_size = spdk_nvme_ns_get_sector_size(ns);
-  struct timeval test_start;
-  struct ioworker_global_ctx gctx;
-  struct ioworker_io_ctx* io_ctx = malloc(sizeof(struct ioworker_io_ctx)*args->qdepth);
+  args->stripe_chunk = 0;
+  return ioworker_entry_striped(&ns, &qpair, 1, args, rets, NULL);
+}
 
-  //init rets
+static void ioworker_init_rets(struct ioworker_rets* rets)
+{
   rets->io_count_read = 0;
   rets->io_count_write = 0;
   rets->latency_max_us = 0;
   rets->mseconds = 0;
   rets->error = 0;
+  rets->cpu_core = driver_core_get();
+  rets->poll_sleep_us = 0;
+  rets->poll_delay_us = 0;
+  rets->slo_qdepth = 0;
+  rets->slo_qdepth_min = 0;
+  rets->slo_qdepth_max = 0;
+  rets->slo_latency_us = 0;
+  rets->slo_iops = 0;
+  rets->slo_iops_min = 0;
+  rets->slo_iops_max = 0;
+  rets->ss_seconds = 0;
+  rets->mismatch_lba_count = 0;
+  rets->mismatch_count = 0;
+  rets->cycles_total = 0;
+  rets->cycles_submit = 0;
+  rets->cycles_fill = 0;
+  rets->cycles_cmdlog = 0;
+  rets->cycles_completion = 0;
+  rets->cycles_verify = 0;
+  rets->cycles_poll_empty = 0;
+  rets->cycles_idle = 0;
+  rets->cycles_other = 0;
+  rets->poll_count = 0;
+  rets->poll_empty_count = 0;
+}
+
+int ioworker_entry_striped(struct spdk_nvme_ns** ns,
+                           struct spdk_nvme_qpair** qpair,
+                           unsigned int count,
+                           struct ioworker_args* args,
+                           struct ioworker_rets* rets,
+                           struct ioworker_rets* target_rets)
+{
+  int ret = 0;
+  uint64_t nsze = (uint64_t)-1;
+  uint32_t sector_size;
+  uint64_t range_end;
+  struct timeval test_start;
+  struct ioworker_global_ctx gctx;
+  struct ioworker_io_ctx* io_ctx;
+
+  //init rets
+  ioworker_init_rets(rets);
+  for (unsigned int i=0; target_rets && i<count; i++)
+  {
+    ioworker_init_rets(&target_rets[i]);
+  }
 
   SPDK_DEBUGLOG(SPDK_LOG_NVME, "args.lba_start = %ld\n", args->lba_start);
   SPDK_DEBUGLOG(SPDK_LOG_NVME, "args.lba_size = %d\n", args->lba_size);
@@ -1320,9 +4676,26 @@ int ioworker_entry(struct spdk_nvme_ns* ns,
   SPDK_DEBUGLOG(SPDK_LOG_NVME, "args.io_count = %ld\n", args->io_count);
   SPDK_DEBUGLOG(SPDK_LOG_NVME, "args.seconds = %d\n", args->seconds);
   SPDK_DEBUGLOG(SPDK_LOG_NVME, "args.qdepth = %d\n", args->qdepth);
+  SPDK_DEBUGLOG(SPDK_LOG_NVME, "args.stripe_chunk = %d\n", args->stripe_chunk);
+  SPDK_DEBUGLOG(SPDK_LOG_NVME, "args.poll_idle_us = %d\n", args->poll_idle_us);
+  SPDK_DEBUGLOG(SPDK_LOG_NVME, "args.cmb_data = %d\n", args->cmb_data);
+  SPDK_DEBUGLOG(SPDK_LOG_NVME, "args.slo_latency_us = %d\n", args->slo_latency_us);
+  SPDK_DEBUGLOG(SPDK_LOG_NVME, "args.slo_percentile = %d\n", args->slo_percentile);
+  SPDK_DEBUGLOG(SPDK_LOG_NVME, "args.ss_round_seconds = %d\n", args->ss_round_seconds);
+  SPDK_DEBUGLOG(SPDK_LOG_NVME, "args.ss_window = %d\n", args->ss_window);
+  SPDK_DEBUGLOG(SPDK_LOG_NVME, "args.known_pattern = %d\n", args->known_pattern);
+  SPDK_DEBUGLOG(SPDK_LOG_NVME, "args.verify_scan = %d\n", args->verify_scan);
 
   //check args
-  assert(ns != NULL);
+  assert(ns != NULL && qpair != NULL);
+  assert(count != 0);
+  assert(count == 1 || args->stripe_chunk != 0);
+  assert(count == 1 || args->stripe_chunk%args->lba_align == 0);
+  assert(count == 1 || args->lba_size <= args->lba_align);
+  assert(count == 1 || args->cmb_data == 0);
+  // crc table is indexed by lba only, not shared by multiple namespaces
+  assert(count == 1 ||
+         (*g_driver_global_config_ptr & DCFG_VERIFY_READ) == 0);
   assert(args->read_percentage <= 100);
   assert(args->io_count != 0 || args->seconds != 0);
   assert(args->seconds < 24*3600ULL);
@@ -1331,14 +4704,49 @@ int ioworker_entry(struct spdk_nvme_ns* ns,
   assert(args->read_percentage >= 0);
   assert(args->read_percentage <= 100);
   assert(args->qdepth <= CMD_LOG_DEPTH/2);
+  assert(args->slo_latency_us == 0 ||
+         (args->slo_percentile != 0 && args->slo_percentile < 10000 &&
+          args->poll_idle_us == 0));
+  assert(args->ss_round_seconds == 0 ||
+         (args->io_counter_per_second != NULL && args->ss_window >= 2 &&
+          args->ss_window <= IOWORKER_SS_WINDOW_MAX));
+  assert(args->known_pattern == 0 ||
+         (count == 1 && args->read_percentage == 0 && args->lba_random == 0));
+  assert(args->verify_scan == 0 ||
+         (count == 1 && args->read_percentage == 100 && args->lba_random == 0 &&
+          args->mismatch != NULL && args->mismatch_max != 0));
+
+  // check io size and format of all targets
+  sector_size = spdk_nvme_ns_get_sector_size(ns[0]);
+  for (unsigned int i=0; i<count; i++)
+  {
+    uint64_t target_nsze = spdk_nvme_ns_get_num_sectors(ns[i]);
+
+    assert(ns[i] != NULL && qpair[i] != NULL);
+    if (spdk_nvme_ns_get_sector_size(ns[i]) != sector_size)
+    {
+      SPDK_ERRLOG("striped namespaces have different sector size\n");
+      rets->error = 0x0002;  // Invalid Field in Command
+      return -2;
+    }
+
+    if (args->lba_size*sector_size > ns[i]->ctrlr->max_xfer_size)
+    {
+      SPDK_ERRLOG("IO size is larger than max xfer size, %d\n", ns[i]->ctrlr->max_xfer_size);
+      rets->error = 0x0002;  // Invalid Field in Command
+      return -2;
+    }
+
+    if (target_nsze < nsze)
+    {
+      nsze = target_nsze;
+    }
+  }
 
-  // check io size
-  if (args->lba_size*sector_size > ns->ctrlr->max_xfer_size)
+  // the striped space is made of whole chunks of the smallest target
+  if (count > 1)
   {
-    SPDK_ERRLOG("IO size is larger than max xfer size, %d\n", ns->ctrlr->max_xfer_size);
-    rets->error = 0x0002;  // Invalid Field in Command
-    free(io_ctx);
-    return -2;
+    nsze = ALIGN_DOWN(nsze, args->stripe_chunk) * count;
   }
 
   //revise args
@@ -1355,6 +4763,7 @@ int ioworker_entry(struct spdk_nvme_ns* ns,
   {
     args->region_end = nsze;
   }
+  range_end = args->region_end;
   
   //adjust region to start_lba's region
   args->region_start = ALIGN_UP(args->region_start, args->lba_align);
@@ -1370,9 +4779,15 @@ int ioworker_entry(struct spdk_nvme_ns* ns,
   }
 
   //init global ctx
+  io_ctx = calloc(args->qdepth, sizeof(struct ioworker_io_ctx));
   memset(&gctx, 0, sizeof(gctx));
+  gctx.io_ctx = io_ctx;
+  gctx.pending = malloc(sizeof(struct ioworker_io_ctx*)*args->qdepth);
+  gctx.pending_count = 0;
   gctx.ns = ns;
   gctx.qpair = qpair;
+  gctx.target_rets = target_rets;
+  gctx.target_count = count;
   gctx.sequential_lba = args->lba_start;
   gctx.io_count_sent = 0;
   gctx.io_count_cplt = 0;
@@ -1387,15 +4802,58 @@ int ioworker_entry(struct spdk_nvme_ns* ns,
   timeradd_second(&test_start, 1, &gctx.time_next_sec);
   gctx.io_count_till_last_sec = 0;
   gctx.last_sec = 0;
+  gctx.stat = ioworker_stat_claim(args->qdepth);
+  gctx.range_end = range_end;
+  gctx.slo_parked = malloc(sizeof(struct ioworker_io_ctx*)*args->qdepth);
+  gctx.slo_depth = args->slo_latency_us ? 1 : args->qdepth;
+  gctx.slo_slow_start = true;
+  gctx.slo_last_time = test_start;
+  gctx.slo_next_time.tv_sec = 0;
+  gctx.slo_next_time.tv_usec = IOWORKER_SLO_INTERVAL_US;
+  timeradd(&test_start, &gctx.slo_next_time, &gctx.slo_next_time);
+  if (io_ctx == NULL || gctx.pending == NULL || gctx.slo_parked == NULL)
+  {
+    SPDK_ERRLOG("fail to allocate ioworker contexts\n");
+    rets->error = 0x0006;  // Internal Error
+    ioworker_stat_release(gctx.stat);
+    free(gctx.slo_parked);
+    free(gctx.pending);
+    free(io_ctx);
+    return -2;
+  }
 
-  // sending the first batch of IOs, all remaining IOs are sending
-  // in callbacks till end
+  // allocate data buffers of all IOs
   for (unsigned int i=0; i<args->qdepth; i++)
   {
     io_ctx[i].data_buf_len = args->lba_size * sector_size;
-    io_ctx[i].data_buf = buffer_init(io_ctx[i].data_buf_len, NULL);
+    io_ctx[i].data_buf = ioworker_buffer_alloc(&gctx, io_ctx[i].data_buf_len);
     io_ctx[i].gctx = &gctx;
-    ioworker_send_one(ns, qpair, &io_ctx[i], &gctx);
+    if (io_ctx[i].data_buf == NULL)
+    {
+      SPDK_ERRLOG("fail to allocate ioworker buffers\n");
+      rets->error = 0x0006;  // Internal Error
+      ioworker_buffer_free_all(&gctx, io_ctx, i);
+      ioworker_stat_release(gctx.stat);
+      free(gctx.slo_parked);
+      free(gctx.pending);
+      free(io_ctx);
+      return -2;
+    }
+  }
+
+  // sending the first batch of IOs, all remaining IOs are sending
+  // in callbacks till end. Latency SLO starts from depth 1.
+  cycles_start(gctx.cycles);
+  for (unsigned int i=0; i<args->qdepth; i++)
+  {
+    if (i < gctx.slo_depth)
+    {
+      ioworker_send_one(&io_ctx[i], &gctx);
+    }
+    else
+    {
+      gctx.slo_parked[gctx.slo_parked_count++] = &io_ctx[i];
+    }
   }
 
   // callbacks check the end condition and mark the flag. Check the
@@ -1414,18 +4872,41 @@ int ioworker_entry(struct spdk_nvme_ns* ns,
     }
 
     // collect completions
-    spdk_nvme_qpair_process_completions(qpair, 0);
+    int32_t cplt = 0;
+    cycles_switch(CYCLES_POLL);
+    for (unsigned int i=0; i<count; i++)
+    {
+      cplt += qpair_process_completions(qpair[i], 0);
+    }
+    ioworker_cycles_poll(&gctx, cplt);
+
+    if (args->slo_latency_us != 0)
+    {
+      ioworker_slo_update(&gctx);
+    }
+
+    if (args->poll_idle_us != 0)
+    {
+      ioworker_poll_adaptive(&gctx, cplt);
+    }
   }
 
   // final duration
   rets->mseconds = ioworker_get_duration(&test_start, &gctx);
-
-  //release io ctx
-  for (unsigned int i=0; i<args->qdepth; i++)
+  for (unsigned int i=0; target_rets && i<count; i++)
   {
-    buffer_fini(io_ctx[i].data_buf);
+    target_rets[i].mseconds = rets->mseconds;
   }
 
+  cycles_stop();
+  ioworker_slo_rets(&gctx);
+  ioworker_cycles_rets(&gctx);
+
+  //release io ctx
+  ioworker_stat_release(gctx.stat);
+  ioworker_buffer_free_all(&gctx, io_ctx, args->qdepth);
+  free(gctx.slo_parked);
+  free(gctx.pending);
   free(io_ctx);
   return ret;
 }
@@ -1439,6 +4920,40 @@ void log_buf_dump(const char* header, const void* buf, size_t len)
   spdk_log_dump(stderr, header, buf, len);
 }
 
+int log_slow_io_trace(uint32_t threshold_us, uint32_t max)
+{
+  free(g_slow_io_records);
+  g_slow_io_records = NULL;
+  g_slow_io_threshold_us = 0;
+  g_slow_io_count = 0;
+  g_slow_io_max = 0;
+  g_slow_io_dropped = 0;
+
+  if (threshold_us == 0 || max == 0)
+  {
+    return 0;
+  }
+
+  g_slow_io_records = malloc(sizeof(struct slow_io_record)*max);
+  if (g_slow_io_records == NULL)
+  {
+    SPDK_ERRLOG("cannot allocate %d slow io records\n", max);
+    return -1;
+  }
+
+  g_slow_io_max = max;
+  g_slow_io_threshold_us = threshold_us;
+  SPDK_DEBUGLOG(SPDK_LOG_NVME, "trace io slower than %dus\n", threshold_us);
+  return 0;
+}
+
+struct slow_io_record* log_slow_io_get(uint32_t* count, uint64_t* dropped)
+{
+  *count = g_slow_io_count;
+  *dropped = g_slow_io_dropped;
+  return g_slow_io_records;
+}
+
 void log_cmd_dump(struct spdk_nvme_qpair* qpair, size_t count)
 {
   int dump_count = count;
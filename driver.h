@@ -39,6 +39,22 @@ typedef struct spdk_pci_device pcie;
 typedef struct spdk_nvme_cpl cpl;
 
 
+typedef struct ioworker_mismatch
+{
+  unsigned long lba;
+  unsigned int lba_count;
+  // nvme status of the read, 0 for data mismatch
+  unsigned short status;
+  unsigned short rsvd;
+  // of the first lba in the range
+  unsigned int expected_crc;
+  unsigned int actual_crc;
+  unsigned long actual_lba;
+  unsigned long actual_token;
+} ioworker_mismatch;
+
+#define IOWORKER_SS_WINDOW_MAX  (64)  // rounds in the steady state window
+
 typedef struct ioworker_args
 {
   unsigned long lba_start;
@@ -52,6 +68,22 @@ typedef struct ioworker_args
   unsigned long io_count;
   unsigned int seconds;
   unsigned int qdepth;
+  unsigned int stripe_chunk;
+  unsigned int poll_idle_us;
+  int cmb_data;
+  // latency SLO: percentile in 0.01%, e.g. 9900 for p99
+  unsigned int slo_latency_us;
+  unsigned int slo_percentile;
+  // steady state: stop when IOPS of rounds in the window is stable
+  unsigned int ss_round_seconds;
+  unsigned int ss_window;
+  // sequential write of known pattern from region_start to region_end
+  int known_pattern;
+  // sequential read from region_start to region_end, and record every
+  // mismatch in the buffer, instead of stopping at the first one
+  int verify_scan;
+  unsigned int mismatch_max;
+  struct ioworker_mismatch* mismatch;
   unsigned int* io_counter_per_second;
   unsigned int* io_counter_per_latency;
 } ioworker_args;
@@ -63,13 +95,51 @@ typedef struct ioworker_rets
   unsigned int mseconds;
   unsigned int latency_max_us;  
   unsigned short error;
+  int cpu_core;
+  unsigned long poll_sleep_us;
+  unsigned long poll_delay_us;
+  // converged operating point of latency SLO in the last second
+  unsigned int slo_qdepth;
+  unsigned int slo_qdepth_min;
+  unsigned int slo_qdepth_max;
+  unsigned int slo_latency_us;
+  unsigned long slo_iops;
+  unsigned long slo_iops_min;
+  unsigned long slo_iops_max;
+  // seconds to reach steady state, 0 if not reached
+  unsigned int ss_seconds;
+  // lba failed in verify scan, and the ranges recorded in the buffer
+  unsigned long mismatch_lba_count;
+  unsigned int mismatch_count;
+  // host cycles in each stage of io, exclusive of each other
+  unsigned long cycles_total;
+  unsigned long cycles_submit;
+  unsigned long cycles_fill;
+  unsigned long cycles_cmdlog;
+  unsigned long cycles_completion;
+  unsigned long cycles_verify;
+  unsigned long cycles_poll_empty;
+  unsigned long cycles_idle;
+  unsigned long cycles_other;
+  unsigned long poll_count;
+  unsigned long poll_empty_count;
 } ioworker_rets;
   
 extern int driver_init(void);
 extern int driver_fini(void);
 extern void driver_config(uint64_t cfg_word);
+extern uint64_t driver_config_read(void);
+extern int driver_numa_socket_get(void);
+extern void driver_numa_socket_set(int socket_id);
+extern int driver_core_get(void);
+extern int driver_core_free(void);
+extern uint64_t driver_get_ticks(void);
+extern uint64_t driver_get_ticks_hz(void);
+extern size_t driver_metrics(char* buf, size_t size);
+extern uint64_t driver_ioworker_bytes(int pid);
 
 extern pcie* pcie_init(struct spdk_nvme_ctrlr* ctrlr);
+extern int pcie_get_numa_node(pcie* pci);
 extern int pcie_cfg_read8(struct spdk_pci_device* pci,
                           unsigned char* value,
                           unsigned int offset);
@@ -77,9 +147,52 @@ extern int pcie_cfg_write8(struct spdk_pci_device* pci,
                            unsigned char value,
                            unsigned int offset);
 
-extern ctrlr* nvme_init(char * traddr);
-extern ctrlr* nvme_probe(char * traddr);
+typedef struct ctrlr_options
+{
+  int use_cmb_sqs;
+  // transport id and connection options of NVMe over TCP
+  char trsvcid[33];
+  char subnqn[224];
+  int header_digest;
+  int data_digest;
+  // 0 for the default value
+  unsigned int num_io_queues;
+  unsigned int io_queue_size;
+} ctrlr_options;
+
+extern ctrlr* nvme_init(char * traddr, const ctrlr_options* options);
+extern ctrlr* nvme_probe(char * traddr, const ctrlr_options* options);
+extern int nvme_probe_multi(char** traddrs,
+                            unsigned int count,
+                            const ctrlr_options* options,
+                            ctrlr** ctrlrs,
+                            uint64_t* attach_us,
+                            int* errors);
 extern int nvme_fini(struct spdk_nvme_ctrlr* c);
+extern uint64_t nvme_admin_change_count(void);
+
+typedef struct nvme_reset_stat
+{
+  uint64_t reset_us;     // reset till the controller and its qpairs are ready
+  uint64_t first_io_us;  // reset till the first IO completes, 0 if not yet
+} nvme_reset_stat;
+
+extern int nvme_reset(struct spdk_nvme_ctrlr* c);
+extern nvme_reset_stat* nvme_get_reset_stat(void);
+
+// TSC of register transitions in recovery, 0 if not happen
+typedef struct nvme_recovery_ticks
+{
+  uint64_t start;
+  uint64_t cc_en_clear;
+  uint64_t csts_rdy_clear;
+  uint64_t cc_en_set;
+  uint64_t csts_rdy_set;
+  uint64_t shst_complete;
+} nvme_recovery_ticks;
+
+extern int nvme_recovery_monitor_start(struct spdk_nvme_ctrlr* c);
+extern nvme_recovery_ticks* nvme_recovery_monitor_stop(void);
 extern int nvme_set_reg32(struct spdk_nvme_ctrlr* ctrlr,
                           unsigned int offset,
                           unsigned int value);
@@ -123,11 +236,77 @@ extern void nvme_register_timeout_cb(struct spdk_nvme_ctrlr* ctrlr,
 
 extern void* buffer_init(size_t bytes, uint64_t *phys_addr);
 extern void buffer_fini(void* buf);
+extern void buffer_fill_pattern(void* buf,
+                                size_t len,
+                                const void* pattern,
+                                size_t pattern_len);
+extern int64_t buffer_mismatch(const void* buf1, const void* buf2, size_t len);
+extern uint32_t buffer_crc32c(const void* buf, size_t len);
+
+#define BUFFER_POOL_MIN_SHIFT   (12)  // 4KB
+#define BUFFER_POOL_MAX_SHIFT   (21)  // 2MB
+#define BUFFER_POOL_CLASS_NUM   (BUFFER_POOL_MAX_SHIFT-BUFFER_POOL_MIN_SHIFT+1)
+
+typedef struct buffer_pool
+{
+  struct buffer_pool_node* free_list[BUFFER_POOL_CLASS_NUM];
+  uint64_t max_cached_bytes;
+  uint64_t cached_bytes;
+  uint64_t count_alloc;
+  uint64_t count_reuse;
+  int socket_id;
+} buffer_pool;
+
+extern buffer_pool* buffer_pool_create(uint64_t max_cached_bytes, int socket_id);
+extern void* buffer_pool_alloc(buffer_pool* pool,
+                               size_t bytes,
+                               uint64_t* phys_addr,
+                               int zero);
+extern void buffer_pool_free(buffer_pool* pool, void* buf, size_t bytes);
+extern void buffer_pool_clear(buffer_pool* pool);
+extern void buffer_pool_destroy(buffer_pool* pool);
+extern void* buffer_cmb_alloc(struct spdk_nvme_ctrlr* ctrlr, size_t bytes, int zero);
+extern void buffer_cmb_free(struct spdk_nvme_ctrlr* ctrlr, void* buf, size_t bytes);
+
+// completions reaped in one batch, handled by cython layer together
+typedef struct cpl_batch_entry
+{
+  void* cb_arg;
+  uint32_t cdw0;
+  uint32_t latency_us;
+  uint16_t cid;
+  uint16_t status;
+} cpl_batch_entry;
+
+typedef struct cpl_batch
+{
+  uint32_t count;
+  uint32_t max;
+  // only completions of this callback are batched, others are called back
+  cmd_cb_func cb_fn;
+  // requests completed in this batch, batched or called back
+  uint32_t completed;
+  cpl_batch_entry* entries;
+} cpl_batch;
+
+#define DOORBELL_BATCH_HIST_NUM (12)  // log2 buckets of cmds per doorbell: 1, 2-3, ..., 2048+
+
+typedef struct qpair_doorbell_stat
+{
+  uint64_t batch_hist[DOORBELL_BATCH_HIST_NUM];
+  uint64_t rings;
+  uint64_t cmds;
+} qpair_doorbell_stat;
 
 extern qpair* qpair_create(struct spdk_nvme_ctrlr *c,
-                           int prio, int depth);
+                           int prio, int depth,
+                           bool delay_doorbell,
+                           int cmb_sq);
 extern int qpair_wait_completion(struct spdk_nvme_qpair *q, uint32_t max_completions);
+extern int qpair_wait_completion_batch(struct spdk_nvme_qpair *q,
+                                       cpl_batch* batch);
 extern int qpair_get_id(struct spdk_nvme_qpair* q);
+extern qpair_doorbell_stat* qpair_get_doorbell_stat(struct spdk_nvme_qpair* q);
 extern int qpair_free(struct spdk_nvme_qpair* q);
     
 extern namespace* ns_init(ctrlr* c, unsigned int nsid);
@@ -141,6 +320,16 @@ extern int ns_cmd_read_write(int is_read,
                              uint32_t io_flags,
                              cmd_cb_func cb_fn,
                              void* cb_arg);
+extern int ns_cmd_read_write_vec(int is_read,
+                                 struct spdk_nvme_ns* ns,
+                                 struct spdk_nvme_qpair *qpair,
+                                 const struct iovec* iov,
+                                 int iovcnt,
+                                 uint64_t lba,
+                                 uint32_t lba_count,
+                                 uint32_t io_flags,
+                                 cmd_cb_func cb_fn,
+                                 void* cb_arg);
 extern uint32_t ns_get_sector_size(namespace* ns);
 extern uint64_t ns_get_num_sectors(namespace* ns);
 extern int ns_fini(struct spdk_nvme_ns* ns);
@@ -151,9 +340,42 @@ extern int ioworker_entry(struct spdk_nvme_ns* ns,
                           struct spdk_nvme_qpair *qpair,
                           ioworker_args* args,
                           ioworker_rets* rets);
+extern int ioworker_entry_striped(struct spdk_nvme_ns** ns,
+                                  struct spdk_nvme_qpair** qpair,
+                                  unsigned int count,
+                                  ioworker_args* args,
+                                  ioworker_rets* rets,
+                                  ioworker_rets* target_rets);
 
 extern void log_buf_dump(const char* header, const void* buf, size_t len);
 extern void log_cmd_dump(struct spdk_nvme_qpair* qpair, size_t count);
 extern void log_cmd_dump_admin(struct spdk_nvme_ctrlr* ctrlr, size_t count);
 
+// slow io tracer: the command and its neighbours in the cmdlog of the qpair
+#define SLOW_IO_NEIGHBOUR_NUM   (8)
+
+typedef struct slow_io_cmd
+{
+  unsigned long time_cmd_us;
+  // 0 if the command is not completed yet
+  unsigned long time_cpl_us;
+  unsigned int cmd[16];
+  unsigned int cpl[4];
+} slow_io_cmd;
+
+typedef struct slow_io_record
+{
+  unsigned short qid;
+  unsigned short neighbour_count;
+  unsigned int latency_us;
+  // commands outstanding in the qpair when the slow one completed
+  unsigned int inflight;
+  unsigned int rsvd;
+  struct slow_io_cmd io;
+  struct slow_io_cmd neighbour[SLOW_IO_NEIGHBOUR_NUM];
+} slow_io_record;
+
+extern int log_slow_io_trace(uint32_t threshold_us, uint32_t max);
+extern slow_io_record* log_slow_io_get(uint32_t* count, uint64_t* dropped);
+
 extern const char* cmd_name(uint8_t opc, int set);
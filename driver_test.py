@@ -35,8 +35,10 @@
 
 
 import os
+import re
 import time
 import pytest
+import asyncio
 import logging
 import warnings
 
@@ -52,6 +54,27 @@ def test_nvme_tcp_basic():
     del n
     del c
 
+
+@pytest.mark.skip("nvme over tcp")
+def test_nvme_tcp_options():
+    # local target created by make nvmt
+    c = d.Controller(b'127.0.0.1', port=4420,
+                     subnqn="nqn.2016-06.io.spdk:cnode1",
+                     header_digest=True, data_digest=True,
+                     io_queues=4, io_queue_size=128)
+    n = d.Namespace(c, 1)
+
+    # each ioworker connects the target again with the same options
+    l = [n.ioworker(io_size=8, lba_align=8, lba_random=True,
+                    read_percentage=50, qdepth=16, time=2).start()
+         for i in range(2)]
+    for w in l:
+        r = w.close()
+        assert r.error == 0
+    n.close()
+    del n
+    del c
+
     
 def test_create_device(nvme0, nvme0n1):
     assert nvme0 is not None
@@ -67,6 +90,36 @@ def test_create_device_again(nvme0):
         d.Controller(b"10:00.0")
 
 
+def test_attach_multiple_invalid(nvme0, pciaddr):
+    # the attached device is not probed again
+    r = d.attach([b"00:00.0", pciaddr.encode('ascii'), b"10:00.0"])
+    assert len(r) == 3
+    for x in r:
+        logging.info(x)
+        assert x.nvme is None
+        assert x.error is not None
+    assert nvme0.id_data(1, 0) != 0
+
+
+def test_attach_multiple(pciaddr2):
+    r = d.attach([pciaddr2.encode('ascii')])
+    assert len(r) == 1
+    logging.info(r[0])
+    assert r[0].error is None, r[0].error
+    assert r[0].attach_us > 0
+
+    # the attached controller is ready to use
+    nvme1 = r[0].nvme
+    nvme1n1 = d.Namespace(nvme1, 1)
+    buf = d.Buffer(4096)
+    q = d.Qpair(nvme1, 8)
+    assert nvme1.id_data(1, 0) != 0
+    nvme1n1.read(q, buf, 0, 8).waitdone()
+    del q
+    nvme1n1.close()
+    del r, nvme1
+
+
 @pytest.mark.parametrize("shift", range(1, 8))
 def test_qpair_different_size(nvme0n1, nvme0, shift):
     size = 1 << shift
@@ -83,11 +136,41 @@ def test_get_identify_quick(nvme0, nvme0n1):
     logging.info("firmware revision: %s" % nvme0.id_data(71, 64, str))
     logging.info("namespace size: %d" % nvme0n1.id_data(7, 0))
     logging.info("namespace capacity: %d" % nvme0n1.id_data(15, 8))
-    logging.info("namespace utilization: %d" % nvme0n1.id_data(23, 16))
+    logging.info("namespace utilization: %d" % nvme0n1.nuse)
     assert nvme0n1.id_data(7, 0) == nvme0n1.id_data(15, 8)
     assert nvme0.id_data(63, 24, str)[0] != 0
     
     
+def test_get_identify_cached(pciaddr, nvme0, nvme0n1):
+    def admin_cmds():
+        m = re.search(r'pynvme_qpair_commands_submitted_total{ctrlr="0000:%s",qid="0"} (\d+)' % pciaddr,
+                      d.metrics())
+        return int(m.group(1))
+
+    sn = nvme0.id_data(23, 4, str)
+    nvme0n1.id_data(7, 0)
+    nvme0.supports(0x80)
+    nvme0.cap
+    count = admin_cmds()
+    for i in range(100):
+        assert nvme0.id_data(23, 4, str) == sn
+        assert nvme0n1.id_data(7, 0) == nvme0n1.id_data(15, 8)
+        assert nvme0.supports(0x6)
+        assert nvme0.mdts >= 4096
+    assert admin_cmds() == count
+
+    # format invalidates the cache
+    nvme0.format(nvme0n1.get_lba_format(512, 0)).waitdone()
+    count = admin_cmds()
+    assert nvme0.id_data(23, 4, str) == sn
+    assert nvme0.id_data(23, 4, str) == sn
+    assert admin_cmds() == count+1
+    nvme0n1.id_data(23, 16, cached=False)
+    assert admin_cmds() == count+2
+    nvme0n1.nuse
+    assert admin_cmds() == count+3
+
+
 def test_get_identify(nvme0, nvme0n1):
     logging.info("controller data")
     id_buf = d.Buffer(4096, 'identify buffer')
@@ -107,7 +190,7 @@ def test_get_identify(nvme0, nvme0n1):
     assert nvme0.id_data(4, 0) != nvme0n1.id_data(4, 0)
     assert nvme0n1.id_data(8, 5) != nvme0n1.id_data(4, 0)
     assert nvme0n1.id_data(7, 0) == nvme0n1.id_data(15, 8)
-    assert nvme0n1.id_data(23, 16) == nvme0n1.id_data(15, 8)
+    assert nvme0n1.nuse == nvme0n1.id_data(15, 8)
 
     logging.info("common namespace data")    
     id_buf = d.Buffer(4096, 'identify buffer')
@@ -267,6 +350,29 @@ def test_write_identify_and_verify_with_callback(nvme0, nvme0n1):
     n.write(q, id_buf, 5, 8, cb=write_cb).waitdone(2)
 
 
+def test_write_read_vectored(nvme0, nvme0n1, verify):
+    q = d.Qpair(nvme0, 8)
+    buf1 = d.Buffer(4096, "segment 1")
+    buf2 = d.Buffer(8192, "segment 2")
+    read_buf = d.Buffer(4096*3, "read buffer")
+
+    # write 24 LBAs from 2 buffers, and read back in one buffer
+    nvme0n1.writev(q, [buf1, (buf2, 0, 8192)], 8).waitdone()
+    nvme0n1.read(q, read_buf, 8, 24).waitdone()
+    assert read_buf[:4096] == buf1[:]
+    assert read_buf[4096:] == buf2[:]
+
+    # read back into scattered buffers, verified per LBA
+    buf1[:] = bytes(4096)
+    nvme0n1.readv(q, [(buf2, 4096, 4096), buf1], 16, 16).waitdone()
+    assert buf1[:] == read_buf[4096*2:]
+
+    # segments not at page boundary can only be mapped by SGL
+    if (nvme0.id_data(539, 536) & 0x3) == 0:
+        with pytest.raises(AssertionError):
+            nvme0n1.writev(q, [(buf1, 0, 512), buf2], 8)
+
+
 def test_io_waitdone_many_command(nvme0, nvme0n1):
     id_buf = d.Buffer(4096)
     q = d.Qpair(nvme0, 8)
@@ -300,6 +406,55 @@ def test_io_waitdone_many_command(nvme0, nvme0n1):
     assert True
 
 
+def test_io_waitdone_batch(nvme0, nvme0n1):
+    # every write in flight has its own buffer
+    bufs = [d.Buffer(4096) for i in range(200)]
+    q = d.Qpair(nvme0, 256)
+
+    # reaped in batch, no python call for commands without callback
+    for i in range(200):
+        nvme0n1.write(q, bufs[i], i*8, 8)
+    q.waitdone(200)
+
+    cpl_count = 0
+    def write_cb(cdw0, status):
+        nonlocal cpl_count
+        cpl_count += 1
+
+    for i in range(10):
+        nvme0n1.write(q, bufs[i], i*8, 8, cb=write_cb)
+    cpls = []
+    while len(cpls) < 10:
+        cpls += q.reap(4)
+    assert len(cpls) == 10
+    assert cpl_count == 10
+    for cid, cdw0, status, latency in cpls:
+        assert (status>>1) == 0
+
+
+def test_poller_admin_and_io(nvme0, nvme0n1):
+    q1 = d.Qpair(nvme0, 16)
+    q2 = d.Qpair(nvme0, 16)
+    buf1 = d.Buffer(4096)
+    buf2 = d.Buffer(4096)
+    id_buf = d.Buffer(4096)
+
+    async def admin_and_io():
+        p = d.Poller(nvme0, [q1, q2])
+        rets = await asyncio.gather(p.submit(nvme0.identify, id_buf),
+                                    p.submit(nvme0n1.write, q1, buf1, 0, 8),
+                                    p.submit(nvme0n1.write, q2, buf2, 8, 8),
+                                    p.submit(nvme0.getfeatures, 7))
+        for cdw0, status in rets:
+            assert (status>>1) == 0
+        cdw0, status = await p.submit(nvme0n1.read, q1, buf2, 0, 8, timeout=1)
+        assert (status>>1) == 0
+
+    asyncio.get_event_loop().run_until_complete(admin_and_io())
+    assert id_buf.data(1, 0) == nvme0.id_data(1, 0)
+    assert buf1[:] == buf2[:]
+
+
 def test_write_and_flush(nvme0, nvme0n1):
     id_buf = d.Buffer(4096)
     q = d.Qpair(nvme0, 8)
@@ -605,7 +760,7 @@ def test_buffer_set_get():
     assert b[0] == 0x31
     b[0:10:1] = b"1234567890"
     assert b[0] == 0x31
-    b[1:10:1] = b"abcd567890"
+    b[1:10:1] = b"bcd567890"
     assert b[0] == 0x31
     b[:10:1] = b"1234567890"
     assert b[0] == 0x31
@@ -623,7 +778,64 @@ def test_buffer_set_get():
     # this is a full slice
     assert b[0:] != b"Z234567890"
 
+    # slices out of the buffer, with gaps, or of different sizes
+    with pytest.raises(AssertionError):
+        b[0:10:2] = b"12345"
+    with pytest.raises(AssertionError):
+        b[0:4] = b"12345"
+    with pytest.raises(AssertionError):
+        b[4094:] = b"1234"
+    b[-4:] = b"1234"
+    assert b[4092:] == b"1234"
+
     
+def test_buffer_bulk_operations():
+    b = d.Buffer(128*1024)
+    b.fill(b'\x5a\xa5')
+    assert b[:4] == b'\x5a\xa5\x5a\xa5'
+    assert b[-2:] == b'\x5a\xa5'
+
+    # zero-copy view of the buffer
+    m = memoryview(b)
+    assert len(m) == 128*1024
+    m[0] = 0x11
+    assert b[0] == 0x11
+
+    c = d.Buffer(128*1024)
+    c.copy(b)
+    assert c.compare(b)
+    assert c.crc32() == b.crc32()
+    c[100] = 0
+    assert c.mismatch(b) == 100
+    assert c.mismatch(b, 101, 101) is None
+    assert c.crc32(0, 100) == b.crc32(0, 100)
+    c.fill(0, 4096, 4096)
+    assert c.mismatch(bytes(4096), 4096) is None
+
+
+def test_buffer_pool():
+    pool = d.BufferPool()
+    b = d.Buffer(4096, pool=pool)
+    phys_addr = b.phys_addr
+    b[0] = 0x5a
+    del b
+
+    # the same memory is recycled, and cleared
+    b = d.Buffer(4000, pool=pool)
+    assert b.phys_addr == phys_addr
+    assert b[0] == 0
+    assert pool.reuse_count == 1
+    del b
+    assert pool.cached_bytes == 4096
+
+    for i in range(10000):
+        b = d.Buffer(512, pool=pool, zero=False)
+    assert pool.reuse_count > 9990
+    del b
+    pool.clear()
+    assert pool.cached_bytes == 0
+
+
 @pytest.mark.parametrize("repeat", range(2))
 def test_create_many_qpair(nvme0, repeat):
     q = []
@@ -865,6 +1077,40 @@ def test_controller_reset(nvme0):
     assert get_power_cycles(nvme0) == powercycle
 
 
+def test_controller_reset_fast(nvme0, nvme0n1):
+    buf = d.Buffer(4096)
+    q = d.Qpair(nvme0, 16)
+    nvme0n1.write(q, buf, 0, 8).waitdone()
+
+    # qpair and namespace are still valid after reset
+    for i in range(10):
+        nvme0.reset(fast=True)
+        assert nvme0.reset_time.reset_us > 0
+        assert nvme0.reset_time.first_io_us is None
+        nvme0n1.read(q, buf, 0, 8).waitdone()
+        logging.info(nvme0.reset_time)
+        assert nvme0.reset_time.first_io_us >= nvme0.reset_time.reset_us
+    nvme0.getfeatures(7).waitdone()
+    del q
+
+
+@pytest.mark.parametrize("cycle", ["reset", "subsystem", "shutdown"])
+def test_recovery_benchmark(nvme0, nvme0n1, cycle):
+    # the monitor polls in its own core
+    cores = d.cores_free()
+    if cores == 0:
+        pytest.skip("no free core for the recovery monitor")
+    r = nvme0.recovery_benchmark(nvme0n1, cycle, 5)
+    logging.info(r)
+    assert d.cores_free() == cores
+    assert r.reset_done.min > 0
+    assert r.reset_done.max <= r.identify.max
+    assert r.identify.p50 <= r.first_io.p50
+    assert r.csts_rdy_set.max <= r.reset_done.max
+    if cycle == "shutdown":
+        assert r.shst_complete.max < r.reset_done.min
+
+
 def test_get_smart_data(nvme0):
     smart_buffer = d.Buffer(4096, "smart data buffer")
     nvme0.getlogpage(0x2, smart_buffer, 512)
@@ -971,6 +1217,388 @@ def test_ioworker_simplified(nvme0n1):
     logging.info("ioworker context finish")
 
 
+def test_ioworker_striped_invalid(nvme0n1, verify):
+    # crc table cannot tell lba of different namespaces
+    with pytest.raises(AssertionError, match="verification"):
+        nvme0n1.ioworker(io_size=8, lba_align=8,
+                         lba_random=False, qdepth=16,
+                         read_percentage=100, io_count=10000,
+                         stripe=[nvme0n1], stripe_chunk=64)
+    d.config(verify=False)
+
+    # chunks of the namespace striped with itself overlap
+    with pytest.raises(AssertionError, match="striped more than once"):
+        nvme0n1.ioworker(io_size=8, lba_align=8,
+                         lba_random=False, qdepth=16,
+                         read_percentage=100, io_count=10000,
+                         stripe=[nvme0n1], stripe_chunk=64)
+
+
+def test_ioworker_striped_controllers(nvme0n1, nvme1n1):
+    # one qpair on each controller
+    r = nvme0n1.ioworker(io_size=8, lba_align=8,
+                         lba_random=True, qdepth=16,
+                         read_percentage=50, time=2,
+                         stripe=[nvme1n1], stripe_chunk=64).start().close()
+    assert r.error == 0
+    assert len(r.devices) == 2
+    assert all(x.io_count_read+x.io_count_write > 0 for x in r.devices)
+    assert sum(x.io_count_read for x in r.devices) == r.io_count_read
+    assert sum(x.io_count_write for x in r.devices) == r.io_count_write
+
+    # sequential IO is distributed to targets evenly
+    r = nvme0n1.ioworker(io_size=8, lba_align=8,
+                         lba_random=False, qdepth=16,
+                         read_percentage=100, io_count=10000,
+                         stripe=[nvme1n1], stripe_chunk=64).start().close()
+    assert r.io_count_read == 10000
+    assert abs(r.devices[0].io_count_read-r.devices[1].io_count_read) <= 16
+
+
+def test_ioworker_numa_node(nvme0, nvme0n1):
+    node = nvme0.numa_node
+    assert node >= -1
+    logging.info("device numa node: %d" % node)
+
+    # buffers follow the node of the device by default
+    assert d.BufferPool().socket == -1
+    assert d.BufferPool(socket=max(0, node)).socket == max(0, node)
+
+    # ioworker on the device node, or any node
+    for n in (None, -1):
+        r = nvme0n1.ioworker(io_size=8, lba_align=8,
+                             lba_random=True, qdepth=16,
+                             read_percentage=100, io_count=1000,
+                             numa_node=n).start().close()
+        assert r.io_count_read == 1000
+
+
+def test_ioworker_exclusive_cores(nvme0n1):
+    # one core for the script, and one for each ioworker
+    if (os.cpu_count() or 1) < 5:
+        pytest.skip("not enough cores")
+
+    l = []
+    for i in range(4):
+        a = nvme0n1.ioworker(io_size=8, lba_align=8,
+                             lba_random=True, qdepth=16,
+                             read_percentage=100, time=2).start()
+        l.append(a)
+
+    cores = [a.close().cpu_core for a in l]
+    logging.info("ioworker cores: %s" % cores)
+    assert min(cores) >= 0
+    assert len(set(cores)) == len(cores)
+
+
+def test_ioworker_adaptive_polling(nvme0n1):
+    r = nvme0n1.ioworker(io_size=8, lba_align=8,
+                         lba_random=True, qdepth=4, iops=200,
+                         read_percentage=100, time=3,
+                         poll_idle_us=1000).start().close()
+    logging.info(r)
+    assert r.error == 0
+    assert 400 < r.io_count_read < 800
+    # most of the time is slept
+    assert r.poll_sleep_us > r.mseconds*1000//2
+
+
+def test_ioworker_batch_doorbell(nvme0, nvme0n1):
+    # scripted IO: one doorbell for all commands sent before waitdone
+    buf = d.Buffer(4096)
+    q = d.Qpair(nvme0, 64, batch_doorbell=True)
+    for i in range(32):
+        nvme0n1.read(q, buf, i*8, 8)
+    q.waitdone(32)
+    assert q.doorbell['cmds'] == 32
+    assert q.doorbell['rings'] == 1
+    assert q.doorbell['batch'][32] == 1
+
+    # every command writes the doorbell without batch
+    q2 = d.Qpair(nvme0, 64)
+    for i in range(32):
+        nvme0n1.read(q2, buf, i*8, 8)
+    q2.waitdone(32)
+    assert q2.doorbell['cmds'] == 32
+    assert q2.doorbell['rings'] == 32
+    assert q2.doorbell['batch'][1] == 32
+
+    r = nvme0n1.ioworker(io_size=8, lba_align=8,
+                         lba_random=True, qdepth=64,
+                         read_percentage=100, io_count=100000,
+                         batch_doorbell=True).start().close()
+    logging.info(r.doorbell)
+    assert r.io_count_read == 100000
+    assert r.doorbell.cmds == 100000
+    assert r.doorbell.rings < r.doorbell.cmds
+    assert sum(r.doorbell.batch.values()) == r.doorbell.rings
+    # lower bound of cmds in each bucket
+    assert sum(k*v for k, v in r.doorbell.batch.items()) <= r.doorbell.cmds
+
+
+def test_metrics(pciaddr, nvme0, nvme0n1):
+    buf = d.Buffer(4096)
+    q = d.Qpair(nvme0, 64)
+    for i in range(32):
+        nvme0n1.read(q, buf, i*8, 8)
+    for i in range(16):
+        nvme0n1.write(q, buf, i*8, 8)
+    q.waitdone(48)
+
+    qid = 'ctrlr="0000:%s",qid="%d"' % (pciaddr, q.sqid)
+    m = d.metrics()
+    logging.debug(m)
+    assert "# TYPE pynvme_qpair_latency_us histogram" in m
+    assert "pynvme_qpair_reads_total{%s} 32" % qid in m
+    assert "pynvme_qpair_writes_total{%s} 16" % qid in m
+    assert "pynvme_qpair_read_bytes_total{%s} %d" % (qid, 32*4096) in m
+    assert "pynvme_qpair_inflight{%s} 0" % qid in m
+    assert 'pynvme_qpair_latency_us_count{%s} 48' % qid in m
+
+    # running ioworkers are reported in their own series
+    w = nvme0n1.ioworker(io_size=8, lba_align=8,
+                         lba_random=True, qdepth=16,
+                         read_percentage=100, time=3).start()
+    time.sleep(2)
+    m = d.metrics()
+    w.close()
+    assert "pynvme_ioworker_reads_total{pid=" in m
+    assert "pynvme_ioworker_read_bytes_total{pid=" in m
+    del q
+
+
+def test_cmb_sqs_and_data(nvme0, nvme0n1):
+    if nvme0.cmb_size == 0:
+        pytest.skip("cmb is not supported")
+
+    # SQ and data buffer in cmb
+    q = d.Qpair(nvme0, 16, cmb_sq=True)
+    buf = d.Buffer(4096, cmb=nvme0)
+    buf[0:4] = b'1234'
+    nvme0n1.write(q, buf, 0, 8).waitdone()
+    buf[0:4] = b'0000'
+    nvme0n1.read(q, buf, 0, 8).waitdone()
+    assert buf[0:4] == b'1234'
+    del buf
+    del q
+
+    # QD1 latency of SQ in cmb and in host memory
+    latency = {}
+    for cmb in (False, True):
+        percentile = {50: 0, 99: 0}
+        r = nvme0n1.ioworker(io_size=8, lba_align=8,
+                             lba_random=True, qdepth=1,
+                             read_percentage=0, io_count=10000, cmb_sq=cmb,
+                             output_percentile_latency=percentile).start().close()
+        assert r.error == 0
+        assert r.io_count_write == 10000
+        latency[cmb] = (r.latency_average_us, percentile[50], percentile[99])
+    logging.info("QD1 latency average/p50/p99 (us), sq in host memory: %s, sq in cmb: %s" %
+                 (latency[False], latency[True]))
+    logging.info("cmb sq average latency: %.1f%% of host memory sq" %
+                 (latency[True][0]*100/max(1, latency[False][0])))
+    assert latency[False][0] > 0 and latency[True][0] > 0
+
+    # and data buffers in cmb too
+    r = nvme0n1.ioworker(io_size=8, lba_align=8,
+                         lba_random=True, qdepth=1,
+                         read_percentage=0, io_count=10000,
+                         cmb_sq=True, cmb_data=True).start().close()
+    assert r.error == 0
+
+
+def test_ioworker_latency_slo(nvme0n1):
+    # latency of qd1 as the reference
+    output_percentile_latency = {99: 0}
+    r = nvme0n1.ioworker(io_size=8, lba_align=8,
+                         lba_random=True, qdepth=1,
+                         read_percentage=100, time=2,
+                         output_percentile_latency=output_percentile_latency).start().close()
+    target = max(100, output_percentile_latency[99]*2)
+
+    # find the qdepth meeting the latency target
+    qdepth = 256
+    r = nvme0n1.ioworker(io_size=8, lba_align=8,
+                         lba_random=True, qdepth=qdepth,
+                         read_percentage=100, time=5,
+                         slo_latency_us=target,
+                         slo_percentile=99).start().close()
+    logging.info("slo %dus: qdepth %d (%d-%d), p99 %dus, iops %d (%d-%d)" %
+                 (target, r.slo_qdepth, r.slo_qdepth_min, r.slo_qdepth_max,
+                  r.slo_latency_us, r.slo_iops, r.slo_iops_min, r.slo_iops_max))
+    assert r.error == 0
+    assert 1 <= r.slo_qdepth_min <= r.slo_qdepth <= r.slo_qdepth_max <= qdepth
+    assert r.slo_iops > 0
+
+    # latency is kept at the target, within the error of the histogram,
+    # unless the target is not reached even in the max qdepth
+    assert r.slo_latency_us <= target*1.125
+    if r.slo_qdepth_max < qdepth:
+        assert r.slo_latency_us >= target*0.875
+
+
+def test_precondition_steady_state(nvme0n1):
+    # short rounds to converge in the test
+    r = nvme0n1.precondition(io_size=8, qdepth=32, time=60,
+                             round_seconds=2, window=5, fill=False)
+    logging.info(r)
+    assert r.fill_seconds == 0
+    assert r.seconds <= 61
+    assert len(r.trace) >= 1
+    if r.steady:
+        last = r.trace[-1]
+        assert last.range <= last.average*0.2
+        assert abs(last.slope)*4 <= last.average*0.1
+        assert r.iops == last.average
+
+
+def test_ioworker_steady_state_read(nvme0n1):
+    # read IOPS gets steady soon
+    io_per_second = []
+    r = nvme0n1.ioworker(io_size=8, lba_align=8,
+                         lba_random=True, qdepth=16,
+                         read_percentage=100, time=30,
+                         steady_state_round=1, steady_state_window=5,
+                         output_io_per_second=io_per_second).start().close()
+    logging.info(io_per_second)
+    assert r.ss_seconds != 0
+    assert r.ss_seconds >= 5
+    assert r.mseconds <= (r.ss_seconds+2)*1000
+
+    # the measurement window meets the criteria
+    y = io_per_second[r.ss_seconds-5:r.ss_seconds]
+    average = sum(y)/5
+    slope = sum((x-2)*(v-average) for x, v in enumerate(y))/10
+    assert average > 0
+    assert max(y)-min(y) <= average*0.2
+    assert abs(slope)*4 <= average*0.1
+
+
+def test_fill_known_pattern(nvme0, nvme0n1, verify):
+    r = nvme0n1.fill(lba_start=1000, lba_count=100000, workers=2)
+    logging.info("fill %.1f MB/s in %.1f seconds" % (r.bandwidth, r.seconds))
+    assert r.lba_count == 100000
+    assert len(r.workers) == 2
+    assert sum(w.io_count_write for w in r.workers) >= 100000//(nvme0.mdts//512)
+
+    # lba and pattern in data, and verified by the checksum table
+    q = d.Qpair(nvme0, 8)
+    buf = d.Buffer(512*8)
+    for lba in (1000, 50000, 100999):
+        nvme0n1.read(q, buf, lba, 1).waitdone()
+        assert buf[0:8] == lba.to_bytes(8, 'little')
+        assert buf[8:16] == (0x5a5aa5a5c3c33c3c).to_bytes(8, 'little')
+        assert buf[504:512] == (0x5a5aa5a5c3c33c3c).to_bytes(8, 'little')
+
+    del q
+
+    # verify by ioworker
+    r = nvme0n1.ioworker(io_size=8, lba_align=8, lba_random=True,
+                         region_start=1000, region_end=101000,
+                         read_percentage=100, time=2).start().close()
+    assert r.error == 0
+
+
+def test_verify_scan_mismatch(nvme0, nvme0n1):
+    nvme0n1.fill(lba_start=2000, lba_count=100000, workers=2)
+    r = nvme0n1.verify_scan(lba_start=2000, lba_count=100000, workers=2)
+    assert r.mismatch_lba_count == 0
+    assert r.mismatch == []
+
+    # two uncorrectable ranges are all reported, with progress. Failed
+    # read is reported as a whole IO, so scan in small IO
+    q = d.Qpair(nvme0, 8)
+    nvme0n1.write_uncorrectable(q, 3000, 8).waitdone()
+    nvme0n1.write_uncorrectable(q, 90000, 16).waitdone()
+    del q
+    steps = []
+    r = nvme0n1.verify_scan(lba_start=2000, lba_count=100000, io_size=8,
+                            workers=4, progress=lambda done, total: steps.append((done, total)))
+    logging.info(r.mismatch)
+    assert r.mismatch_lba_count == 24
+    assert len(r.mismatch) == 2
+    assert r.mismatch[0].lba == 3000 and r.mismatch[0].lba_count == 8
+    assert r.mismatch[1].lba == 90000 and r.mismatch[1].lba_count == 16
+    assert all(m.status != 0 for m in r.mismatch)
+    assert all(total == 100000 for done, total in steps)
+    assert all(a[0] <= b[0] for a, b in zip(steps, steps[1:]))
+
+    # limit of collected ranges
+    r = nvme0n1.verify_scan(lba_start=2000, lba_count=100000, io_size=8,
+                            mismatch_max=1)
+    assert r.mismatch_lba_count == 24
+    assert len(r.mismatch) == 1
+
+
+def test_ioworker_slow_io(nvme0, nvme0n1):
+    # every io is slow with the lowest threshold, so records are full
+    r = nvme0n1.ioworker(io_size=8, lba_align=8,
+                         lba_random=True, qdepth=64,
+                         read_percentage=50, time=2,
+                         slow_io_us=1, slow_io_max=16).start().close()
+    assert r.error == 0
+    assert len(r.slow_io) == 16
+    assert r.slow_io_dropped > 0
+    for s in r.slow_io:
+        logging.info(s)
+        assert s.latency_us >= 1
+        assert s.inflight < 64
+        assert s.qid != 0
+        assert s.io.name in ("Read", "Write")
+        assert s.io.time_cpl_us - s.io.time_cmd_us == s.latency_us
+        assert len(s.neighbour) <= 8
+        assert all(n.name in ("Read", "Write") for n in s.neighbour)
+
+    # trace io of the script process
+    d.slow_io_trace(1)
+    q = d.Qpair(nvme0, 8)
+    buf = d.Buffer(512)
+    nvme0n1.read(q, buf, 0, 1).waitdone()
+    nvme0n1.write(q, buf, 8, 1).waitdone()
+    r = d.slow_io()
+    assert r.dropped == 0
+    assert len(r.records) == 2
+    assert r.records[0].io.lba == 0
+    assert r.records[1].io.lba == 8 and r.records[1].io.lba_count == 1
+    assert any(n.name == "Read" and n.lba == 0 for n in r.records[1].neighbour)
+    d.slow_io_trace(0)
+    assert d.slow_io().records == []
+    del q
+
+
+def test_ioworker_host_cycles(nvme0n1, verify):
+    r = nvme0n1.ioworker(io_size=8, lba_align=8,
+                         lba_random=True, qdepth=16,
+                         read_percentage=50, time=2).start().close()
+    logging.info("cycles per io %d, productive polls %.2f, host busy %.2f" %
+                 (r.cycles_per_io, r.poll_productive_ratio, r.host_busy_ratio))
+    assert r.error == 0
+    assert r.cycles_total == r.cycles_submit + r.cycles_fill + r.cycles_cmdlog + \
+        r.cycles_completion + r.cycles_verify + r.cycles_poll_empty + \
+        r.cycles_idle + r.cycles_other
+    assert r.cycles_submit > 0 and r.cycles_fill > 0 and r.cycles_cmdlog > 0
+    assert r.cycles_completion > 0 and r.cycles_verify > 0
+    assert r.cycles_idle == 0
+    # the process keeps polling in the ioworker
+    assert r.cycles_total >= r.cycles_hz*r.mseconds//1000//2
+    busy = r.cycles_total - r.cycles_poll_empty - r.cycles_idle
+    assert r.cycles_per_io > 0
+    assert r.cycles_per_io == busy//(r.io_count_read+r.io_count_write)
+    assert r.poll_empty_count <= r.poll_count
+    assert 0 <= r.poll_productive_ratio <= 1
+    assert 0 < r.host_busy_ratio <= 1
+
+    # adaptive polling sleeps instead of empty polls
+    r = nvme0n1.ioworker(io_size=8, lba_align=8,
+                         lba_random=True, qdepth=1,
+                         read_percentage=100, time=2,
+                         poll_idle_us=1000).start().close()
+    assert r.cycles_fill == 0
+    assert r.cycles_idle > 0
+    # sleeps are not counted in the cost of io
+    assert r.cycles_per_io*r.io_count_read <= r.cycles_total - r.cycles_idle
+
+
 def test_ioworker_output_io_per_latency(nvme0n1, nvme0):
     nvme0.format(nvme0n1.get_lba_format(512, 0)).waitdone()
 
@@ -1140,8 +1768,7 @@ def test_ioworker_invalid_io_size(nvme0, nvme0n1):
                          read_percentage=100, time=2).start().close()
 
 
-# test error handle of driver, test could continue after failed case
-@pytest.mark.xfail(reason="read write confliction on same LBA")
+# read write confliction on same LBA is not verified
 def test_ioworker_iops_confliction(verify, nvme0n1):
     import time
     start_time = time.time()
@@ -1158,14 +1785,13 @@ def test_ioworker_iops_confliction(verify, nvme0n1):
                           iops=0, io_count=0, time=30,
                           qprio=0, qdepth=16).start()
 
-    with pytest.warns(UserWarning, match="ERROR status: 02/81"):
-        wr.close()
+    assert wr.close().error == 0
 
     report = ww.close()
     assert report.error == 0
-    assert report['mseconds'] > 9999
-    assert time.time()-start_time > 9
-    assert time.time()-start_time < 20
+    assert report['mseconds'] > 29999
+    assert time.time()-start_time > 29
+    assert time.time()-start_time < 40
 
     
 def test_ioworker_activate_crc32(nvme0n1, verify, nvme0):
@@ -1190,14 +1816,36 @@ def test_ioworker_activate_crc32(nvme0n1, verify, nvme0):
 
     
 def test_ioworker_iops_confliction_read_write_mix(nvme0n1, verify):
-    # rw mixed ioworkers cause verification fail
-    with pytest.warns(UserWarning, match="ERROR status: 02/81"):
-        w = nvme0n1.ioworker(lba_start=0, io_size=8, lba_align=64,
-                             lba_random=False,
-                             region_start=0, region_end=1000,
-                             read_percentage=50,
-                             iops=0, io_count=0, time=10,
-                             qprio=0, qdepth=16).start().close()
+    # rw mixed ioworkers pass verification
+    w = nvme0n1.ioworker(lba_start=0, io_size=8, lba_align=64,
+                         lba_random=False,
+                         region_start=0, region_end=1000,
+                         read_percentage=50,
+                         iops=0, io_count=0, time=10,
+                         qprio=0, qdepth=16).start().close()
+    assert w.error == 0
+
+
+def test_ioworker_verify_corrupted_lba(nvme0, nvme0n1, verify):
+    # the raw write command changes the data of the lba, but its crc in
+    # the table is not updated, so the lba is corrupted
+    q = d.Qpair(nvme0, 8)
+    buf = d.Buffer(512)
+    nvme0n1.write(q, buf, 5000, 1).waitdone()
+    buf[100] = buf[100] ^ 0xff
+    nvme0n1.send_cmd(0x01, q, buf, cdw10=5000).waitdone()
+
+    # the lba out of the mixed ioworker's region is not racing with any
+    # write, so the mismatch is still reported
+    w = nvme0n1.ioworker(io_size=8, lba_align=8, lba_random=True,
+                         region_start=0, region_end=1000,
+                         read_percentage=50, time=5).start()
+    for i in range(10):
+        with pytest.warns(UserWarning, match="ERROR status: 02/81"):
+            nvme0n1.read(q, buf, 5000, 1).waitdone()
+        time.sleep(0.2)
+    assert w.close().error == 0
+    del q
 
         
 def test_ioworker_iops(nvme0n1):
@@ -1409,29 +2057,36 @@ def test_ioworkers_with_many_huge_io(nvme0n1, nvme0):
 
 
 def test_ioworkers_read_and_write_conflict(nvme0n1, nvme0, verify):
-    """read write confliction will cause data mismatch.
+    """read write confliction does not cause data mismatch.
 
     When the same LBA the read and write commands are operating on, NVMe
     spec does not garentee the order of read and write operation, so the 
     data of read command got could be old data or the new data of the write
-    command just written. 
+    command just written. These LBA racing with writes in flight are not
+    verified.
     """
     
     nvme0.format(nvme0n1.get_lba_format(512, 0)).waitdone()
-    with pytest.warns(UserWarning, match="ERROR status: 02/81"):
-        with nvme0n1.ioworker(lba_start=0, io_size=8, lba_align=8,
-                              lba_random=False,
-                              region_start=0, region_end=128,
-                              read_percentage=0,
-                              iops=0, io_count=0, time=2,
-                              qprio=0, qdepth=32), \
-             nvme0n1.ioworker(lba_start=0, io_size=8, lba_align=8,
-                              lba_random=False,
-                              region_start=0, region_end=128,
-                              read_percentage=100,
-                              iops=0, io_count=0, time=2,
-                              qprio=0, qdepth=32):
-            pass
+    w = nvme0n1.ioworker(lba_start=0, io_size=8, lba_align=8,
+                         lba_random=False,
+                         region_start=0, region_end=128,
+                         read_percentage=0,
+                         iops=0, io_count=0, time=2,
+                         qprio=0, qdepth=32).start()
+    r = nvme0n1.ioworker(lba_start=0, io_size=8, lba_align=8,
+                         lba_random=False,
+                         region_start=0, region_end=128,
+                         read_percentage=100,
+                         iops=0, io_count=0, time=2,
+                         qprio=0, qdepth=32).start()
+    assert w.close().error == 0
+    assert r.close().error == 0
+
+    # all data is verified after writes complete
+    r = nvme0n1.ioworker(io_size=8, lba_align=8, lba_random=False,
+                         region_start=0, region_end=128,
+                         read_percentage=100, io_count=64).start().close()
+    assert r.error == 0
 
 
 def test_ioworkers_read_and_write(nvme0n1, nvme0):
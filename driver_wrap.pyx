@@ -60,7 +60,9 @@
   * [Namespace](#namespace)
   * [Qpair](#qpair)
   * [Buffer](#buffer)
+  * [BufferPool](#bufferpool)
   * [Subsystem](#subsystem)
+  * [Poller](#poller)
 
 Pynvme is a python extension module. Users can operate NVMe SSD intuitively by Python scripts. It is designed for NVMe SSD testing with performance considered. With third-party tools, e.g. emacs, pycharm and/or pytest, Pynvme is a convenient and professional NVMe device test solution. It can test multiple NVMe DUT devices, operate most of the NVMe commands, support callback functions, and manage reset/power of NVMe devices. User needs root privilege to use pynvme.
 
@@ -227,6 +229,11 @@ Pynvme traces recent thousands of commands in the cmdlog, as well as the complet
 watch -n 1 sudo ./spdk/scripts/rpc.py get_nvme_controllers  # we use existed get_nvme_controllers rpc method to get all DUT information
 ```
 
+Live IO statistics of qpairs and running IOWorkers, e.g. IOPS, bandwidth, inflight commands, errors and latency histogram, are counted in shared memory. They are served by rpc methods get_nvme_qpair_stats and get_nvme_ioworker_stats in JSON, and get_nvme_metrics in Prometheus text format, which is also returned by nvme.metrics() in scripts. Qpairs are identified by the controller address and qid. For example,
+```shell
+echo '{"jsonrpc":"2.0","method":"get_nvme_metrics","id":1}' | sudo nc -U /var/tmp/spdk.sock
+```
+
 The cost is high and inconvenient to send each read and write command in Python scripts. Pynvme provides the low-cost IOWorker to send IOs in different processes. IOWorker takes full use of multi-core to not only send read/write IO in high speed, but also verify the correctness of data on the fly. User can get IOWorker's test statistics through its close() method. Here is an example of reading 4K data randomly with the IOWorker.
 
 Example:
@@ -314,11 +321,13 @@ Classes
 
 # python package
 import os
+import errno
 import sys
 import time
 import atexit
 import signal
 import struct
+import asyncio
 import logging
 import warnings
 import statistics
@@ -327,9 +336,11 @@ import multiprocessing
 
 # c library
 import cython
-from libc.string cimport strncpy, memset, strlen
+from libc.string cimport strncpy, memset, strlen, memcpy, memmove
 from libc.stdio cimport printf
+from libc.stdint cimport uintptr_t
 from cpython.mem cimport PyMem_Malloc, PyMem_Free
+from cpython.bytes cimport PyBytes_FromStringAndSize
 from cpython.exc cimport PyErr_CheckSignals
 
 # c driver
@@ -351,6 +362,14 @@ cdef void timeout_driver_cb(void* cb_arg, d.ctrlr* ctrlr,
     warnings.warn(error_string)
 
 
+# maximum completions reaped in one batch
+_cBATCH_MAX = 256
+
+
+# maximum sleep (in seconds) of the asyncio poller when nothing completes
+_cPOLL_IDLE_MAX = 0.001
+
+
 # timeout signal in wrap layer, it's an assert fail
 # driver wrap needs longer timeout, some commands need more time, like format
 _cTIMEOUT_wrap = 30
@@ -384,16 +403,16 @@ cdef struct _cpl:
 
 cdef void cmd_cb(void* f, const d.cpl* cpl):
     arg = <_cpl*>cpl  # no qa
-    status1 = arg.status1
-    func = <object>f   # no qa
+    cmd_cb_deliver(f, arg.cdw0, arg.status1)
 
-    if func is not None:
+cdef inline void cmd_cb_deliver(void* f, unsigned int cdw0, unsigned short status1):
+    if f is not NULL and <object>f is not None:
         # call script callback function to check cpl
         try:
-            func(arg.cdw0, status1)
+            (<object>f)(cdw0, status1)
         except AssertionError as e:
             warnings.warn("ASSERT: "+str(e))
-    elif d.nvme_cpl_is_error(cpl):
+    elif (status1>>1) & 0x7ff:
         # script not check, so driver check cpl
         sc = (status1>>1) & 0xff
         sct = (status1>>9) & 0x7
@@ -404,6 +423,62 @@ cdef void aer_cmd_cb(void* f, const d.cpl* cpl):
     cmd_cb(f, cpl)
 
 
+cdef class BufferPool(object):
+    """BufferPool class recycles DMA buffers in size classes, so allocating and freeing Buffer objects in test loops does not access hugepage memory every time. Buffers of the same size class are reused from the pool's free list. Buffers created without a pool are recycled in the default pool of the process.
+
+    Args:
+        max_cached (int): the maximum bytes of free buffers kept in the pool, others are released to hugepage memory
+                          default: 64MB
+        socket (int): NUMA socket of the hugepage memory where buffers are allocated
+                      default: -1, the socket of the process, which is the socket of the first Controller in the process
+
+    Examples:
+```python
+        >>> pool = BufferPool()
+        >>> for i in range(10000):
+        >>>     b = Buffer(4096, pool=pool, zero=False)
+        >>> pool.reuse_count
+        9998
+```
+    """
+
+    cdef d.buffer_pool * _pool
+
+    def __cinit__(self, max_cached=64*1024*1024, socket=-1):
+        self._pool = d.buffer_pool_create(max_cached, socket)
+        if self._pool is NULL:
+            raise MemoryError()
+
+    def __dealloc__(self):
+        if self._pool is not NULL:
+            d.buffer_pool_destroy(self._pool)
+            self._pool = NULL
+
+    @property
+    def cached_bytes(self):
+        """bytes of free buffers kept in the pool"""
+        return self._pool.cached_bytes
+
+    @property
+    def socket(self):
+        """NUMA socket of buffers allocated by the pool, -1 for the socket of the process"""
+        return self._pool.socket_id
+
+    @property
+    def alloc_count(self):
+        """number of buffers allocated from the pool"""
+        return self._pool.count_alloc
+
+    @property
+    def reuse_count(self):
+        """number of buffers recycled from the free list of the pool"""
+        return self._pool.count_reuse
+
+    def clear(self):
+        """release all free buffers in the pool to hugepage memory"""
+        d.buffer_pool_clear(self._pool)
+
+
 cdef class Buffer(object):
     """Buffer class allocated in DPDK memzone,so can be used by DMA. Data in buffer is clear to 0 in initialization.
 
@@ -412,6 +487,12 @@ cdef class Buffer(object):
                     default: 4096
         name (str): the name of the buffer
                     default: 'buffer'
+        pool (BufferPool): the pool to allocate the buffer from
+                           default: None, to use the default pool of the process
+        zero (bool): clear data to 0 in initialization
+                     default: True
+        cmb (Controller): allocate the buffer in the Controller Memory Buffer of this controller. The buffer can only be used in IO commands of this controller, and its phys_addr is 0.
+                          default: None, allocate the buffer in host hugepage memory
 
     Examples:
 ```python
@@ -451,8 +532,13 @@ cdef class Buffer(object):
     cdef size_t size
     cdef char* name
     cdef unsigned long phys_addr
+    cdef BufferPool pool
+    cdef object cmb
+    cdef Py_ssize_t shape[1]
+    cdef Py_ssize_t strides[1]
 
-    def __cinit__(self, size=4096, name="buffer"):
+    def __cinit__(self, size=4096, name="buffer", BufferPool pool=None, zero=True,
+                  cmb=None):
         assert size > 0, "0 is not valid size"
 
         # copy python string to c string
@@ -465,7 +551,14 @@ cdef class Buffer(object):
 
         # buffer init
         self.size = size
-        self.ptr = d.buffer_init(size, &self.phys_addr)
+        self.pool = pool
+        # keep the controller alive with its cmb buffer
+        self.cmb = cmb
+        if cmb is not None:
+            self.phys_addr = 0
+            self.ptr = d.buffer_cmb_alloc((<Controller?>cmb)._ctrlr, size, zero)
+        else:
+            self.ptr = d.buffer_pool_alloc(self._pool(), size, &self.phys_addr, zero)
         if self.ptr is NULL:
             raise MemoryError()
 
@@ -474,7 +567,15 @@ cdef class Buffer(object):
             PyMem_Free(self.name)
 
         if self.ptr is not NULL:
-            d.buffer_fini(self.ptr)
+            if self.cmb is not None:
+                d.buffer_cmb_free((<Controller>self.cmb)._ctrlr, self.ptr, self.size)
+            else:
+                d.buffer_pool_free(self._pool(), self.ptr, self.size)
+            self.ptr = NULL
+
+    cdef d.buffer_pool* _pool(self):
+        # NULL is the default pool in driver
+        return self.pool._pool if self.pool is not None else NULL
 
     @property
     def phys_addr(self):
@@ -522,24 +623,162 @@ cdef class Buffer(object):
     def __repr__(self):
         return '<buffer name: %s>' % str(self.name, "ascii")
 
+    def __getbuffer__(self, Py_buffer* buffer, int flags):
+        # export the DMA memory to memoryview, numpy, etc, without copy
+        self.shape[0] = self.size
+        self.strides[0] = 1
+        buffer.buf = self.ptr
+        buffer.obj = self
+        buffer.len = self.size
+        buffer.readonly = 0
+        buffer.itemsize = 1
+        buffer.format = 'B'
+        buffer.ndim = 1
+        buffer.shape = self.shape
+        buffer.strides = self.strides
+        buffer.suboffsets = NULL
+        buffer.internal = NULL
+
+    def __releasebuffer__(self, Py_buffer* buffer):
+        pass
+
     def __getitem__(self, index):
+        cdef Py_ssize_t start, stop, step
+
         if isinstance(index, slice):
-            return bytes([self[i] for i in range(*index.indices(len(self)))])
+            start, stop, step = index.indices(len(self))
+            if step == 1:
+                return PyBytes_FromStringAndSize(<char*>self.ptr+start, max(0, stop-start))
+            return bytes([self[i] for i in range(start, stop, step)])
         elif isinstance(index, int):
             return (<unsigned char*>self.ptr)[index]
         else:
             raise TypeError()
 
     def __setitem__(self, index, value):
+        cdef const unsigned char[:] data
+        cdef Py_ssize_t start, stop, step
+
         if isinstance(index, slice):
-            start = 0 if index.start is None else index.start
-            for i, d in enumerate(value):
-                self[i+start] = d
+            data = value if isinstance(value, (bytes, bytearray, memoryview)) else bytes(value)
+            start, stop, step = index.indices(self.size)
+            if index.stop is None:
+                # open-ended slice: write the data from start
+                stop = start+len(data)
+            assert step == 1, "only support contiguous slice"
+            assert 0 <= start and stop <= self.size, "data is out of the buffer"
+            assert stop-start == len(data), "data size does not match the slice"
+            if len(data):
+                memcpy(<char*>self.ptr+start, &data[0], len(data))
         elif isinstance(index, int):
             (<unsigned char*>self.ptr)[index] = value
         else:
             raise TypeError()
 
+    cdef size_t _range(self, Py_ssize_t offset, size) except? 0:
+        # get the size of a range in the buffer
+        if size is None:
+            size = self.size-offset
+        assert offset >= 0 and size >= 0, "invalid buffer range"
+        assert offset+size <= self.size, "range is out of the buffer"
+        return size
+
+    def fill(self, pattern=0, Py_ssize_t offset=0, size=None):
+        """fill the buffer with the pattern repeatedly
+
+        Args:
+            pattern (int or bytes): the byte value, or the bytes of the pattern
+                                    default: 0
+            offset (int): the first byte to fill
+                          default: 0
+            size (int): the bytes to fill
+                        default: None, to fill till the end of the buffer
+        """
+
+        cdef const unsigned char[:] p
+        cdef size_t n = self._range(offset, size)
+
+        p = bytes([pattern]) if isinstance(pattern, int) else pattern
+        assert len(p) > 0, "empty pattern"
+        if n:
+            d.buffer_fill_pattern(<char*>self.ptr+offset, n, &p[0], len(p))
+
+    def copy(self, src, Py_ssize_t offset=0, Py_ssize_t src_offset=0, size=None):
+        """copy data from another buffer, or bytes-like object
+
+        Args:
+            src (Buffer or bytes): the source of the data
+            offset (int): the first byte to copy to in this buffer
+                          default: 0
+            src_offset (int): the first byte to copy from in the source
+                              default: 0
+            size (int): the bytes to copy
+                        default: None, to copy all data in the source after src_offset
+        """
+
+        cdef const unsigned char[:] s = src
+
+        if size is None:
+            size = len(s)-src_offset
+        assert src_offset+size <= len(s), "range is out of the source"
+        cdef size_t n = self._range(offset, size)
+        if n:
+            memmove(<char*>self.ptr+offset, &s[src_offset], n)
+
+    def mismatch(self, other, Py_ssize_t offset=0, Py_ssize_t other_offset=0, size=None):
+        """find the first different byte with another buffer, or bytes-like object
+
+        Args:
+            other (Buffer or bytes): the data to compare with
+            offset (int): the first byte to compare in this buffer
+                          default: 0
+            other_offset (int): the first byte to compare in the other data
+                                default: 0
+            size (int): the bytes to compare
+                        default: None, to compare all data in the other after other_offset
+
+        Rets:
+            (int or None): the offset of the first mismatched byte in the range, None if all are the same
+        """
+
+        cdef const unsigned char[:] o = other
+
+        if size is None:
+            size = len(o)-other_offset
+        assert other_offset+size <= len(o), "range is out of the other data"
+        cdef size_t n = self._range(offset, size)
+        if n == 0:
+            return None
+        ret = d.buffer_mismatch(<char*>self.ptr+offset, &o[other_offset], n)
+        return None if ret < 0 else ret
+
+    def compare(self, other, offset=0, other_offset=0, size=None):
+        """compare data with another buffer, or bytes-like object
+
+        Args: the same as mismatch()
+
+        Rets:
+            (bool): True if data are the same
+        """
+
+        return self.mismatch(other, offset, other_offset, size) is None
+
+    def crc32(self, Py_ssize_t offset=0, size=None):
+        """CRC32C of the data in the buffer
+
+        Args:
+            offset (int): the first byte of the data
+                          default: 0
+            size (int): the bytes of the data
+                        default: None, till the end of the buffer
+
+        Rets:
+            (int): the CRC32C value
+        """
+
+        cdef size_t n = self._range(offset, size)
+        return d.buffer_crc32c(<char*>self.ptr+offset, n)
+
     def set_dsm_range(self, index, lba, lba_count):
         """set dsm ranges in the buffer, for dsm/deallocation (a.ka trim) commands
 
@@ -605,13 +844,21 @@ cdef class Subsystem(object):
         while (self._nvme[0x1c] & 0xc) != 0x8: pass
         logging.debug("shutdown completed")
 
-    def reset(self):
-        """reset the nvme subsystem through register nssr.nssrc"""
+    def reset(self, fast=False):
+        """reset the nvme subsystem through register nssr.nssrc
+
+        Args:
+            fast (bool): re-initialize the controller in place, keeping qpairs and namespaces valid, refer to Controller.reset()
+                         default: False
+        """
 
         # nssr.nssrc: nvme subsystem reset
         logging.debug("nvme subsystem reset by NSSR.NSSRC")
         self._nvme[0x20] = 0x4E564D65  # "NVMe"
-        self._nvme._reinit()
+        if fast:
+            self._nvme._reset_fast()
+        else:
+            self._nvme._reinit()
 
 
 cdef class Pcie(object):
@@ -695,6 +942,27 @@ class NvmeEnumerateError(Exception):
     pass
 
 
+# controllers attached in bulk, picked up by Controller objects later
+_attached_ctrlrs = {}
+
+
+cdef void _ctrlr_options_init(d.ctrlr_options* options, cmb_sqs, port, subnqn,
+                              header_digest, data_digest,
+                              io_queues, io_queue_size):
+    memset(options, 0, sizeof(d.ctrlr_options))
+    options.use_cmb_sqs = cmb_sqs
+    port = str(port).encode('ascii')
+    strncpy(options.trsvcid, port, sizeof(options.trsvcid)-1)
+    if subnqn is not None:
+        subnqn = subnqn.encode('ascii')
+        assert len(subnqn) < sizeof(options.subnqn), "subnqn is too long"
+        strncpy(options.subnqn, subnqn, sizeof(options.subnqn)-1)
+    options.header_digest = header_digest
+    options.data_digest = data_digest
+    options.num_io_queues = io_queues
+    options.io_queue_size = io_queue_size
+
+
 class NvmeDeletionError(Exception):
     pass
 
@@ -706,6 +974,20 @@ cdef class Controller(object):
         addr (bytes): the bus/device/function address of the DUT, for example: 
                       b'01:00.0' (PCIe BDF address);
                       b'127.0.0.1' (TCP IP address).
+        cmb_sqs (bool): place IO SQs in the Controller Memory Buffer, if the controller supports SQ in CMB. Qpairs and ioworkers can override it.
+                        default: False
+        port (int): TCP port of the NVMe/TCP target
+                    default: 4420
+        subnqn (str): NQN of the NVMe/TCP subsystem
+                      default: None, the discovery NQN
+        header_digest (bool): enable CRC32C digest of PDU headers of NVMe/TCP
+                              default: False
+        data_digest (bool): enable CRC32C digest of PDU data of NVMe/TCP
+                            default: False
+        io_queues (int): number of IO queues requested to the controller
+                         default: 0, driver's default number
+        io_queue_size (int): maximum IO queue size
+                             default: 0, the maximum size supported by the controller
 
     Example:
 ```python
@@ -744,9 +1026,25 @@ cdef class Controller(object):
     cdef d.ctrlr * _ctrlr
     cdef char _bdf[20]
     cdef Buffer hmb_buf
+    cdef d.ctrlr_options _options
+    cdef object _kwargs
+    cdef dict _cache
+    cdef unsigned long _cache_generation
     
-    def __cinit__(self, addr):
+    def __cinit__(self, addr, cmb_sqs=False, port=4420, subnqn=None,
+                  header_digest=False, data_digest=False,
+                  io_queues=0, io_queue_size=0):
         strncpy(self._bdf, addr, strlen(addr)+1)
+        self._cache = {}
+        self._cache_generation = d.nvme_admin_change_count()
+
+        # options are also used to connect the controller in ioworkers
+        self._kwargs = dict(cmb_sqs=cmb_sqs, port=port, subnqn=subnqn,
+                            header_digest=header_digest, data_digest=data_digest,
+                            io_queues=io_queues, io_queue_size=io_queue_size)
+        _ctrlr_options_init(&self._options, cmb_sqs, port, subnqn,
+                            header_digest, data_digest,
+                            io_queues, io_queue_size)
         self._create()
 
     def __dealloc__(self):
@@ -755,16 +1053,81 @@ cdef class Controller(object):
     def _reinit(self):
         logging.debug("to re-initialize nvme: %s", self._bdf)
         self._close()
+        self.cache_clear()
         self._create()
 
     def _create(self):
-        self._ctrlr = d.nvme_init(self._bdf)
+        # the controller may be attached already by attach()
+        ptr = _attached_ctrlrs.pop(self._bdf, None)
+        if ptr is not None:
+            self._ctrlr = <d.ctrlr*><uintptr_t>ptr
+        else:
+            self._ctrlr = d.nvme_init(self._bdf, &self._options)
         if self._ctrlr is NULL:
             raise NvmeEnumerateError(f"fail to create the controller")
         d.nvme_register_timeout_cb(self._ctrlr, timeout_driver_cb, _cTIMEOUT)
         self.register_aer_cb(None)
         logging.debug("nvme initialized: %s", self._bdf)
 
+        # allocate buffers in the socket of the first device, if the
+        # process is not placed to any NUMA node explicitly
+        if d.driver_numa_socket_get() < 0 and \
+           "PYNVME_NUMA_NODE" not in os.environ:
+            d.driver_numa_socket_set(self.numa_node)
+
+    def cache_clear(self):
+        """drop cached identify data, log pages and registers of the controller
+
+        The cache is cleared automatically on controller reset, format, sanitize, firmware commit and namespace management/attachment commands. Scripts changing the controller in other ways, e.g. vendor specific commands, should call this function.
+        """
+
+        self._cache.clear()
+
+    def _cache_check(self):
+        # drop the data cached before any changing admin command completes,
+        # no matter the completion is reaped by waitdone, reap or Poller
+        generation = d.nvme_admin_change_count()
+        if generation != self._cache_generation:
+            self._cache_generation = generation
+            self._cache.clear()
+
+    def _cache_get(self, key, fill):
+        # get cached data buffer, fill it by admin command at the first time
+        self._cache_check()
+        buf = self._cache.get(key)
+        if buf is None:
+            status = 0
+            def cb(cdw0, status1):
+                nonlocal status
+                status = status1
+                cmd_cb_deliver(NULL, cdw0, status1)
+
+            buf = Buffer(4096)
+            fill(buf, cb).waitdone()
+            if (status>>1) & 0x7ff == 0:
+                # only keep valid data
+                self._cache[key] = buf
+        return buf
+
+    @property
+    def cap(self):
+        """the 64-bit CAP register, which is cached"""
+        self._cache_check()
+        if 'cap' not in self._cache:
+            self._cache['cap'] = self[0] | (self[4]<<32)
+        return self._cache['cap']
+
+    @property
+    def cmb_size(self):
+        """bytes of the Controller Memory Buffer, 0 if not supported"""
+        cmbsz = self[0x3c]
+        return ((cmbsz>>12)&0xfffff) * (4096<<(4*((cmbsz>>8)&0xf)))
+
+    @property
+    def numa_node(self):
+        """NUMA node of the device's PCIe root port, -1 if unknown"""
+        return d.pcie_get_numa_node(d.pcie_init(self._ctrlr))
+
     def enable_hmb(self):
         # init hmb function
         hmb_size = self.id_data(275, 272)
@@ -784,7 +1147,7 @@ cdef class Controller(object):
     @property
     def mdts(self):
         """max data transfer size"""
-        page_size = (1UL<<(12+((self[4]>>16)&0xf)))
+        page_size = (1UL<<(12+((self.cap>>48)&0xf)))
         mdts_shift = self.id_data(77)
         if mdts_shift == 0:
             return 512*(1UL<<16)
@@ -833,13 +1196,22 @@ cdef class Controller(object):
 
         d.log_cmd_dump_admin(self._ctrlr, count)
 
-    def reset(self):
+    def reset(self, fast=False):
         """controller reset: cc.en 1 => 0 => 1
 
+        Args:
+            fast (bool): reset the controller in driver, and re-create io qpairs in place. Qpair, Namespace and Buffer objects are kept valid, and outstanding commands are aborted. The time of reset is reported in reset_time.
+                         default: False
+
         Notices:
-            Test scripts should delete all io qpairs before reset!
+            Test scripts should delete all io qpairs before reset, unless it is a fast reset!
+            Fast reset only covers controller reset and subsystem reset. Pcie.reset() and Subsystem.power_cycle() always re-initialize the controller, so all io qpairs should be deleted before them.
         """
 
+        if fast:
+            self._reset_fast()
+            return
+
         cc = self[0x14]
         assert (cc & 1) == 1, "cc.en is not 1 before reset"
 
@@ -856,6 +1228,108 @@ cdef class Controller(object):
         # reset driver
         self._reinit()
 
+    def _reset_fast(self):
+        self.cache_clear()
+        if d.nvme_reset(self._ctrlr) != 0:
+            raise SystemError("fail to reset the controller")
+        logging.debug("controller is ready in %d us" % d.nvme_get_reset_stat().reset_us)
+
+    @property
+    def reset_time(self):
+        """time of the latest fast reset in this process
+
+        Rets:
+            (DotDict): reset_us, the time to get the controller and its qpairs ready; first_io_us, the time to complete the first IO after reset, None if no IO is completed yet
+        """
+
+        stat = d.nvme_get_reset_stat()
+        return DotDict(reset_us=stat.reset_us,
+                       first_io_us=stat.first_io_us if stat.first_io_us else None)
+
+    def recovery_benchmark(self, Namespace ns, cycle="reset", count=10):
+        """measure the time to recover from reset or shutdown, phase by phase
+
+        Transitions of CC.EN, CSTS.RDY and CSTS.SHST are timestamped by TSC in a monitor thread, when the controller is recovered by fast reset. The admin queue is ready at csts_rdy_set, and the driver completes its reset, including controller initialization and io qpairs re-creation, at reset_done. And then admin and IO commands are sent to get the time of the first identify and the first IO completion.
+
+        Args:
+            ns (Namespace): the namespace to send the first IO
+            cycle (str): "reset" for controller reset, "subsystem" for NVM subsystem reset, and "shutdown" for normal shutdown and then controller reset
+                         default: "reset"
+            count (int): the number of cycles to repeat
+                         default: 10
+
+        Rets:
+            (DotDict): distribution of each phase in us since the start of the cycle: min, max, avg, p50, p99. Phases are cc_en_clear, csts_rdy_clear, shst_complete, cc_en_set, csts_rdy_set, reset_done, identify and first_io.
+
+        Notices:
+            Only PCIe controllers are supported. Outstanding IO of the controller is aborted. The monitor thread runs on a free core claimed from the core table, and SystemError is raised when no core is free. PCIe reset and power cycle are not supported, because the device is detached and probed again, and the BAR polled by the monitor is remapped.
+            SystemError is raised when shutdown is not completed in RTD3E, or 10 seconds if RTD3E is not reported.
+        """
+
+        cdef d.nvme_recovery_ticks* t
+
+        assert cycle in ("reset", "subsystem", "shutdown"), "unknown cycle: %s" % cycle
+        assert ns._nvme is self, "namespace is not in this controller"
+
+        hz = d.driver_get_ticks_hz()
+        samples = {}
+        buf = Buffer(ns.sector_size)
+        id_buf = Buffer(4096)
+        q = Qpair(self, 2)
+
+        # the bound to wait shutdown complete, refer to spec 7.6.2
+        shutdown_timeout = self.id_data(91, 88)/1000_000
+        if shutdown_timeout == 0:
+            shutdown_timeout = 10
+
+        def us(tick, start):
+            return (tick-start)*1000000/hz if tick else None
+
+        try:
+            for i in range(count):
+                if d.nvme_recovery_monitor_start(self._ctrlr) != 0:
+                    raise SystemError("fail to start the recovery monitor")
+                start = d.driver_get_ticks()
+                try:
+                    if cycle == "subsystem":
+                        self[0x20] = 0x4E564D65  # "NVMe"
+                    elif cycle == "shutdown":
+                        self[0x14] = self[0x14] | 0x4000
+                        deadline = time.time() + shutdown_timeout
+                        while (self[0x1c] & 0xc) != 0x8:
+                            if time.time() > deadline:
+                                raise SystemError("shutdown is not completed in %d seconds" % shutdown_timeout)
+                    self._reset_fast()
+                    reset_done = d.driver_get_ticks()
+                    self.identify(id_buf, 0, 1).waitdone()
+                    identify = d.driver_get_ticks()
+                    ns.read(q, buf, 0, 1).waitdone()
+                    first_io = d.driver_get_ticks()
+                finally:
+                    t = d.nvme_recovery_monitor_stop()
+
+                phases = dict(cc_en_clear=us(t.cc_en_clear, start),
+                              csts_rdy_clear=us(t.csts_rdy_clear, start),
+                              shst_complete=us(t.shst_complete, start),
+                              cc_en_set=us(t.cc_en_set, start),
+                              csts_rdy_set=us(t.csts_rdy_set, start),
+                              reset_done=us(reset_done, start),
+                              identify=us(identify, start),
+                              first_io=us(first_io, start))
+                logging.debug("recovery phases: %s" % phases)
+                for k, v in phases.items():
+                    if v is not None:
+                        samples.setdefault(k, []).append(v)
+        finally:
+            del q
+
+        ret = DotDict()
+        for k, v in samples.items():
+            v.sort()
+            ret[k] = DotDict(min=v[0], max=v[-1], avg=sum(v)/len(v),
+                             p50=v[len(v)//2], p99=v[min(len(v)-1, len(v)*99//100)])
+        return ret
+
     def cmdname(self, opcode):
         """get the name of the admin command
 
@@ -881,8 +1355,8 @@ cdef class Controller(object):
         """
 
         assert opcode < 256*2 # *2 for nvm command set
-        logpage_buf = Buffer(4096)
-        self.getlogpage(5, logpage_buf).waitdone()
+        logpage_buf = self._cache_get(('log', 5),
+                                      lambda buf, cb: self.getlogpage(5, buf, cb=cb))
         return logpage_buf.data((opcode+1)*4-1, opcode*4) != 0
 
     def waitdone(self, expected=1):
@@ -926,6 +1400,23 @@ cdef class Controller(object):
             "not reap the exact completions! reaped %d, expected %d" % (reaped, expected)
         _reentry_flag = False
 
+    def reap(self):
+        """reap available admin completions, without waiting
+
+        Callback functions of these commands are called before return.
+
+        Rets:
+            (int): the number of reaped completions
+        """
+
+        global _reentry_flag
+        assert _reentry_flag is False, f"cannot re-entry waitdone() functions which may be caused by waitdone in callback functions, {_reentry_flag}"
+        _reentry_flag = True
+        try:
+            return d.nvme_wait_completion_admin(self._ctrlr)
+        finally:
+            _reentry_flag = False
+
     def abort(self, cid, sqid=0, cb=None):
         """abort admin commands
 
@@ -980,7 +1471,7 @@ cdef class Controller(object):
                             cb_arg=<void*>cb)
         return self
 
-    def id_data(self, byte_end, byte_begin=None, type=int, nsid=0, cns=1):
+    def id_data(self, byte_end, byte_begin=None, type=int, nsid=0, cns=1, cached=True):
         """get field in controller identify data
 
         Args:
@@ -989,13 +1480,17 @@ cdef class Controller(object):
                               default: None, means only get 1 byte defined in byte_end
             type (type): the type of the field. It should be int or str.
                          default: int, convert to integer python object
+            cached (bool): get the field from the identify data cached in the controller
+                           default: True
 
         Rets:
             (int or str): the data in the specified field
         """
 
-        id_buf = Buffer(4096)
-        self.identify(id_buf, nsid, cns).waitdone()
+        if not cached:
+            self._cache.pop(('identify', nsid, cns), None)
+        id_buf = self._cache_get(('identify', nsid, cns),
+                                 lambda buf, cb: self.identify(buf, nsid, cns, cb=cb))
         return id_buf.data(byte_end, byte_begin, type)
 
     def getfeatures(self, fid, cdw11=0, cdw12=0, cdw13=0, cdw14=0, cdw15=0,
@@ -1327,6 +1822,11 @@ cdef class Controller(object):
             ptr = buf.ptr
             size = buf.size
 
+        # fw commit, ns management, format, ns attachment and sanitize
+        # change identify data and log pages
+        if opcode in (0x10, 0x0d, 0x80, 0x15, 0x84):
+            self.cache_clear()
+
         logging.debug("send admin command, opcode %xh" % opcode)
         ret = d.nvme_send_cmd_raw(self._ctrlr, NULL, opcode, nsid, ptr, size,
                                   cdw10, cdw11, cdw12, cdw13, cdw14, cdw15,
@@ -1350,27 +1850,62 @@ cdef class Qpair(object):
         nvme (Controller): controller where to create the queue
         depth (int): SQ/CQ queue depth
         prio (int): when Weighted Round Robin is enabled, specify SQ priority here
+        batch_doorbell (bool): delay the SQ doorbell of IO commands till the qpair is polled (e.g. waitdone, reap), so one doorbell write notifies the whole batch of commands. Only PCIe controllers support it.
+                               default: False, ring the doorbell for each command
+        cmb_sq (bool): place the SQ in the Controller Memory Buffer, if the controller supports SQ in CMB
+                       default: None, follow the cmb_sqs option of the Controller
     """
 
     cdef d.qpair * _qpair
+    cdef d.cpl_batch _batch
 
     def __cinit__(self, Controller nvme,
                   unsigned int depth,
-                  unsigned int prio=0):
+                  unsigned int prio=0,
+                  bint batch_doorbell=False,
+                  cmb_sq=None):
         # create CQ and SQ
         if depth < 2:
             raise QpairCreationError("depth should >= 2")
             
-        self._qpair = d.qpair_create(nvme._ctrlr, prio, depth)
+        self._qpair = d.qpair_create(nvme._ctrlr, prio, depth, batch_doorbell,
+                                     -1 if cmb_sq is None else cmb_sq)
         if self._qpair is NULL:
             raise QpairCreationError("qpair create fail")
 
+        # completions are reaped in batch
+        self._batch.count = 0
+        self._batch.max = _cBATCH_MAX
+        self._batch.cb_fn = cmd_cb
+        self._batch.entries = <d.cpl_batch_entry*>PyMem_Malloc(_cBATCH_MAX*sizeof(d.cpl_batch_entry))
+        if not self._batch.entries:
+            raise MemoryError()
+
     def __dealloc__(self):
         if self._qpair is not NULL:
             if d.qpair_free(self._qpair) != 0:
                 raise QpairDeletionError()
             self._qpair = NULL
 
+        if self._batch.entries is not NULL:
+            PyMem_Free(self._batch.entries)
+            self._batch.entries = NULL
+
+    cdef int _reap_batch(self, unsigned int max_count) except -1:
+        # reap completions into the batch, and call back the scripts
+        cdef unsigned int i
+        cdef d.cpl_batch_entry* e
+
+        assert max_count > 0 and max_count <= _cBATCH_MAX
+        self._batch.max = max_count
+        ret = d.qpair_wait_completion_batch(self._qpair, &self._batch)
+        assert ret >= 0, "qpair process completions error: %d" % ret
+
+        for i in range(self._batch.count):
+            e = &self._batch.entries[i]
+            cmd_cb_deliver(e.cb_arg, e.cdw0, e.status)
+        return ret
+
     def __repr__(self):
         return "<qpair: %d>" % self.sqid
 
@@ -1408,9 +1943,8 @@ cdef class Qpair(object):
         logging.debug("to reap %d io commands, sqid %d" % (expected, self.sqid))
         signal.alarm(_cTIMEOUT_wrap)
         while reaped < expected:
-            # wait IO Q pair done, max 8 cpl in one time
-            max_to_reap = (expected-reaped) % 8
-            reaped += d.qpair_wait_completion(self._qpair, max_to_reap)
+            # wait IO Q pair done, never reap more than expected
+            reaped += self._reap_batch(min(expected-reaped, _cBATCH_MAX))
             PyErr_CheckSignals()
         signal.alarm(0)
 
@@ -1419,6 +1953,49 @@ cdef class Qpair(object):
         _reentry_flag = False
 
 
+    def reap(self, max_count=_cBATCH_MAX):
+        """reap available completions in one batch, without waiting
+
+        Callback functions of these commands are called before return.
+
+        Args:
+            max_count (int): the maximum completions to reap
+                             default: 256
+
+        Rets:
+            (list): tuples of (cid, cdw0, status, latency_us) of the reaped completions
+        """
+
+        cdef unsigned int i
+        cdef d.cpl_batch_entry* e
+
+        global _reentry_flag
+        assert _reentry_flag is False, f"cannot re-entry waitdone() functions which may be caused by waitdone in callback functions, {_reentry_flag}"
+        _reentry_flag = True
+        try:
+            self._reap_batch(max_count)
+        finally:
+            _reentry_flag = False
+
+        ret = []
+        for i in range(self._batch.count):
+            e = &self._batch.entries[i]
+            ret.append((e.cid, e.cdw0, e.status, e.latency_us))
+        return ret
+
+    @property
+    def doorbell(self):
+        """doorbell statistics of the qpair in this process
+
+        Rets:
+            dict: "cmds" is the number of submitted commands, "rings" is the number of SQ doorbell writes, and "batch" is the distribution of commands per doorbell write. Its keys are the lower bound of power-of-2 buckets, e.g. {1: 10, 2: 0, 4: 3, ...}.
+        """
+        cdef d.qpair_doorbell_stat* stat = d.qpair_get_doorbell_stat(self._qpair)
+        return {'cmds': stat.cmds,
+                'rings': stat.rings,
+                'batch': {1<<i: stat.batch_hist[i] for i in range(d.DOORBELL_BATCH_HIST_NUM)}}
+
+
 class NamespaceCreationError(Exception):
     pass
 
@@ -1436,7 +2013,7 @@ cdef class Namespace(object):
     """
 
     cdef d.namespace * _ns
-    cdef char _bdf[8]
+    cdef char _bdf[20]
     cdef unsigned int _nsid
     cdef unsigned int sector_size
     cdef Controller _nvme
@@ -1444,7 +2021,7 @@ cdef class Namespace(object):
     def __cinit__(self, Controller nvme, unsigned int nsid=1):
         logging.debug("initialize namespace nsid %d" % nsid)
         self._nvme = nvme
-        strncpy(self._bdf, nvme._bdf, 8)
+        strncpy(self._bdf, nvme._bdf, 20)
         self._nsid = nsid
         self._ns = d.ns_init(nvme._ctrlr, nsid)
         if self._ns is NULL:
@@ -1474,6 +2051,11 @@ cdef class Namespace(object):
         """bytes of namespace capacity"""
         return self.id_data(63, 48)
 
+    @property
+    def nuse(self):
+        """namespace utilization in LBAs, which is changed by IO, so it is always identified again"""
+        return self.id_data(23, 16, cached=False)
+
     def cmdname(self, opcode):
         """get the name of the IO command
 
@@ -1501,7 +2083,7 @@ cdef class Namespace(object):
         assert opcode < 256
         return self._nvme.supports(256+opcode)
 
-    def id_data(self, byte_end, byte_begin=None, type=int):
+    def id_data(self, byte_end, byte_begin=None, type=int, cached=True):
         """get field in namespace identify data
 
         Args:
@@ -1510,12 +2092,14 @@ cdef class Namespace(object):
                               default: None, means only get 1 byte defined in byte_end
             type (type): the type of the field. It should be int or str.
                          default: int, convert to integer python object
+            cached (bool): get the field from the identify data cached in the controller. Set it to False for dynamic fields, like NUSE changed by IO.
+                           default: True
 
         Rets:
             (int or str): the data in the specified field
         """
 
-        return self._nvme.id_data(byte_end, byte_begin, type, self._nsid, 0)
+        return self._nvme.id_data(byte_end, byte_begin, type, self._nsid, 0, cached)
 
     def get_lba_format(self, data_size=512, meta_size=0):
         """find the lba format by its data size and meta data size
@@ -1540,7 +2124,13 @@ cdef class Namespace(object):
                  read_percentage, time=0, qdepth=64,
                  region_start=0, region_end=0xffff_ffff_ffff_ffff,
                  iops=0, io_count=0, lba_start=0, qprio=0,
-                 output_io_per_second=None, output_percentile_latency=None):
+                 output_io_per_second=None, output_percentile_latency=None,
+                 stripe=None, stripe_chunk=256, numa_node=None,
+                 poll_idle_us=0, batch_doorbell=False, cmb_sq=None, cmb_data=False,
+                 slo_latency_us=0, slo_percentile=99,
+                 steady_state_round=0, steady_state_window=5,
+                 known_pattern=False, verify_scan=False, mismatch_max=1000,
+                 slow_io_us=0, slow_io_max=64):
         """workers sending different read/write IO on different CPU cores.
 
         User defines IO characteristics in parameters, and then the ioworker
@@ -1578,21 +2168,272 @@ cdef class Namespace(object):
                                          default: None, not to collect the data
             output_percentile_latency (dict): dict of io counter on different percentile latency. Dict key is the percentage, and the value is the latency in ms.
                                               default: None, not to collect the data
+            stripe (list): other Namespaces striped with this namespace as one RAID-0 volume. The ioworker sends IO to all namespaces from one process, each of them with its own Qpair.
+                           default: None, not striped
+            stripe_chunk (int): stripe chunk size, unit is LBA. It should be a multiple of lba_align.
+                                default: 256
+            numa_node (int): NUMA node where the ioworker process runs and allocates its buffers. -1 means any node.
+                             default: None, the node of the device
+            poll_idle_us (int): adaptive polling, the maximum us to sleep when no IO completes and no IO is due. The ioworker sleeps until the next paced IO or the expected completion by average latency, and backs off exponentially when the completion is overdue. The slept time and the upper bound of latency it introduced are reported as poll_sleep_us and poll_delay_us.
+                                default: 0, busy polling
+            batch_doorbell (bool): delay the SQ doorbell till the qpair is polled, so IOs submitted in one poll iteration are notified by one doorbell write. The doorbell statistics of all qpairs are reported as doorbell in the returned data.
+                                   default: False
+            cmb_sq (bool): place SQs of the ioworker in the Controller Memory Buffer
+                           default: None, follow the cmb_sqs option of the Controller
+            cmb_data (bool): allocate data buffers of IO in the Controller Memory Buffer
+                             default: False, data buffers are in host memory
+            slo_latency_us (int): latency SLO, the target latency of the percentile. The ioworker starts from queue depth 1, and adjusts the queue depth every 100ms upto qdepth, to find the highest IOPS meeting the latency target. The operating point of the last second is reported as slo_qdepth, slo_latency_us and slo_iops, with the min/max of qdepth and iops. It cannot be used with poll_idle_us.
+                                  default: 0, send IO in fixed qdepth
+            slo_percentile (float): the percentile of latency checked against slo_latency_us, in (0, 100)
+                                    default: 99
+            steady_state_round (int): seconds of one round in steady state detection. The ioworker stops before time when the average IOPS of rounds in the measurement window meets SNIA PTS steady state: the range of data is within 20% of the average, and the range of the linear fit is within 10% of the average. The seconds to reach steady state are reported as ss_seconds, or 0 if it is not reached. It requires output_io_per_second.
+                                      default: 0, no steady state detection
+            steady_state_window (int): count of rounds in the measurement window, 2 to 64
+                                       default: 5
+            known_pattern (bool): write the known pattern sequentially from region_start to region_end. Only lba is updated in data buffers for each IO, and the checksum table is marked in bulk, so the data can be verified without per-LBA CRC. It requires sequential write.
+                                  default: False, write data with token and CRC
+            verify_scan (bool): read sequentially from region_start to region_end, and verify all data against the checksum table. Mismatched LBA and failed reads are counted as mismatch_lba_count, and the ranges are returned in the list "mismatch", instead of stopping the ioworker.
+                                default: False
+            mismatch_max (int): maximum mismatched ranges returned by verify_scan
+                                default: 1000
+            slow_io_us (int): trace IO slower than this latency. The records are returned in "slow_io", and the count of slow IO not recorded in "slow_io_dropped". Refer to slow_io() for the content of records.
+                              default: 0, no trace of slow IO
+            slow_io_max (int): maximum slow IO recorded
+                               default: 64
 
         Rets:
-            ioworker object
+            ioworker object. When striped, the returned data has a list "devices" with statistic data of each namespace.
+            The returned data also has the host cycles of the ioworker process in each stage: cycles_submit, cycles_fill, cycles_cmdlog, cycles_completion, cycles_verify, cycles_poll_empty (polls reaping no IO), cycles_idle (sleeps of adaptive polling), and cycles_other, which add up to cycles_total. The report has cycles_per_io (busy cycles, excluding empty polls and idle sleeps, per IO), poll_productive_ratio, and host_busy_ratio, which is close to 1 when the result is bound by the host rather than the device.
+
+        Notices:
+            The striped volume is made of the same count of chunks on each namespace, so its capacity is limited by the smallest namespace. All namespaces should have the same sector size, and each of them can only be striped once. Inline verification of data is not supported in striped ioworkers, so disable it by nvme.config(verify=False).
+            Each ioworker process claims an exclusive CPU core, which is reported as cpu_core in the returned data. The ioworker fails if no core is free in 10 seconds.
         """
 
+        cdef Namespace ns
+
         assert not (time==0 and io_count==0), "when to stop the ioworker?"
         assert qdepth>0 and qdepth<=1024, "support qdepth upto 1024"
-        assert qdepth <= (self._nvme[0]&0xffff) + 1, "qdepth is larger than specification"  
-        
+        assert qdepth <= (self._nvme.cap&0xffff) + 1, "qdepth is larger than specification"  
+        assert slo_percentile>0 and slo_percentile<100, "percentile should be in (0, 100)"
+        assert slo_latency_us==0 or poll_idle_us==0, "latency slo controls the queue depth without adaptive polling"
+        assert steady_state_round==0 or output_io_per_second is not None, "steady state is detected with io counter per second"
+        assert steady_state_window >= 2, "measurement window needs 2 rounds at least"
+        assert steady_state_window <= d.IOWORKER_SS_WINDOW_MAX, "measurement window has %d rounds at most" % d.IOWORKER_SS_WINDOW_MAX
+        assert not known_pattern or (read_percentage==0 and not lba_random and not stripe), "known pattern is filled by sequential write"
+        assert not verify_scan or (read_percentage==100 and not lba_random and not stripe and mismatch_max>0), "verify scan is sequential read"
+
+        targets = None
+        if stripe:
+            assert not cmb_data, "cmb data buffer is not supported in striped ioworker"
+            assert stripe_chunk > 0 and stripe_chunk%lba_align == 0, "stripe_chunk should be a multiple of lba_align"
+            assert io_size <= lba_align, "striped IO cannot cross chunks"
+            assert (d.driver_config_read() & 1) == 0, "inline verification is not supported in striped ioworker"
+            namespaces = [(self._bdf, self._nsid)] + [(ns._bdf, ns.nsid) for ns in stripe]
+            assert len(set(namespaces)) == len(namespaces), "a namespace is striped more than once"
+            targets = []
+            for ns in stripe:
+                assert qdepth <= (ns._nvme.cap&0xffff) + 1, "qdepth is larger than specification"
+                targets.append((ns._bdf, ns.nsid, ns._nvme._kwargs))
+
+        if numa_node is None:
+            numa_node = self._nvme.numa_node
+
         pciaddr = self._bdf
         nsid = self._nsid
         return _IOWorker(pciaddr, nsid, lba_start, io_size, lba_align,
                          lba_random, region_start, region_end,
                          read_percentage, iops, io_count, time, qdepth+1, qprio,
-                         output_io_per_second, output_percentile_latency)
+                         output_io_per_second, output_percentile_latency,
+                         targets, stripe_chunk, numa_node, poll_idle_us,
+                         batch_doorbell, cmb_sq, cmb_data, slo_latency_us,
+                         slo_percentile, steady_state_round,
+                         steady_state_window, known_pattern, verify_scan,
+                         mismatch_max, slow_io_us, slow_io_max,
+                         self._nvme._kwargs)
+
+    def fill(self, lba_start=0, lba_count=0, io_size=0, qdepth=16, workers=4):
+        """fill the LBA range with the known pattern at sequential write bandwidth.
+
+        The range is split to the workers, each of them is an ioworker on its own core and Qpair, sending the largest IO allowed by MDTS. Data written by fill can be verified by read as other data.
+
+        Args:
+            lba_start (long): the first LBA to fill
+                              default: 0
+            lba_count (long): count of LBA to fill
+                              default: 0, till the end of the namespace
+            io_size (int): IO size, unit is LBA
+                           default: 0, the MDTS
+            qdepth (int): queue depth of each worker
+                          default: 16
+            workers (int): count of ioworkers
+                           default: 4
+
+        Rets:
+            DotDict: seconds, lba_count, bandwidth in MB/s, and the returned data of each worker in "workers".
+        """
+
+        lba_count, ioworkers = self._range_ioworkers(lba_start, lba_count, io_size,
+                                                     qdepth, workers, read_percentage=0,
+                                                     known_pattern=True)
+        rets = [w.close() for w in ioworkers]
+
+        seconds = max(r.mseconds for r in rets)/1000
+        assert all(r.error == 0 for r in rets), "fill failed"
+        ret = DotDict(seconds=seconds, lba_count=lba_count, workers=rets)
+        ret.bandwidth = lba_count*self.sector_size/1e6/seconds if seconds else 0
+        logging.info("fill %d LBA in %.1f seconds, %.1f MB/s" %
+                     (lba_count, seconds, ret.bandwidth))
+        return ret
+
+    def verify_scan(self, lba_start=0, lba_count=0, io_size=0, qdepth=16,
+                    workers=4, mismatch_max=1000, progress=None):
+        """read back and verify the LBA range at sequential read bandwidth.
+
+        The range is split to the workers as fill(). Data is verified against the checksum table, and all mismatches are collected instead of stopping at the first one.
+
+        Args:
+            lba_start (long): the first LBA to verify
+                              default: 0
+            lba_count (long): count of LBA to verify
+                              default: 0, till the end of the namespace
+            io_size (int): IO size, unit is LBA
+                           default: 0, the MDTS
+            qdepth (int): queue depth of each worker
+                          default: 16
+            workers (int): count of ioworkers
+                           default: 4
+            mismatch_max (int): maximum mismatched ranges to collect
+                                default: 1000
+            progress (function): called every second with the count of LBA verified and the count of all LBA
+                                 default: None
+
+        Rets:
+            DotDict: seconds, lba_count, bandwidth in MB/s, mismatch_lba_count, and the list of "mismatch" ranges sorted by lba. Each range has lba, lba_count, the nvme status of a failed read or 0 for data mismatch, and expected_crc, actual_crc, actual_lba, actual_token of its first LBA. All LBA of a failed read are reported, so use smaller io_size to locate them.
+        """
+
+        lba_count, ioworkers = self._range_ioworkers(lba_start, lba_count, io_size,
+                                                     qdepth, workers, read_percentage=100,
+                                                     verify_scan=True,
+                                                     mismatch_max=mismatch_max)
+
+        # stream progress till all workers return. The stat slot of a
+        # worker is released when it returns, so count its whole range,
+        # and never go back from the bytes seen before
+        done = [0]*len(ioworkers)
+        while progress and any(w.q.empty() for w in ioworkers):
+            time.sleep(1)
+            for i, w in enumerate(ioworkers):
+                if not w.q.empty():
+                    done[i] = (w.region[1]-w.region[0])*self.sector_size
+                else:
+                    done[i] = max(done[i], d.driver_ioworker_bytes(w.p.pid))
+            progress(min(lba_count, sum(done)//self.sector_size), lba_count)
+        rets = [w.close() for w in ioworkers]
+
+        # merge adjacent ranges split by workers and out-of-order completions
+        mismatch = []
+        for m in sorted((m for r in rets for m in r.mismatch), key=lambda m: m.lba):
+            if mismatch and mismatch[-1].lba+mismatch[-1].lba_count == m.lba and \
+               mismatch[-1].status == m.status:
+                mismatch[-1].lba_count += m.lba_count
+            else:
+                mismatch.append(m)
+
+        seconds = max(r.mseconds for r in rets)/1000
+        assert all(r.error == 0 for r in rets), "verify scan failed"
+        ret = DotDict(seconds=seconds, lba_count=lba_count, workers=rets,
+                      mismatch=mismatch[:mismatch_max],
+                      mismatch_lba_count=sum(r.mismatch_lba_count for r in rets))
+        ret.bandwidth = lba_count*self.sector_size/1e6/seconds if seconds else 0
+        logging.info("verify %d LBA in %.1f seconds, %.1f MB/s, %d LBA mismatched" %
+                     (lba_count, seconds, ret.bandwidth, ret.mismatch_lba_count))
+        return ret
+
+    def _range_ioworkers(self, lba_start, lba_count, io_size, qdepth,
+                         workers, **kwargs):
+        # split the range to sequential ioworkers on the boundary of IO
+        nsze = self.id_data(7, 0)
+        if lba_count == 0:
+            lba_count = nsze - lba_start
+        assert lba_start+lba_count <= nsze, "range beyond the namespace"
+        if io_size == 0:
+            # the driver splits IO larger than 2MB
+            io_size = min(self._nvme.mdts, 2*1024*1024)//self.sector_size
+
+        ios = (lba_count+io_size-1)//io_size
+        workers = max(1, min(workers, ios))
+        per_worker = (ios+workers-1)//workers*io_size
+        ioworkers = []
+        for start in range(lba_start, lba_start+lba_count, per_worker):
+            end = min(start+per_worker, lba_start+lba_count)
+            ioworkers.append(self.ioworker(io_size=io_size, lba_align=1,
+                                           lba_random=False,
+                                           region_start=start, region_end=end,
+                                           io_count=(end-start+io_size-1)//io_size,
+                                           qdepth=qdepth, **kwargs).start())
+        return lba_count, ioworkers
+
+    def precondition(self, io_size=8, qdepth=64, time=3600*6,
+                     round_seconds=60, window=5, fill=True):
+        """precondition the namespace to the steady state of random write.
+
+        The whole namespace is filled by sequential write, and then random
+        write runs until IOPS reaches SNIA PTS steady state, or time is out.
+
+        Args:
+            io_size (int): IO size of random write, unit is LBA
+                           default: 8
+            qdepth (int): queue depth of both sequential and random write
+                          default: 64
+            time (int): maximum seconds of random write
+                        default: 6 hours
+            round_seconds (int): seconds of one round in steady state detection
+                                 default: 60
+            window (int): count of rounds in the measurement window
+                          default: 5
+            fill (bool): fill the namespace by sequential write before random write
+                         default: True
+
+        Rets:
+            DotDict: fill_seconds, steady (bool), seconds of random write, iops of the measurement window, and the convergence trace. Each round in the trace has its iops, and the average, range and slope of the window ending at this round.
+        """
+
+        ret = DotDict(fill_seconds=0)
+
+        if fill:
+            ret.fill_seconds = self.fill(qdepth=qdepth).seconds
+
+        io_per_second = []
+        r = self.ioworker(io_size=io_size, lba_align=io_size,
+                          lba_random=True, read_percentage=0,
+                          time=time, qdepth=qdepth,
+                          output_io_per_second=io_per_second,
+                          steady_state_round=round_seconds,
+                          steady_state_window=window).start().close()
+        assert r.error == 0, "random write failed"
+
+        # convergence trace of rounds, the same as the ioworker detects
+        ret.trace = []
+        rounds = [sum(io_per_second[i:i+round_seconds])/round_seconds
+                  for i in range(0, len(io_per_second)-round_seconds+1, round_seconds)]
+        for n, iops in enumerate(rounds):
+            step = DotDict(round=n+1, iops=iops)
+            if n+1 >= window:
+                y = rounds[n+1-window:n+1]
+                y_avg = sum(y)/window
+                x_avg = (window-1)/2
+                step.average = y_avg
+                step.range = max(y)-min(y)
+                step.slope = sum((x-x_avg)*(y[x]-y_avg) for x in range(window)) / \
+                             sum((x-x_avg)**2 for x in range(window))
+            ret.trace.append(step)
+
+        ret.steady = r.ss_seconds != 0
+        ret.seconds = r.mseconds/1000
+        ret.iops = ret.trace[-1].average if ret.trace and ret.steady else None
+        logging.info("precondition: steady %s in %d seconds" % (ret.steady, ret.seconds))
+        return ret
 
     def read(self, qpair, buf, lba, lba_count=1, io_flags=0, cb=None):
         """read IO command
@@ -1655,6 +2496,66 @@ cdef class Namespace(object):
 
         return qpair
 
+    def readv(self, qpair, segments, lba, lba_count=None, io_flags=0, cb=None):
+        """read IO command with scattered data buffers
+
+        Args:
+            qpair (Qpair): use the qpair to send this command
+            segments (list): data segments of the command. Each segment is a Buffer, or a tuple of (Buffer, offset, length). Driver maps segments to SGL when the controller supports it. Otherwise segments are mapped to PRP list, so all segments but the first have to start at a 4KB page boundary, and all segments but the last have to end at a 4KB page boundary.
+            lba (int): the starting lba address, 64 bits
+            lba_count (int): the lba count of this command, 1 to 65536
+                             default: None, means the total size of segments
+            io_flags (int): io flags defined in NVMe specification, 16 bits
+                            default: 0
+            cb (function): callback function called at completion
+                           default: None
+
+        Returns:
+            qpair (Qpair): the qpair used to send this command, for ease of chained call
+
+        Raises:
+            SystemError: the read command fails
+
+        Notices:
+            buffers cannot be released before the command completes.
+        """
+
+        logging.debug(f"readv, lba {lba}, lba_count {lba_count}")
+        if 0 != self.send_read_write_vec(True, qpair, segments, lba, lba_count,
+                                         io_flags, cmd_cb, <void*>cb):
+            raise SystemError()
+        return qpair
+
+    def writev(self, qpair, segments, lba, lba_count=None, io_flags=0, cb=None):
+        """write IO command with scattered data buffers
+
+        Args:
+            qpair (Qpair): use the qpair to send this command
+            segments (list): data segments of the command. Each segment is a Buffer, or a tuple of (Buffer, offset, length). Driver maps segments to SGL when the controller supports it. Otherwise segments are mapped to PRP list, so all segments but the first have to start at a 4KB page boundary, and all segments but the last have to end at a 4KB page boundary.
+            lba (int): the starting lba address, 64 bits
+            lba_count (int): the lba count of this command, 1 to 65536
+                             default: None, means the total size of segments
+            io_flags (int): io flags defined in NVMe specification, 16 bits
+                            default: 0
+            cb (function): callback function called at completion
+                           default: None
+
+        Returns:
+            qpair (Qpair): the qpair used to send this command, for ease of chained call
+
+        Raises:
+            SystemError: the write command fails
+
+        Notices:
+            buffers cannot be released before the command completes.
+        """
+
+        logging.debug(f"writev, lba {lba}, lba_count {lba_count}")
+        if 0 != self.send_read_write_vec(False, qpair, segments, lba, lba_count,
+                                         io_flags, cmd_cb, <void*>cb):
+            raise SystemError()
+        return qpair
+
     def dsm(self, qpair, buf, range_count, attribute=0x4, cb=None):
         """data-set management IO command
 
@@ -1788,6 +2689,34 @@ cdef class Namespace(object):
                          cmd_cb, <void*>cb)
         return qpair
 
+    def send_cmd(self, opcode, qpair, buf=None,
+                 cdw10=0, cdw11=0, cdw12=0,
+                 cdw13=0, cdw14=0, cdw15=0, cb=None):
+        """send generic IO command of the namespace
+
+        Args:
+            opcode (int): the opcode of the IO command
+            qpair (Qpair): use the qpair to send this command
+            buf (Buffer): the data buffer of the command
+                          default: None
+            cdw10-cdw15 (int): dwords of the command
+                               default: 0
+            cb (function): callback function called at completion
+                           default: None
+
+        Returns:
+            qpair (Qpair): the qpair used to send this command, for ease of chained call
+
+        Notices:
+            Data of the command is not filled or tracked by the driver. The data verification of the lbas fails after they are written by this command, until they are written by write() again.
+            buf cannot be released before the command completes.
+        """
+
+        self.send_io_raw(qpair, buf, opcode, self._nsid,
+                         cdw10, cdw11, cdw12, cdw13, cdw14, cdw15,
+                         cmd_cb, <void*>cb)
+        return qpair
+
     cdef int send_read_write(self,
                              bint is_read,
                              Qpair qpair,
@@ -1804,6 +2733,65 @@ cdef class Namespace(object):
         assert ret == 0, "error in submitting read write commands: 0x%x" % ret
         return ret
 
+    cdef int send_read_write_vec(self,
+                                 bint is_read,
+                                 Qpair qpair,
+                                 segments,
+                                 lba,
+                                 lba_count,
+                                 unsigned int io_flags,
+                                 d.cmd_cb_func cb_func,
+                                 void* cb_arg):
+        cdef Buffer buf
+        cdef size_t offset
+        cdef size_t length
+        cdef size_t total = 0
+        cdef int iovcnt = len(segments)
+        cdef d.iovec* iov
+
+        assert iovcnt > 0, "no data segment"
+        # SGLS in identify controller data
+        sgl = (self._nvme.id_data(539, 536) & 0x3) != 0
+        iov = <d.iovec*>PyMem_Malloc(iovcnt*sizeof(d.iovec))
+        if not iov:
+            raise MemoryError()
+
+        try:
+            for i, seg in enumerate(segments):
+                # segment: Buffer, or (Buffer, offset, length)
+                if isinstance(seg, Buffer):
+                    seg = (seg, 0, len(seg))
+                buf, offset, length = seg
+                assert buf is not None, "no buffer allocated"
+                assert offset+length <= buf.size, "segment is out of the buffer"
+                iov[i].iov_base = <char*>buf.ptr+offset
+                iov[i].iov_len = length
+                total += length
+
+                # PRP entries address whole pages, except the first and last
+                if not sgl:
+                    addr = <uintptr_t>iov[i].iov_base
+                    assert addr % 4 == 0, "segment is not dword aligned"
+                    assert i == 0 or addr % 4096 == 0, \
+                        "segment %d does not start at a page boundary, and the controller does not support SGL" % i
+                    assert i == iovcnt-1 or (addr+length) % 4096 == 0, \
+                        "segment %d does not end at a page boundary, and the controller does not support SGL" % i
+
+            if lba_count is None:
+                lba_count = total//self.sector_size
+            assert 1 <= lba_count <= 0x10000, "lba count is a 16bit-field in commands"
+            assert lba_count*self.sector_size <= total, "segments are smaller than the lba count"
+
+            # driver keeps its own copy of the segment list
+            ret = d.ns_cmd_read_write_vec(is_read, self._ns, qpair._qpair,
+                                          iov, iovcnt, lba, lba_count, io_flags,
+                                          cb_func, cb_arg)
+        finally:
+            PyMem_Free(iov)
+
+        assert ret == 0, "error in submitting vectored read write commands: 0x%x" % ret
+        return ret
+
     cdef int send_io_raw(self,
                          Qpair qpair,
                          Buffer buf,
@@ -1831,6 +2819,109 @@ cdef class Namespace(object):
         return ret
 
 
+class _PollerCommand(object):
+    """a command submitted in the poller, kept till it completes"""
+    __slots__ = ('future', 'deadline', 'cb')
+
+
+class Poller(object):
+    """Poller services the admin queue and IO qpairs of a controller in the asyncio event loop.
+
+    Commands submitted through the poller are awaitable, so scripts can overlap admin commands, IO commands in multiple qpairs, and host-side work in coroutines, without blocking in waitdone(). Each command has its own timeout, instead of the SIGALRM of waitdone().
+
+    Args:
+        nvme (Controller): the controller whose admin queue is polled
+        qpairs (list): the IO qpairs to poll
+                       default: None, only poll the admin queue
+        timeout (int): default timeout (in seconds) of commands
+                       default: 30
+
+    Example:
+```python
+        >>> async def test(nvme0, nvme0n1, q, buf):
+        >>>     p = Poller(nvme0, [q])
+        >>>     cdw0, status = await p.submit(nvme0.getfeatures, 7)
+        >>>     await asyncio.gather(p.submit(nvme0n1.read, q, buf, 0, 8),
+        >>>                          p.submit(nvme0.identify, Buffer(4096)))
+        >>> asyncio.get_event_loop().run_until_complete(test(nvme0, nvme0n1, q, buf))
+```
+    """
+
+    def __init__(self, nvme, qpairs=None, timeout=_cTIMEOUT_wrap):
+        self._nvme = nvme
+        self._qpairs = list(qpairs) if qpairs else []
+        self._timeout = timeout
+        self._pending = set()
+        # timeout commands are kept till completion, since the driver still
+        # has the pointer of their callbacks
+        self._expired = set()
+        self._task = None
+
+    def add_qpair(self, qpair):
+        """poll one more IO qpair
+
+        Args:
+            qpair (Qpair): the qpair to poll
+        """
+
+        self._qpairs.append(qpair)
+
+    def submit(self, func, *args, timeout=None, **kwargs):
+        """submit a command and get its awaitable result
+
+        Args:
+            func (function): the command method of Controller or Namespace, e.g. nvme0.getfeatures or nvme0n1.read. It is called with an internal callback as the argument cb.
+            *args: arguments of the command method
+            timeout (int): timeout (in seconds) of this command
+                           default: None, to use the default timeout of the poller
+            **kwargs: keyword arguments of the command method
+
+        Rets:
+            (asyncio.Future): the result is (cdw0, status) of the completion. Raise TimeoutError if the command is not completed in time.
+        """
+
+        loop = asyncio.get_event_loop()
+        c = _PollerCommand()
+        c.future = loop.create_future()
+        c.deadline = loop.time() + (self._timeout if timeout is None else timeout)
+
+        def cb(cdw0, status1):
+            # driver keeps the pointer of this function till completion
+            self._pending.discard(c)
+            self._expired.discard(c)
+            if not c.future.done():
+                c.future.set_result((cdw0, status1))
+        c.cb = cb
+
+        func(*args, cb=cb, **kwargs)
+        self._pending.add(c)
+        if self._task is None:
+            self._task = loop.create_task(self._poll())
+        return c.future
+
+    async def _poll(self):
+        idle = 0
+        try:
+            while self._pending:
+                reaped = self._nvme.reap()
+                for q in self._qpairs:
+                    reaped += len(q.reap())
+
+                # timeout commands do not need polling
+                now = asyncio.get_event_loop().time()
+                for c in [c for c in self._pending if now > c.deadline]:
+                    self._pending.discard(c)
+                    self._expired.add(c)
+                    if not c.future.done():
+                        c.future.set_exception(TimeoutError("pynvme command timeout"))
+
+                # other coroutines run in between, and back off when idle
+                idle = 0 if reaped else min(max(idle*2, 0.00001), _cPOLL_IDLE_MAX)
+                await asyncio.sleep(idle)
+        finally:
+            self._task = None
+
+
 class DotDict(dict):
     """utility class to access dict members by . operation"""
     def __init__(self, *args, **kwargs):
@@ -1844,7 +2935,13 @@ class _IOWorker(object):
     def __init__(self, pciaddr, nsid, lba_start, lba_size, lba_align,
                  lba_random, region_start, region_end,
                  read_percentage, iops, io_count, time, qdepth, qprio,
-                 output_io_per_second, output_percentile_latency):
+                 output_io_per_second, output_percentile_latency,
+                 stripe=None, stripe_chunk=0, numa_node=-1, poll_idle_us=0,
+                 batch_doorbell=False, cmb_sq=None, cmb_data=False,
+                 slo_latency_us=0, slo_percentile=99, steady_state_round=0,
+                 steady_state_window=5, known_pattern=False,
+                 verify_scan=False, mismatch_max=1000, slow_io_us=0,
+                 slow_io_max=64, options={}):
         # queue for returning result
         self.q = _mp.Queue()
 
@@ -1854,15 +2951,33 @@ class _IOWorker(object):
                                      lba_start, lba_size, lba_align, lba_random,
                                      region_start, region_end, read_percentage,
                                      iops, io_count, time, qdepth, qprio,
-                                     output_io_per_second, output_percentile_latency))
+                                     output_io_per_second, output_percentile_latency,
+                                     stripe, stripe_chunk, poll_idle_us,
+                                     batch_doorbell, cmb_sq, cmb_data,
+                                     slo_latency_us, slo_percentile,
+                                     steady_state_round, steady_state_window,
+                                     known_pattern, verify_scan, mismatch_max,
+                                     slow_io_us, slow_io_max, options))
         self.output_io_per_second = output_io_per_second
         self.output_percentile_latency = output_percentile_latency
+        self.numa_node = numa_node
+        self.region = (region_start, region_end)
         self.p.daemon = True
 
     def start(self):
         """Start the worker's process"""
-        logging.debug("start ioworker")
-        self.p.start()
+        logging.debug("start ioworker on numa node %d" % self.numa_node)
+
+        # the child process places itself by the environment in driver init
+        env = os.environ.get("PYNVME_NUMA_NODE")
+        os.environ["PYNVME_NUMA_NODE"] = str(self.numa_node)
+        try:
+            self.p.start()
+        finally:
+            if env is None:
+                del os.environ["PYNVME_NUMA_NODE"]
+            else:
+                os.environ["PYNVME_NUMA_NODE"] = env
         return self
 
     def find_percentile_latency(self, k, output_io_per_latency):
@@ -1881,8 +2996,25 @@ class _IOWorker(object):
         """
 
         # get data from queue before joinging the subprocess, otherwise deadlock
-        error, rets, output_io_per_second, output_io_per_latency = self.q.get()
+        error, rets, output_io_per_second, output_io_per_latency, devices, doorbell, mismatch, slow = self.q.get()
         rets = DotDict(rets)
+        if devices is not None:
+            rets['devices'] = [DotDict(r) for r in devices]
+        if doorbell is not None:
+            rets['doorbell'] = DotDict(doorbell)
+        if mismatch is not None:
+            rets['mismatch'] = [DotDict(m) for m in mismatch]
+        if slow is not None:
+            rets['slow_io'] = _slow_io_records(slow[0])
+            rets['slow_io_dropped'] = slow[1]
+
+        # host cpu efficiency: busy cycles exclude waiting for the device
+        io_count = rets.io_count_read + rets.io_count_write
+        busy = rets.cycles_total - rets.cycles_poll_empty - rets.cycles_idle
+        rets['cycles_hz'] = d.driver_get_ticks_hz()
+        rets['cycles_per_io'] = busy//io_count if io_count else 0
+        rets['poll_productive_ratio'] = 1-rets.poll_empty_count/rets.poll_count if rets.poll_count else 0
+        rets['host_busy_ratio'] = busy/rets.cycles_total if rets.cycles_total else 0
         self.p.join()
         logging.debug("ioworker closed")
 
@@ -1945,11 +3077,26 @@ class _IOWorker(object):
     def _ioworker(self, rqueue, pciaddr, nsid, lba_start, lba_size,
                   lba_align, lba_random, region_start, region_end,
                   read_percentage, iops, io_count, time, qdepth, qprio,
-                  output_io_per_second, output_percentile_latency):
+                  output_io_per_second, output_percentile_latency,
+                  stripe, stripe_chunk, poll_idle_us, batch_doorbell,
+                  cmb_sq, cmb_data, slo_latency_us, slo_percentile,
+                  steady_state_round, steady_state_window, known_pattern,
+                  verify_scan, mismatch_max, slow_io_us, slow_io_max,
+                  options):
         cdef d.ioworker_args args
         cdef d.ioworker_rets rets
+        cdef d.ioworker_rets* target_rets = NULL
+        cdef d.namespace** target_ns = NULL
+        cdef d.qpair** target_qpair = NULL
         cdef int error = 0
         output_io_per_latency = None
+        devices = None
+        doorbell = None
+        mismatch = None
+        slow = None
+        controllers = {}
+        namespaces = {}
+        qpairs = []
 
         try:
             # register events in worker's processor
@@ -1987,18 +3134,66 @@ class _IOWorker(object):
             args.io_count = io_count
             args.seconds = time
             args.qdepth = qdepth
-
-            # runtime in subprocess
-            nvme0 = Controller(pciaddr)
-            nvme0n1 = Namespace(nvme0, nsid)
-            qpair = Qpair(nvme0, max(2, qdepth), qprio)
+            args.stripe_chunk = stripe_chunk
+            args.poll_idle_us = poll_idle_us
+            args.cmb_data = cmb_data
+            args.slo_latency_us = slo_latency_us
+            args.slo_percentile = int(slo_percentile*100)
+            args.ss_round_seconds = steady_state_round
+            args.ss_window = steady_state_window
+            args.known_pattern = known_pattern
+            args.verify_scan = verify_scan
+            if verify_scan:
+                args.mismatch_max = mismatch_max
+                args.mismatch = <d.ioworker_mismatch*>PyMem_Malloc(mismatch_max*sizeof(d.ioworker_mismatch))
+
+            # the process runs on its own core claimed in driver init
+            assert d.driver_core_get() >= 0, "no free core for the ioworker"
+
+            # runtime in subprocess: one controller for each device, and
+            # one namespace and qpair for each striped target. NVMe/TCP
+            # controllers are connected again in the process.
+            targets = [(pciaddr, nsid, options)] + (stripe or [])
+            count = len(targets)
+            target_ns = <d.namespace**>PyMem_Malloc(count*sizeof(d.namespace*))
+            target_qpair = <d.qpair**>PyMem_Malloc(count*sizeof(d.qpair*))
+            for i, (bdf, n, kwargs) in enumerate(targets):
+                if bdf not in controllers:
+                    controllers[bdf] = Controller(bdf, **kwargs)
+                if (bdf, n) not in namespaces:
+                    namespaces[(bdf, n)] = Namespace(controllers[bdf], n)
+                qpairs.append(Qpair(controllers[bdf], max(2, qdepth), qprio,
+                                    batch_doorbell, cmb_sq))
+                target_ns[i] = (<Namespace>namespaces[(bdf, n)])._ns
+                target_qpair[i] = (<Qpair>qpairs[i])._qpair
+
+            # records of slow io are collected in this process
+            if slow_io_us:
+                slow_io_trace(slow_io_us, slow_io_max)
 
             # ioworker main roution
-            error = d.ioworker_entry(nvme0n1._ns, qpair._qpair, &args, &rets)
-
-            # transfer back iops counter per second: c => cython
+            if stripe:
+                target_rets = <d.ioworker_rets*>PyMem_Malloc(count*sizeof(d.ioworker_rets))
+                error = d.ioworker_entry_striped(target_ns, target_qpair, count,
+                                                 &args, &rets, target_rets)
+                devices = [target_rets[i] for i in range(count)]
+            else:
+                error = d.ioworker_entry(target_ns[0], target_qpair[0], &args, &rets)
+
+            # doorbell statistics of all qpairs
+            if batch_doorbell:
+                doorbell = {'cmds': 0, 'rings': 0, 'batch': {}}
+                for q in qpairs:
+                    db = q.doorbell
+                    doorbell['cmds'] += db['cmds']
+                    doorbell['rings'] += db['rings']
+                    for k, v in db['batch'].items():
+                        doorbell['batch'][k] = doorbell['batch'].get(k, 0) + v
+
+            # transfer back iops counter per second: c => cython, till the
+            # steady state which could be reached before time
             if output_io_per_second is not None:
-                for i in range(time):
+                for i in range(rets.ss_seconds or time):
                     output_io_per_second.append(args.io_counter_per_second[i])
 
             # transfer back percentile latency: c => cython
@@ -2007,22 +3202,40 @@ class _IOWorker(object):
                 for i in range(1000*1000):
                     output_io_per_latency.append(args.io_counter_per_latency[i])
 
+            # transfer back mismatched ranges of verify scan: c => cython
+            if verify_scan:
+                mismatch = [args.mismatch[i] for i in range(rets.mismatch_count)]
+
+            # transfer back slow io records: c => cython
+            if slow_io_us:
+                slow = _slow_io_get()
+                slow_io_trace(0)
+
         except Exception as e:
             logging.warning(e)
             warnings.warn(e)
             error = -1
         finally:
             # feed return to main process
-            rqueue.put((error, rets, output_io_per_second, output_io_per_latency))
+            rqueue.put((error, rets, output_io_per_second, output_io_per_latency, devices, doorbell, mismatch, slow))
 
             # close resources in right order
-            nvme0n1.close()
+            for ns in namespaces.values():
+                ns.close()
 
             # delete resources
-            if 'qpair' in locals():
-                del qpair
-            del nvme0n1
-            del nvme0
+            del qpairs
+            del namespaces
+            del controllers
+
+            if target_ns:
+                PyMem_Free(target_ns)
+
+            if target_qpair:
+                PyMem_Free(target_qpair)
+
+            if target_rets:
+                PyMem_Free(target_rets)
 
             if args.io_counter_per_second:
                 PyMem_Free(args.io_counter_per_second)
@@ -2030,6 +3243,9 @@ class _IOWorker(object):
             if args.io_counter_per_latency:
                 PyMem_Free(args.io_counter_per_latency)
 
+            if args.mismatch:
+                PyMem_Free(args.mismatch)
+
 
 def config(verify, fua_read=False, fua_write=False):
     """config driver global setting
@@ -2049,8 +3265,202 @@ def config(verify, fua_read=False, fua_write=False):
     d.driver_config((verify << 0) |
                     (fua_read << 1) |
                     (fua_write << 2))
-    
-    
+
+
+def attach(addrs, **kwargs):
+    """probe and initialize multiple controllers together
+
+    PCIe devices are initialized concurrently, so the time is decided by the slowest device, instead of the sum of all devices. NVMe/TCP targets are connected one by one.
+
+    Args:
+        addrs (list): addresses of the devices, refer to Controller
+        kwargs: options of all controllers, refer to Controller
+
+    Returns:
+        (list): DotDict of each device in the order of addrs: nvme, the Controller object or None; attach_us, the time to get the device ready; error, None or the error message
+
+    Examples:
+```python
+        >>> for r in nvme.attach([b'01:00.0', b'02:00.0']):
+        >>>     assert r.error is None, r.error
+        >>>     logging.info("%s ready in %d us" % (r.nvme, r.attach_us))
+```
+    """
+
+    cdef d.ctrlr_options options
+    cdef char** traddrs
+    cdef d.ctrlr** ctrlrs
+    cdef unsigned long* attach_us
+    cdef int* errors
+    cdef unsigned int count = len(addrs)
+
+    if count == 0:
+        return []
+
+    _ctrlr_options_init(&options,
+                        kwargs.get('cmb_sqs', False),
+                        kwargs.get('port', 4420),
+                        kwargs.get('subnqn', None),
+                        kwargs.get('header_digest', False),
+                        kwargs.get('data_digest', False),
+                        kwargs.get('io_queues', 0),
+                        kwargs.get('io_queue_size', 0))
+    traddrs = <char**>PyMem_Malloc(count*sizeof(char*))
+    ctrlrs = <d.ctrlr**>PyMem_Malloc(count*sizeof(d.ctrlr*))
+    attach_us = <unsigned long*>PyMem_Malloc(count*sizeof(unsigned long))
+    errors = <int*>PyMem_Malloc(count*sizeof(int))
+    if traddrs == NULL or ctrlrs == NULL or attach_us == NULL or errors == NULL:
+        PyMem_Free(traddrs)
+        PyMem_Free(ctrlrs)
+        PyMem_Free(attach_us)
+        PyMem_Free(errors)
+        raise MemoryError()
+
+    for i in range(count):
+        ctrlrs[i] = NULL
+    try:
+        for i, addr in enumerate(addrs):
+            assert len(addr) < 20, "invalid address: %s" % addr
+            traddrs[i] = addr
+        if d.nvme_probe_multi(traddrs, count, &options, ctrlrs, attach_us, errors) < 0:
+            raise MemoryError()
+
+        rets = []
+        for i, addr in enumerate(addrs):
+            ret = DotDict(nvme=None, attach_us=attach_us[i], error=None)
+            if ctrlrs[i] == NULL:
+                if errors[i] == -errno.ENODEV:
+                    ret.error = "device %s is not found, or it is already attached" % addr
+                elif errors[i] == -errno.EIO:
+                    ret.error = "fail to initialize the controller %s" % addr
+                else:
+                    ret.error = "fail to probe the device %s: %s" % (addr, os.strerror(-errors[i]))
+            else:
+                _attached_ctrlrs[addr] = <uintptr_t>ctrlrs[i]
+                try:
+                    ret.nvme = Controller(addr, **kwargs)
+                except Exception as e:
+                    ret.error = str(e)
+                finally:
+                    # the failed Controller object has detached its ctrlr,
+                    # detach the ctrlr when it is not taken at all
+                    if _attached_ctrlrs.pop(addr, None) is not None:
+                        d.nvme_fini(ctrlrs[i])
+                    ctrlrs[i] = NULL
+            rets.append(ret)
+        return rets
+    finally:
+        # detach the remaining ctrlrs when any exception is raised
+        for i in range(count):
+            if ctrlrs[i] != NULL:
+                _attached_ctrlrs.pop(addrs[i], None)
+                d.nvme_fini(ctrlrs[i])
+        PyMem_Free(traddrs)
+        PyMem_Free(ctrlrs)
+        PyMem_Free(attach_us)
+        PyMem_Free(errors)
+
+
+def metrics():
+    """get live io statistics of qpairs and ioworkers
+
+    The same text is also served by the rpc method get_nvme_metrics, so
+    dashboards can scrape it while the test is running.
+
+    Returns:
+        (str): metrics in Prometheus text exposition format
+    """
+
+    cdef char* buf
+    cdef size_t size
+
+    # the length changes with active qpairs and ioworkers
+    size = d.driver_metrics(NULL, 0) + 1024
+    buf = <char*>PyMem_Malloc(size)
+    if buf == NULL:
+        raise MemoryError()
+
+    try:
+        d.driver_metrics(buf, size)
+        return buf.decode('ascii')
+    finally:
+        PyMem_Free(buf)
+
+
+def cores_free():
+    """get the number of free cores, which can be claimed by ioworkers
+
+    Returns:
+        (int): the number of allowed cores not claimed by any process
+    """
+
+    return d.driver_core_free()
+
+
+cdef _slow_io_cmd(d.slow_io_cmd* c, int qid):
+    cmd = [c.cmd[i] for i in range(16)]
+    cpl = [c.cpl[i] for i in range(4)]
+    return dict(name=d.cmd_name(cmd[0]&0xff, qid!=0).decode('ascii'),
+                cid=cmd[0]>>16, nsid=cmd[1], lba=cmd[10]+(cmd[11]<<32),
+                lba_count=(cmd[12]&0xffff)+1, status=(cpl[3]>>17)&0x7ff,
+                time_cmd_us=c.time_cmd_us, time_cpl_us=c.time_cpl_us,
+                cmd=cmd, cpl=cpl)
+
+
+def _slow_io_get():
+    # plain data, which is also transferred from ioworker processes
+    cdef unsigned int count
+    cdef unsigned long dropped
+    cdef d.slow_io_record* r
+
+    records = []
+    r = d.log_slow_io_get(&count, &dropped)
+    for i in range(count):
+        records.append(dict(qid=r[i].qid,
+                            latency_us=r[i].latency_us,
+                            inflight=r[i].inflight,
+                            io=_slow_io_cmd(&r[i].io, r[i].qid),
+                            neighbour=[_slow_io_cmd(&r[i].neighbour[j], r[i].qid)
+                                       for j in range(r[i].neighbour_count)]))
+    return records, dropped
+
+
+def _slow_io_records(records):
+    return [DotDict(r, io=DotDict(r['io']),
+                    neighbour=[DotDict(n) for n in r['neighbour']])
+            for r in records]
+
+
+def slow_io_trace(threshold_us, max=64):
+    """trace the commands slower than the threshold in this process
+
+    Each slow command is recorded with its full command and completion, the
+    outstanding commands in its qpair, and the commands submitted just
+    before and after it in the cmdlog. Starting a new trace clears the
+    recorded commands.
+
+    Args:
+        threshold_us (int): latency threshold of slow commands, 0 to stop the trace
+        max (int): maximum commands recorded, the others are counted as dropped
+                   default: 64
+    """
+
+    assert threshold_us >= 0 and max > 0
+    if d.log_slow_io_trace(threshold_us, max) != 0:
+        raise MemoryError()
+
+
+def slow_io():
+    """get the slow commands recorded by slow_io_trace()
+
+    Rets:
+        (DotDict): "records" is the list of slow commands, and "dropped" is the count of slow commands not recorded. Each record has qid, latency_us, inflight, "io" of the slow command, and the list of its "neighbour" commands. A command has its name, cid, nsid, lba, lba_count, status, time_cmd_us, time_cpl_us (0 if not completed yet), and all dwords in cmd and cpl.
+    """
+
+    records, dropped = _slow_io_get()
+    return DotDict(records=_slow_io_records(records), dropped=dropped)
+
+
 # module init, needs root privilege
 if os.geteuid() == 0:
     # CTRL-c to exit